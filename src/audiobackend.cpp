@@ -0,0 +1,240 @@
+//
+//  audiobackend.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "audiobackend.h"
+#include "littledaw.h"
+#include <chrono>
+
+/*
+ PortAudioBackend constructor
+*/
+PortAudioBackend::PortAudioBackend() {
+    this->outputParameters = new PaStreamParameters;
+    this->stream = NULL;
+    this->err = paNoError;
+    this->initialized = false;
+    this->daw = NULL;
+}
+
+/*
+ PortAudioBackend destructor
+*/
+PortAudioBackend::~PortAudioBackend() {
+    this->close();
+    delete this->outputParameters;
+}
+
+/*
+ Initialize PortAudio and open a stream on the default output device
+   TAKES:
+     daw               --> Daw * passed to Daw::callback as user data
+     sample_rate       --> int sample rate in Hz
+     num_channels      --> int number of output channels
+     frames_per_buffer --> int frames per callback
+*/
+int PortAudioBackend::open(Daw *daw, int sample_rate, int num_channels,
+                           int frames_per_buffer) {
+    const PaDeviceInfo *info;
+    
+    this->daw = daw;
+    this->err = Pa_Initialize();
+    if(this->err != paNoError) return 1;
+    this->initialized = true;
+    // setup output parameters for Pa_OpenStream()
+    this->outputParameters->device = Pa_GetDefaultOutputDevice();
+    if(this->outputParameters->device == paNoDevice) {
+        this->err = paInvalidDevice;
+        return 1;
+    }
+    info = Pa_GetDeviceInfo(this->outputParameters->device);
+    this->outputParameters->channelCount = num_channels;
+    this->outputParameters->sampleFormat = paFloat32; // 32 bit floating point samples
+    this->outputParameters->suggestedLatency = info->defaultLowOutputLatency;
+    this->outputParameters->hostApiSpecificStreamInfo = NULL;
+    // open stream
+    this->err = Pa_OpenStream(&(this->stream),
+                              NULL,
+                              this->outputParameters,
+                              sample_rate,
+                              frames_per_buffer,
+                              paClipOff,
+                              Daw::callback,
+                              daw);
+    return (this->err != paNoError);
+}
+
+/*
+ Start the PortAudio stream
+*/
+int PortAudioBackend::start() {
+    this->daw->mixer->set_running(true); // before the first callback
+    this->err = Pa_StartStream(this->stream);
+    if(this->err != paNoError) this->daw->mixer->set_running(false);
+    return (this->err != paNoError);
+}
+
+/*
+ Stop the PortAudio stream
+*/
+int PortAudioBackend::stop() {
+    if(this->stream == NULL) return 0;
+    this->err = Pa_StopStream(this->stream);
+    if(this->err != paNoError) return 1;
+    this->daw->mixer->set_running(false); // no callback is left running
+    return 0;
+}
+
+/*
+ Close the stream and terminate PortAudio
+*/
+int PortAudioBackend::close() {
+    if(this->stream != NULL) {
+        this->err = Pa_CloseStream(this->stream); // aborts a running stream
+        this->stream = NULL;
+        if(this->err != paNoError) return 1;
+        this->daw->mixer->set_running(false);
+    }
+    if(this->initialized) {
+        this->initialized = false;
+        this->err = Pa_Terminate();
+        if(this->err != paNoError) return 1;
+    }
+    return 0;
+}
+
+/*
+ Text for the last PortAudio error
+*/
+const char *PortAudioBackend::error_text() {
+    return Pa_GetErrorText(this->err);
+}
+
+/*
+ OfflineBackend constructor
+   TAKES:
+     path   --> const char * output file
+     format --> FORMAT_WAV or FORMAT_RAW
+*/
+OfflineBackend::OfflineBackend(const char *path, int format) {
+    this->daw = NULL;
+    this->path = path;
+    this->err = "no error";
+    this->format = format;
+    this->sample_rate = 0;
+    this->num_channels = 0;
+    this->frames_per_buffer = 0;
+    this->buffer = NULL;
+    this->hook = NULL;
+    this->hook_data = NULL;
+    this->rendered_seconds = 0.0;
+    this->wall_seconds = 0.0;
+}
+
+/*
+ OfflineBackend destructor
+*/
+OfflineBackend::~OfflineBackend() {
+    this->close();
+}
+
+/*
+ Open the output file and allocate the render buffer
+*/
+int OfflineBackend::open(Daw *daw, int sample_rate, int num_channels,
+                         int frames_per_buffer) {
+    this->daw = daw;
+    this->sample_rate = sample_rate;
+    this->num_channels = num_channels;
+    this->frames_per_buffer = frames_per_buffer;
+    if(this->writer.open(this->path, sample_rate, num_channels, this->format)) {
+        this->err = "could not open output file";
+        return 1;
+    }
+    this->buffer = new float[frames_per_buffer * num_channels];
+    return 0;
+}
+
+/*
+ Nothing runs until render() is called
+*/
+int OfflineBackend::start() {
+    return 0;
+}
+
+int OfflineBackend::stop() {
+    return 0;
+}
+
+/*
+ Finish the output file and free the render buffer
+*/
+int OfflineBackend::close() {
+    delete [] this->buffer;
+    this->buffer = NULL;
+    if(this->writer.close()) {
+        this->err = "could not finish output file";
+        return 1;
+    }
+    return 0;
+}
+
+const char *OfflineBackend::error_text() {
+    return this->err;
+}
+
+/*
+ Register a function to run before each buffer is rendered
+   TAKES:
+     hook --> BufferHook called with the frame position and length of
+              each buffer
+     data --> void * passed through to hook
+*/
+void OfflineBackend::set_hook(BufferHook hook, void *data) {
+    this->hook = hook;
+    this->hook_data = data;
+}
+
+/*
+ Render to disk as fast as possible
+   TAKES:
+     seconds --> double length of audio to render
+   RETURNS:
+     0 on success, 1 on a write error
+*/
+int OfflineBackend::render(double seconds) {
+    unsigned long total = (unsigned long)(seconds * this->sample_rate);
+    unsigned long frame = 0;
+    unsigned long n;
+    std::chrono::steady_clock::time_point t0, t1;
+    
+    if(this->buffer == NULL) return 1;
+    t0 = std::chrono::steady_clock::now();
+    while(frame < total) {
+        n = total - frame;
+        if(n > (unsigned long)this->frames_per_buffer) n = this->frames_per_buffer;
+        if(this->hook != NULL) this->hook(frame, n, this->hook_data);
+        Daw::callback(NULL, this->buffer, n, NULL, 0, this->daw);
+        if(this->writer.write(this->buffer, n)) {
+            this->err = "short write to output file";
+            return 1;
+        }
+        frame += n;
+    }
+    t1 = std::chrono::steady_clock::now();
+    this->rendered_seconds = (double)frame / this->sample_rate;
+    this->wall_seconds = std::chrono::duration<double>(t1 - t0).count();
+    return 0;
+}
+
+/*
+ Seconds of audio rendered per second of wall clock in the last render()
+*/
+double OfflineBackend::realtime_factor() {
+    if(this->wall_seconds <= 0.0) return 0.0;
+    return this->rendered_seconds / this->wall_seconds;
+}
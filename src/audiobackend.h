@@ -0,0 +1,81 @@
+//
+//  audiobackend.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef audiobackend_h
+#define audiobackend_h
+
+#include "wavfile.h"
+#include "portaudio.h"
+
+class Daw;
+
+// AudioBackend abstract base class: drives Daw::callback
+class AudioBackend {
+public:
+    virtual ~AudioBackend() {};
+    // abstract interface, each returns 0 on success
+    virtual int open(Daw*, int, int, int) = 0; // daw, rate, channels, frames
+    virtual int start() = 0;
+    virtual int stop() = 0;
+    virtual int close() = 0;
+    virtual const char *error_text() = 0;
+};
+
+// Realtime output through the default PortAudio device
+class PortAudioBackend : public AudioBackend {
+    PaStreamParameters *outputParameters; //struct for stream parameters
+    PaStream *stream;
+    PaError err;
+    bool initialized;
+    Daw *daw;
+public:
+    PortAudioBackend();
+    ~PortAudioBackend();
+    // AudioBackend interface overrides
+    int open(Daw*, int, int, int);
+    int start();
+    int stop();
+    int close();
+    const char *error_text();
+};
+
+// Pulls buffers from the daw as fast as the CPU allows, writes to disk
+class OfflineBackend : public AudioBackend, public WavFileConstants {
+public:
+    // called before each buffer with its frame position and length
+    typedef void (*BufferHook)(unsigned long, unsigned long, void*);
+private:
+    Daw *daw;
+    WavWriter writer;
+    const char *path;
+    const char *err;
+    int format;
+    int sample_rate;
+    int num_channels;
+    int frames_per_buffer;
+    float *buffer;
+    BufferHook hook;
+    void *hook_data;
+    double rendered_seconds;
+    double wall_seconds;
+public:
+    OfflineBackend(const char*, int format=OfflineBackend::FORMAT_WAV);
+    ~OfflineBackend();
+    // AudioBackend interface overrides
+    int open(Daw*, int, int, int);
+    int start();
+    int stop();
+    int close();
+    const char *error_text();
+    // OfflineBackend specific methods
+    void set_hook(BufferHook, void*);
+    int render(double);
+    double realtime_factor();
+};
+
+#endif /* audiobackend_h */
@@ -10,6 +10,104 @@
 #include "littledaw.h"
 #include "instrument.h"
 #include "wavetable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <limits.h>
+#include <math.h>
+#include <chrono>
+#include <time.h>
+
+/*
+ ShellController constructor
+*/
+ShellController::ShellController() {
+    this->loop = NULL;
+    this->daw = NULL;
+    this->instrument = NULL;
+    this->mode = ShellController::MODE_PLAY;
+    this->custom_next = 0;
+    this->stats_timer = -1;
+}
+
+/*
+ Start reading commands from the terminal
+   TAKES:
+     loop       --> EventLoop * to watch stdin on
+     daw        --> Daw * to queue events on
+     instrument --> Instrument * the keys play
+   RETURNS:
+     0 on success, 1 if the loop has no room
+*/
+int ShellController::attach(EventLoop *loop, void *daw, void *instrument) {
+    this->loop = loop;
+    this->daw = daw;
+    this->instrument = (Instrument*)instrument;
+    if(loop->add_fd(STDIN_FILENO, ShellController::on_input, this)) return 1;
+    this->prompt();
+    return 0;
+}
+
+/*
+ Forget the loop once it has stopped
+*/
+void ShellController::detach() {
+    this->loop = NULL;
+    this->stats_timer = -1;
+}
+
+/*
+ stdin is readable: take whatever has arrived and handle complete lines.
+ End of input quits, like 'X'.
+*/
+void ShellController::on_input(int fd, void *shell) {
+    ShellController *sh = (ShellController*)shell;
+    char buf[ShellController::INPUT_CHUNK];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    size_t end;
+    
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if(n <= 0) {
+        sh->loop->remove_fd(fd);
+        sh->handle_line("X");
+        return;
+    }
+    sh->pending.append(buf, n);
+    while((end = sh->pending.find('\n')) != std::string::npos && sh->loop != NULL) {
+        std::string line = sh->pending.substr(0, end);
+        sh->pending.erase(0, end + 1);
+        if(sh->mode == ShellController::MODE_CUSTOM) {
+            sh->custom_line(line);
+        } else {
+            sh->handle_line(line);
+        }
+        if(!sh->loop->is_running()) return;
+    }
+    sh->prompt();
+}
+
+/*
+ Print the prompt for the current input mode
+*/
+void ShellController::prompt() {
+    if(this->mode == ShellController::MODE_CUSTOM) {
+        if(this->custom_next == 0) {
+            std::cout << "  Fundamental: ";
+        } else {
+            std::cout << "  Hamonic " << this->custom_next << ": ";
+        }
+    } else {
+        std::cout << ">> ";
+    }
+    std::cout.flush();
+}
 
 void ShellController::salutation() {
     std::cout << "\n---------------------------------------------------------------";
@@ -25,7 +123,8 @@ void ShellController::farewell() {
 
 void ShellController::help() {
     std::cout << "\nTo enter a command, type its letter and hit ";
-    std::cout << "RETURN. Each command is\none symbol long.  Don't ";
+    std::cout << "RETURN. Each command is\none symbol long; several ";
+    std::cout << "on one line (\"adg\") play together.  Don't\n";
     std::cout << "include quotations or brackets.\n\n\n";
     std::cout << "      PARTIAL SCHEMATIC OF KEYBOARD:\n\n";
     std::cout << "--------------------- KEYS: ----------------|\n";
@@ -45,7 +144,10 @@ void ShellController::help() {
     std::cout << "\n\n   OTHER COMMANDS:\n   --------------\n";
     std::cout << "     A   --->  Timbre = sine wave\n";
     std::cout << "     S   --->  Timbre = square wave (default)\n";
-    std::cout << "     C   --->  Timbre = custom waveform\n";
+    std::cout << "     C   --->  Timbre = custom waveform (or C 100 50 25 ...)\n";
+    std::cout << "     L   --->  Print DSP load report\n";
+    std::cout << "     P   --->  Toggle periodic DSP stats line\n";
+    std::cout << "     R   --->  Start/stop recording the output (or R file.wav)\n";
     std::cout << "     Z   --->  Print help\n";
     std::cout << "     X   --->  EXIT PROGRAM\n\n";
 }
@@ -70,193 +172,803 @@ void ShellController::error(const char *msg, void *args) {
     std::cerr << "\n";
 }
 
-void ShellController::custom_wave(int *harmonic_amplitudes) {
-    // setup local variables
-    std::string command_str;
-    int command = 0;
-    int loop = 1;
-    int x = 0;
-    
+/*
+ Start building a custom timbre: the following lines are read as
+ harmonic amplitudes by custom_line()
+*/
+void ShellController::custom_wave() {
     // print info to terminal
     std::cout << "\n\t\tSYNTHESIZE A CUSTOM TIMBRE\n\n";
     std::cout << "type 'z' and hit RETURN for custom synthesis info\n";
     std::cout << "type 'x' and hit RETURN to abort custom timbre and return to jam\n";
     std::cout << "type 's' and hit RETURN to synthesize timbre and return to jam\n\n";
     std::cout << "Enter amplitude of each harmonic:\n";
-    // PROMPT FOR, PROCESS, AND STORE USER INPUT
-    while(loop) {
-        // prompt for and then store input value
+    for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) this->harmonics[i] = 0;
+    this->custom_next = 0;
+    this->mode = ShellController::MODE_CUSTOM;
+}
+
+/*
+ Handle one line of custom timbre input
+   TAKES:
+     command_str --> line typed, without its newline
+*/
+void ShellController::custom_line(const std::string &command_str) {
+    Daw *e = (Daw*)this->daw;
+    int command = std::atoi(command_str.c_str());
+    int x = this->custom_next;
+    
+    // validate not empty input
+    if(command_str.length() < 1) {
+        std::cout << "\n\tERROR: invalid command/value\n";
+        std::cout << "\t       amplitudes are {0 <= a <= 100}\n";
+        std::cout << "\t       enter 'z' for custom synthesis help\n\n";
+    // COMMAND 'z': print help
+    } else if(command_str[0] == 'z') {
+        std::cout << "\n   Enter the amplitude {0 <= a <= 100} of each\n";
+        std::cout << "   harmonic, starting with the fundamental.  You can\n";
+        std::cout << "   synthesize at any point with the 's' command.\n\n";
+        std::cout << "         COMMANDS:\n         --------\n";
+        std::cout << "     s   --->  Synthesize waveform\n";
+        std::cout << "     z   --->  Print help\n";
+        std::cout << "     x   --->  Abort custom synthesis\n\n";
+    // COMMAND 'x': abort custom timbre synthesis
+    } else if(command_str[0] == 'x') {
+        std::cout << "\nCUSTOM TIMBRE SYNTHESIS ABORTED\n";
+        this->mode = ShellController::MODE_PLAY;
+    // COMMAND 's' without input: need more user info
+    } else if(command_str[0] == 's' && x == 0) {
+        std::cout << "\n\n\tERROR: Enter amplitude for one or more frequency\n\n";
+    // COMMAND 's': synthesize
+    } else if(command_str[0] == 's' || (x >= (WaveTable::HIGHEST_HARMONIC-1))) {
+        std::cout << "\n";
+        e->command(this->instrument, WaveTableSynth::COMMAND_CUSTOM_WAVE, this->harmonics);
+        this->mode = ShellController::MODE_PLAY;
+    // STORE USER INPUT, PROMPT FOR NEXT HARMONIC
+    } else if((command >= 0) && (command <= 100)) {
+        this->harmonics[x] = command;
+        this->custom_next++;
+    // ERROR: invalid input
+    } else if((command < 0) || (command > 100)) {
+        std::cout << "\tERROR: amplitudes are {0 <= X <= 100}\n";
+    }
+}
+
+/*
+ Print a DSP load report for the last DspStats::WINDOW buffers
+*/
+void ShellController::dsp_report(void *daw) {
+    Daw *e = (Daw*)daw;
+    DspStats::Report r = e->stats->report();
+    unsigned long steals = 0, drops = 0;
+    
+    for(size_t i = 0; i < e->instruments.size(); i++) {
+        steals += e->instruments[i]->get_steals();
+        drops += e->instruments[i]->get_drops();
+    }
+    printf("\n   DSP LOAD (last %d of %lu buffers, %.0f us each):\n",
+           r.window, r.buffers, r.period_us);
+    printf("     render   min %.1f / mean %.1f / p99 %.1f / max %.1f us\n",
+           r.render_min_us, r.render_mean_us, r.render_p99_us, r.render_max_us);
+    printf("     load     mean %.1f%% / p99 %.1f%% / max %.1f%%\n",
+           r.load_mean, r.load_p99, r.load_max);
+    printf("     headroom min %.1f us\n", r.headroom_min_us);
+    printf("     voices   mean %.1f / max %d, %lu stolen, %lu dropped\n",
+           r.voices_mean, r.voices_max, steals, drops);
+    printf("     xruns    %lu underflow, %lu overflow, %lu priming\n",
+           r.underflows, r.overflows, r.priming);
+    printf("     latency  %.1f ms\n", r.latency_ms);
+    for(size_t i = 0; i < e->instruments.size(); i++) {
+        Sampler *sampler = dynamic_cast<Sampler*>(e->instruments[i]);
+        if(sampler == NULL) continue;
+        printf("     sampler  %d samples, %lu cache hits / %lu misses, %lu starved\n",
+               sampler->num_samples(), sampler->get_cache_hits(),
+               sampler->get_cache_misses(), sampler->get_starvations());
+    }
+    for(size_t i = 0; i < e->recorders.size(); i++) {
+        Recorder *rec = e->recorders[i];
+        printf("     record   %.1f s on disk in %d file(s), %lu overruns "
+               "(%.2f s lost)%s\n",
+               (double)rec->get_written() / Daw::DEFAULT_SAMPLE_RATE, rec->get_files(),
+               rec->get_overruns(), (double)rec->get_dropped() / Daw::DEFAULT_SAMPLE_RATE,
+               rec->has_failed() ? ", WRITE FAILED" : "");
+    }
+    printf("\n");
+}
+
+/*
+ Print a one line DSP summary
+*/
+void ShellController::stats_line(void *daw) {
+    DspStats::Report r = ((Daw*)daw)->stats->report();
+    
+    printf("[Stats] load %.1f%% mean, %.1f%% p99, %.1f%% max | voices %d | "
+           "underflows %lu\n", r.load_mean, r.load_p99, r.load_max,
+           r.voices_max, r.underflows);
+    fflush(stdout);
+}
+
+/*
+ Start or stop printing stats_line() every STATS_INTERVAL_MS
+*/
+void ShellController::toggle_stats(void *daw) {
+    if(this->loop == NULL) return;
+    if(this->stats_timer >= 0) {
+        this->loop->remove_timer(this->stats_timer);
+        this->stats_timer = -1;
+    } else {
+        this->daw = daw;
+        this->stats_timer = this->loop->add_timer(ShellController::STATS_INTERVAL_MS,
+                                                  ShellController::on_stats, this);
+    }
+}
+
+void ShellController::on_stats(int timer, void *shell) {
+    ShellController *sh = (ShellController*)shell;
+    (void) timer;
+    sh->stats_line(sh->daw);
+}
+
+/*
+ Start recording the master output, or stop if a take is running
+   TAKES:
+     path --> const char * file to record to; blank for a time-stamped
+              take in the working directory
+*/
+void ShellController::record(const char *path) {
+    Daw *e = (Daw*)this->daw;
+    char name[64];
+    time_t now = time(NULL);
+    
+    while(*path == ' ' || *path == '\t') path++;
+    if(*path == '\0' && e->recording()) {
+        e->stop_recording();
+        this->info("recording stopped");
+        return;
+    }
+    if(*path == '\0') {
+        strftime(name, sizeof(name), "take-%Y%m%d-%H%M%S.wav", localtime(&now));
+        path = name;
+    }
+    if(e->record(path)) {
+        this->error("could not start recording");
+    } else {
+        std::cout << "[Info] recording to " << path << "\n";
+    }
+}
+
+/*
+ Map a keyboard key to a note constant
+   TAKES:
+     key --> char typed at the prompt
+   RETURNS:
+     Instrument note constant, or -1 if the key is not a note
+*/
+int ShellController::key_note(const char key) {
+    switch(key) {
+        case '`': return Instrument::GS2;
+        case '1': return Instrument::A3;
+        case 'q': return Instrument::AS3;
+        case '2': return Instrument::B3;
+        case '3': return Instrument::C3;
+        case 'e': return Instrument::CS3;
+        case '4': return Instrument::D3;
+        case 'r': return Instrument::DS3;
+        case '5': return Instrument::E3;
+        case '6': return Instrument::F3;
+        case 'y': return Instrument::FS3;
+        case '7': return Instrument::G3;
+        case 'u': return Instrument::GS3;
+        case '8': return Instrument::A4;
+        case 'a': return Instrument::A4;
+        case 'z': return Instrument::AS4;
+        case 's': return Instrument::B4;
+        case 'd': return Instrument::C4;
+        case 'c': return Instrument::CS4;
+        case 'f': return Instrument::D4;
+        case 'v': return Instrument::DS4;
+        case 'g': return Instrument::E4;
+        case 'h': return Instrument::F4;
+        case 'n': return Instrument::FS4;
+        case 'j': return Instrument::G4;
+        case 'm': return Instrument::GS4;
+        case 'k': return Instrument::A5;
+        default: return -1;
+    }
+}
+
+/*
+ Handle one line typed at the prompt.  Every character is a key, so a
+ line of notes plays them together; 'C' followed by amplitudes sets a
+ custom timbre directly, and 'C' alone asks for them line by line.
+   TAKES:
+     line --> line typed, without its newline
+*/
+void ShellController::handle_line(const std::string &line) {
+    Daw *e = (Daw*)this->daw;
+    Instrument *inst = this->instrument;
+    const char *p;
+    char *end;
+    char command;
+    int note, x;
+    
+    if(line.length() > 0 && line[0] == 'R') {
+        this->record(line.c_str() + 1);
+        return;
+    }
+    if(line.length() > 0 && line[0] == 'C') {
+        p = line.c_str() + 1;
+        for(x = 0; x < WaveTable::HIGHEST_HARMONIC; x++) {
+            this->harmonics[x] = (int)strtol(p, &end, 10);
+            if(end == p) break;
+            p = end;
+        }
         if(x == 0) {
-            std::cout << "  Fundamental: ";
+            this->custom_wave();
         } else {
-            std::cout << "  Hamonic " << x << ": ";
+            for(; x < WaveTable::HIGHEST_HARMONIC; x++) this->harmonics[x] = 0;
+            e->command(inst, WaveTableSynth::COMMAND_CUSTOM_WAVE, this->harmonics);
         }
-        // get command
-        std::getline(std::cin, command_str);
-        command = std::atoi(command_str.c_str());
-        // validate not empty input
-        if(command_str.length() < 1) {
-            std::cout << "\n\tERROR: invalid command/value\n";
-            std::cout << "\t       amplitudes are {0 <= a <= 100}\n";
-            std::cout << "\t       enter 'z' for custom synthesis help\n\n";
-        // COMMAND 'z': print help
-        } else if(command_str[0] == 'z') {
-            std::cout << "\n   Enter the amplitude {0 <= a <= 100} of each\n";
-            std::cout << "   harmonic, starting with the fundamental.  You can\n";
-            std::cout << "   synthesize at any point with the 's' command.\n\n";
-            std::cout << "         COMMANDS:\n         --------\n";
-            std::cout << "     s   --->  Synthesize waveform\n";
-            std::cout << "     z   --->  Print help\n";
-            std::cout << "     x   --->  Abort custom synthesis\n\n";
-        // COMMAND 'x': abort custom timbre synthesis
-        } else if(command_str[0] == 'x') {
-            std::cout << "\nCUSTOM TIMBRE SYNTHESIS ABORTED\n";
-            loop = 0;
-            return;
-        // COMMAND 's' without input: need more user info
-        } else if(command_str[0] == 's' && x == 0) {
-            std::cout << "\n\n\tERROR: Enter amplitude for one or more frequency\n\n";
-        // COMMAND 's': synthesize
-        } else if(command_str[0] == 's' || (x >= (WaveTable::HIGHEST_HARMONIC-1))) {
-            std::cout << "\n";
-            loop = 0;
-        // STORE USER INPUT, PROMPT FOR NEXT HARMONIC
-        } else if((command >= 0) && (command <= 100)) {
-            harmonic_amplitudes[x] = command;
-            x++;
-        // ERROR: invalid input
-        } else if((command < 0) || (command > 100)) {
-            std::cout << "\tERROR: amplitudes are {0 <= X <= 100}\n";
+        return;
+    }
+    for(size_t i = 0; i < line.length(); i++) {
+        command = line[i];
+        if(command == ' ' || command == '\t' || command == '\r') continue;
+        /* NOTE COMMANDS: Pitch is calculated based on the octave and
+        the frequencies found in the BASE_HZ array.
+        */
+        note = ShellController::key_note(command);
+        if(note >= 0) {
+            if(e->trigger(inst, note)) this->error("event queue full");
+            continue;
+        }
+        switch(command) {
+            // TIMBRE COMMANDS: Wavetable is rewritten to create a new timbre
+            case 'A': // SINE WAVE
+                e->command(inst, WaveTableSynth::COMMAND_SINE_WAVE);
+                break;
+            case 'S': // SQUARE WAVE
+                e->command(inst, WaveTableSynth::COMMAND_SQUARE_WAVE);
+                break;
+            case 'L': // DSP LOAD REPORT
+                this->dsp_report(e);
+                break;
+            case 'P': // PERIODIC STATS LINE ON/OFF
+                this->toggle_stats(e);
+                break;
+            case 'Z': // PRINT OPERATING INFO TO TERMINAL
+                this->help();
+                break;
+            case 'X':
+                // stops the event loop; the daw fades out
+                if(this->stats_timer >= 0) this->toggle_stats(e);
+                this->loop->stop();
+                return;
+            default:
+                this->info("NOT A NOTE!\n");
         }
     }
-    std::cin.clear();
-    return;
 }
 
-void ShellController::input_loop(bool *loop, void *daw, void *instrument) {
-    char command;
-    int ha[WaveTable::HIGHEST_HARMONIC] = {0};
+/*
+ ScriptController constructor
+*/
+ScriptController::ScriptController() {
+    this->next = 0;
+    this->next_target = 0;
+    this->sample_rate = 44100;
+    this->origin = 0;
+    this->loop = NULL;
+    this->daw = NULL;
+    this->timer = -1;
+}
+
+/*
+ Load a session script.  Each line holds a time in seconds and a shell
+ command key; 'C' lines are followed by the harmonic amplitudes.  Lines
+ starting with '#' are comments.  Events must be in time order.
+     0.0  a
+     0.5  C 100 50 25
+   TAKES:
+     path        --> const char * script file
+     sample_rate --> int used to convert seconds to frames
+   RETURNS:
+     0 on success, 1 if the file could not be read
+*/
+int ScriptController::load(const char *path, int sample_rate) {
+    FILE *f = fopen(path, "r");
+    char line[256];
+    char *p;
+    double seconds;
+    int consumed, x;
+    ScriptEvent ev;
+    
+    if(f == NULL) return 1;
+    this->events.clear();
+    this->next = 0;
+    this->next_target = 0;
+    this->sample_rate = sample_rate;
+    while(fgets(line, sizeof(line), f) != NULL) {
+        if(line[0] == '#') continue;
+        if(sscanf(line, " %lf %c%n", &seconds, &ev.command, &consumed) < 2) {
+            continue; // blank line
+        }
+        ev.frame = (unsigned long)(seconds * sample_rate);
+        p = line + consumed;
+        for(x = 0; x < WaveTable::HIGHEST_HARMONIC; x++) {
+            ev.harmonics[x] = (int)strtol(p, &p, 10);
+        }
+        this->events.push_back(ev);
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ Apply every scripted command that starts before a frame.  Notes are
+ stamped with their own frame; timbre commands take effect straight away.
+ A note the event queue has no room for is tried again on the next call,
+ from the instrument that missed it.
+   TAKES:
+     frame       --> unsigned long engine frame to play up to
+     daw         --> Daw * to queue events on
+     instruments --> Instruments to play, all get every command
+*/
+void ScriptController::play(unsigned long frame, void *daw,
+                            std::vector<Instrument*> &instruments) {
     Daw *e = (Daw*)daw;
-    Instrument *inst = (Instrument*)instrument;
+    Instrument *inst;
+    ScriptEvent *ev;
+    unsigned long at;
+    int note;
     
-    std::cout << ">> "; // print the prompt
-    command = getc(stdin); // get command char
-    getc(stdin); // eat newline
-    switch(command) {
-            /* NOTE COMMANDS: Pitch is calculated based on the octave and
-            the frequencies found in the BASE_HZ array.
-            Then, incomming_note is changed to 1,
-            causing the polyphony operator child
-            process to execute the note with
-            envelope.
-            */
-        case '`':
-            inst->trigger(Instrument::GS2);
-            break;
-        case '1':
-            inst->trigger(Instrument::A3);
-            break;
-        case 'q':
-            inst->trigger(Instrument::AS3);
-            break;
-        case '2':
-            inst->trigger(Instrument::B3);
-            break;
-        case '3':
-            inst->trigger(Instrument::C3);
-            break;
-        case 'e':
-            inst->trigger(Instrument::CS3);
-            break;
-        case '4':
-            inst->trigger(Instrument::D3);
-            break;
-        case 'r':
-            inst->trigger(Instrument::DS3);
-            break;
-        case '5':
-            inst->trigger(Instrument::E3);
-            break;
-        case '6':
-            inst->trigger(Instrument::F3);
-            break;
-        case 'y':
-            inst->trigger(Instrument::FS3);
-            break;
-        case '7':
-            inst->trigger(Instrument::G3);
-            break;
-        case 'u':
-            inst->trigger(Instrument::GS3);
-            break;
-        case '8':
-            inst->trigger(Instrument::A4);
-            break;
-        case 'a':
-            inst->trigger(Instrument::A4);
-            break;
-        case 'z':
-            inst->trigger(Instrument::AS4);
-            break;
-        case 's':
-            inst->trigger(Instrument::B4);
-            break;
-        case 'd':
-            inst->trigger(Instrument::C4);
-            break;
-        case 'c':
-            inst->trigger(Instrument::CS4);
-            break;
-        case 'f':
-            inst->trigger(Instrument::D4);
-            break;
-        case 'v':
-            inst->trigger(Instrument::DS4);
-            break;
-        case 'g':
-            inst->trigger(Instrument::E4);
-            break;
-        case 'h':
-            inst->trigger(Instrument::F4);
-            break;
-        case 'n':
-            inst->trigger(Instrument::FS4);
-            break;
-        case 'j':
-            inst->trigger(Instrument::G4);
-            break;
-        case 'm':
-            inst->trigger(Instrument::GS4);
-            break;
-        case 'k':
-            inst->trigger(Instrument::A5);
-            break;
-        // TIMBRE COMMANDS: Wavetable is rewritten to create a new timbre
-        case 'A': // SINE WAVE
-            e->mixer->fade_out();
-            inst->command(WaveTableSynth::COMMAND_SINE_WAVE, this);
-            e->mixer->fade_in();
-            break;
-        case 'S': // SQUARE WAVE
-            e->mixer->fade_out();
-            inst->command(WaveTableSynth::COMMAND_SQUARE_WAVE, this);
-            e->mixer->fade_in();
-            break;
-        case 'C': // CREATE CUSTOM TIMBRE
-            e->mixer->fade_out();
-            this->custom_wave(ha);
-            inst->command(WaveTableSynth::COMMAND_CUSTOM_WAVE, ha);
-            e->mixer->fade_in();
-            break;
-        case 'Z': // PRINT OPERATING INFO TO TERMINAL
-            this->help();
-            break;
-        case 'X':
-            // stops the while loop
-            *loop = false;
-            e->mixer->fade_out();
-            break;
-        default:
-            this->info("NOT A NOTE!\n");
+    while(this->next < this->events.size() &&
+          this->origin + this->events[this->next].frame < frame) {
+        ev = &(this->events[this->next]);
+        at = this->origin + ev->frame;
+        note = ShellController::key_note(ev->command);
+        for(; this->next_target < instruments.size(); this->next_target++) {
+            inst = instruments[this->next_target];
+            if(note >= 0) {
+                if(e->trigger(inst, note, at)) return; // queue full
+            } else if(ev->command == 'A') {
+                e->command(inst, WaveTableSynth::COMMAND_SINE_WAVE);
+            } else if(ev->command == 'S') {
+                e->command(inst, WaveTableSynth::COMMAND_SQUARE_WAVE);
+            } else if(ev->command == 'C') {
+                e->command(inst, WaveTableSynth::COMMAND_CUSTOM_WAVE, ev->harmonics);
+            }
+        }
+        this->next_target = 0;
+        this->next++;
     }
 }
+
+/*
+ Play the script live, from the start, on an instrument.  Mapping the
+ script to several instruments plays every one of them.
+   TAKES:
+     loop       --> EventLoop * to run the playback timer on
+     daw        --> Daw * to queue events on
+     instrument --> Instrument * to play
+   RETURNS:
+     0 on success, 1 if the loop has no room for a timer
+*/
+int ScriptController::attach(EventLoop *loop, void *daw, void *instrument) {
+    unsigned long ahead = ((unsigned long)ScriptController::LOOKAHEAD_MS *
+                           this->sample_rate) / 1000;
+    
+    this->targets.push_back((Instrument*)instrument);
+    if(this->timer >= 0) return 0;
+    this->loop = loop;
+    this->daw = daw;
+    this->next = 0;
+    this->next_target = 0;
+    // the first commands are queued exactly one lookahead early
+    this->origin = ((Daw*)daw)->frame_time() + ahead;
+    this->timer = loop->add_timer(ScriptController::TICK_MS, ScriptController::on_tick, this);
+    return (this->timer < 0) ? 1 : 0;
+}
+
+void ScriptController::detach() {
+    this->loop = NULL;
+    this->timer = -1;
+    this->targets.clear();
+}
+
+/*
+ Playback timer: play what falls inside the lookahead window, stop once
+ the script is done
+*/
+void ScriptController::on_tick(int timer, void *script) {
+    ScriptController *sc = (ScriptController*)script;
+    unsigned long ahead = ((unsigned long)ScriptController::LOOKAHEAD_MS *
+                           sc->sample_rate) / 1000;
+    
+    sc->play(((Daw*)sc->daw)->frame_time() + ahead, sc->daw, sc->targets);
+    if(sc->done()) {
+        sc->loop->remove_timer(timer);
+        sc->timer = -1;
+    }
+}
+
+/*
+ True once every scripted command has been played
+*/
+bool ScriptController::done() {
+    return this->next >= this->events.size();
+}
+
+void ScriptController::info(const char *msg) {
+    std::cout << "[Info] " << msg << "\n";
+}
+
+void ScriptController::error(const char *msg) {
+    std::cerr << "[Error] " << msg << "\n";
+}
+
+/*
+ SequencerController constructor
+*/
+SequencerController::SequencerController() {
+    this->next = 0;
+    this->sample_rate = 44100;
+    this->origin = 0;
+    this->loop = NULL;
+    this->daw = NULL;
+    this->timer = -1;
+}
+
+/*
+ Load a .mid file and rewind to its start
+   TAKES:
+     path        --> const char * file to read
+     sample_rate --> int used to convert times to frames
+   RETURNS:
+     0 on success, 1 if the file could not be read
+*/
+int SequencerController::load(const char *path, int sample_rate) {
+    this->next = 0;
+    this->sample_rate = sample_rate;
+    return this->file.load(path, sample_rate);
+}
+
+/*
+ Queue every note that starts before a frame, stamped with its own frame.
+ A note the event queue has no room for is tried again on the next call.
+   TAKES:
+     frame       --> unsigned long engine frame to queue notes up to
+     daw         --> Daw * to queue events on
+     instruments --> Instruments the parts play
+*/
+void SequencerController::play(unsigned long frame, void *daw,
+                               std::vector<Instrument*> &instruments) {
+    Daw *e = (Daw*)daw;
+    const std::vector<MidiFile::Note> &notes = this->file.events();
+    const MidiFile::Note *n;
+    Instrument *inst;
+    unsigned long at;
+    int err;
+    
+    if(instruments.empty()) return;
+    while(this->next < (int)notes.size()) {
+        n = &(notes[this->next]);
+        at = this->origin + n->frame;
+        if(at >= frame) break;
+        inst = instruments[n->part % instruments.size()];
+        err = n->on ? e->trigger(inst, n->note, at) : e->release(inst, n->note, at);
+        if(err) break; // queue full
+        this->next++;
+    }
+}
+
+/*
+ Play the file live, from the start.  Mapping the sequencer to several
+ instruments spreads the parts over them.
+   TAKES:
+     loop       --> EventLoop * to run the playback timer on
+     daw        --> Daw * to queue events on
+     instrument --> Instrument * for the next part
+   RETURNS:
+     0 on success, 1 if the loop has no room for a timer
+*/
+int SequencerController::attach(EventLoop *loop, void *daw, void *instrument) {
+    unsigned long ahead = ((unsigned long)SequencerController::LOOKAHEAD_MS *
+                           this->sample_rate) / 1000;
+    
+    this->targets.push_back((Instrument*)instrument);
+    if(this->timer >= 0) return 0;
+    this->loop = loop;
+    this->daw = daw;
+    this->next = 0;
+    // the first notes are queued exactly one lookahead early
+    this->origin = ((Daw*)daw)->frame_time() + ahead;
+    this->timer = loop->add_timer(SequencerController::TICK_MS,
+                                  SequencerController::on_tick, this);
+    return (this->timer < 0) ? 1 : 0;
+}
+
+void SequencerController::detach() {
+    this->loop = NULL;
+    this->timer = -1;
+    this->targets.clear();
+}
+
+/*
+ Playback timer: queue what falls inside the lookahead window, stop once
+ the file is done
+*/
+void SequencerController::on_tick(int timer, void *sequencer) {
+    SequencerController *sq = (SequencerController*)sequencer;
+    unsigned long ahead = ((unsigned long)SequencerController::LOOKAHEAD_MS *
+                           sq->sample_rate) / 1000;
+    
+    sq->play(((Daw*)sq->daw)->frame_time() + ahead, sq->daw, sq->targets);
+    if(sq->done()) {
+        sq->loop->remove_timer(timer);
+        sq->timer = -1;
+    }
+}
+
+/*
+ True once every note has been queued
+*/
+bool SequencerController::done() {
+    return this->next >= (int)this->file.events().size();
+}
+
+void SequencerController::info(const char *msg) {
+    std::cout << "[Info] " << msg << "\n";
+}
+
+void SequencerController::error(const char *msg) {
+    std::cerr << "[Error] " << msg << "\n";
+}
+
+/*
+ OscController constructor
+   TAKES:
+     port --> int UDP port on 127.0.0.1, or 0 for no UDP socket
+     path --> const char * Unix socket path, or NULL for none
+*/
+OscController::OscController(int port, const char *path) {
+    this->loop = NULL;
+    this->daw = NULL;
+    this->port = port;
+    this->path = (path != NULL) ? path : "";
+    this->udp_fd = -1;
+    this->unix_fd = -1;
+    this->messages = 0;
+    this->dropped = 0;
+    this->malformed = 0;
+    this->unknown = 0;
+}
+
+OscController::~OscController() {
+    this->close_sockets();
+}
+
+/*
+ Listen for OSC and play an instrument.  The first instrument mapped is
+ /0, the next /1 and so on.
+   TAKES:
+     loop       --> EventLoop * to watch the sockets on
+     daw        --> Daw * to queue events on
+     instrument --> Instrument * to play
+   RETURNS:
+     0 on success, 1 if no socket could be opened
+*/
+int OscController::attach(EventLoop *loop, void *daw, void *instrument) {
+    this->targets.push_back((Instrument*)instrument);
+    if(this->loop != NULL) return 0;
+    this->loop = loop;
+    this->daw = daw;
+    if(this->open_sockets()) return 1;
+    if(this->udp_fd >= 0) loop->add_fd(this->udp_fd, OscController::on_packet, this);
+    if(this->unix_fd >= 0) loop->add_fd(this->unix_fd, OscController::on_packet, this);
+    return 0;
+}
+
+void OscController::detach() {
+    this->close_sockets();
+    this->loop = NULL;
+    this->targets.clear();
+}
+
+/*
+ Open the non-blocking datagram sockets
+   RETURNS:
+     0 if at least one is listening
+*/
+int OscController::open_sockets() {
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+    int size = OscController::RECEIVE_BUFFER;
+    char msg[128];
+    
+    if(this->port > 0) {
+        this->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons(this->port);
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(this->udp_fd < 0 || bind(this->udp_fd, (struct sockaddr*)&in, sizeof(in)) != 0) {
+            this->error("could not open the OSC UDP port");
+            if(this->udp_fd >= 0) close(this->udp_fd);
+            this->udp_fd = -1;
+        } else {
+            snprintf(msg, sizeof(msg), "OSC on udp 127.0.0.1:%d", this->port);
+            this->info(msg);
+        }
+    }
+    if(!this->path.empty() && this->path.length() < sizeof(un.sun_path)) {
+        this->unix_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, this->path.c_str());
+        unlink(un.sun_path); // left behind by an earlier run
+        if(this->unix_fd < 0 || bind(this->unix_fd, (struct sockaddr*)&un, sizeof(un)) != 0) {
+            this->error("could not open the OSC Unix socket");
+            if(this->unix_fd >= 0) close(this->unix_fd);
+            this->unix_fd = -1;
+        } else {
+            snprintf(msg, sizeof(msg), "OSC on %s", this->path.c_str());
+            this->info(msg);
+        }
+    }
+    // room for bursts while the loop is busy elsewhere
+    if(this->udp_fd >= 0) {
+        fcntl(this->udp_fd, F_SETFL, O_NONBLOCK);
+        setsockopt(this->udp_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    if(this->unix_fd >= 0) {
+        fcntl(this->unix_fd, F_SETFL, O_NONBLOCK);
+        setsockopt(this->unix_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    return (this->udp_fd < 0 && this->unix_fd < 0) ? 1 : 0;
+}
+
+void OscController::close_sockets() {
+    if(this->loop != NULL) {
+        if(this->udp_fd >= 0) this->loop->remove_fd(this->udp_fd);
+        if(this->unix_fd >= 0) this->loop->remove_fd(this->unix_fd);
+    }
+    if(this->udp_fd >= 0) close(this->udp_fd);
+    if(this->unix_fd >= 0) {
+        close(this->unix_fd);
+        unlink(this->path.c_str());
+    }
+    this->udp_fd = -1;
+    this->unix_fd = -1;
+}
+
+/*
+ A socket is readable: decode up to PACKETS_PER_WAKE datagrams.  All of
+ them reach the audio thread in one batch.
+*/
+void OscController::on_packet(int fd, void *osc) {
+    OscController *oc = (OscController*)osc;
+    ssize_t n;
+    
+    for(int i = 0; i < OscController::PACKETS_PER_WAKE; i++) {
+        n = recv(fd, oc->packet, sizeof(oc->packet), MSG_DONTWAIT);
+        if(n < 0) return; // drained (or a transient error; poll() will say)
+        if(OscReader::parse(oc->packet, n, OscController::on_message, oc)) {
+            oc->malformed++;
+        }
+    }
+}
+
+/*
+ Engine frame for a timetag
+   RETURNS:
+     0 to play with the next buffer, or ULONG_MAX if the tag is further
+     ahead than MAX_AHEAD_MS
+*/
+unsigned long OscController::frame_for(uint64_t tag) {
+    Daw *e = (Daw*)this->daw;
+    std::chrono::system_clock::duration since = 
+        std::chrono::system_clock::now().time_since_epoch();
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(since).count();
+    uint64_t now;
+    double ahead;
+    
+    if(tag == OscController::IMMEDIATELY) return 0;
+    now = ((uint64_t)(us / 1000000) + OscController::NTP_UNIX_OFFSET) << 32;
+    now += ((uint64_t)(us % 1000000) << 32) / 1000000;
+    ahead = (double)(int64_t)(tag - now) / 4294967296.0; // seconds
+    if(ahead <= 0.0) return 0;
+    if(ahead * 1000.0 > OscController::MAX_AHEAD_MS) return ULONG_MAX;
+    return e->frame_time() + (unsigned long)(ahead * Daw::DEFAULT_SAMPLE_RATE);
+}
+
+/*
+ Apply one decoded message
+*/
+void OscController::on_message(const OscMessage &msg, void *osc) {
+    OscController *oc = (OscController*)osc;
+    Daw *e = (Daw*)oc->daw;
+    const char *addr = msg.address + 1;
+    const char *s;
+    char *rest;
+    int index = 0, note, track, x;
+    int harmonics[WaveTable::HIGHEST_HARMONIC];
+    unsigned long frame;
+    Instrument *inst;
+    float f;
+    
+    oc->messages++;
+    if(*addr >= '0' && *addr <= '9') {
+        index = (int)strtol(addr, &rest, 10);
+        if(*rest != '/') {
+            oc->unknown++;
+            return;
+        }
+        addr = rest + 1;
+    }
+    if(index >= (int)oc->targets.size()) {
+        oc->unknown++;
+        return;
+    }
+    inst = oc->targets[index];
+    if(strcmp(addr, "note/on") == 0 || strcmp(addr, "note/off") == 0) {
+        if(!msg.get_int(0, &note) || !Instrument::playable(note)) {
+            oc->malformed++;
+            return;
+        }
+        frame = oc->frame_for(msg.time);
+        if(frame == ULONG_MAX) {
+            oc->dropped++;
+        } else if(addr[6] == 'n' ? e->trigger(inst, note, frame) :
+                                   e->release(inst, note, frame)) {
+            oc->dropped++;
+        }
+    } else if(strcmp(addr, "timbre") == 0) {
+        s = msg.get_string(0);
+        if(s != NULL && strcmp(s, "sine") == 0) {
+            e->command(inst, WaveTableSynth::COMMAND_SINE_WAVE);
+        } else if(s != NULL && strcmp(s, "square") == 0) {
+            e->command(inst, WaveTableSynth::COMMAND_SQUARE_WAVE);
+        } else {
+            oc->malformed++;
+        }
+    } else if(strcmp(addr, "wave") == 0) {
+        for(x = 0; x < WaveTable::HIGHEST_HARMONIC; x++) {
+            if(!msg.get_int(x, &harmonics[x])) break;
+            if(harmonics[x] < 0) harmonics[x] = 0;
+            if(harmonics[x] > 100) harmonics[x] = 100;
+        }
+        if(x == 0) {
+            oc->malformed++;
+            return;
+        }
+        for(; x < WaveTable::HIGHEST_HARMONIC; x++) harmonics[x] = 0;
+        e->command(inst, WaveTableSynth::COMMAND_CUSTOM_WAVE, harmonics);
+    } else if(strcmp(addr, "gain") == 0 || strcmp(addr, "pan") == 0) {
+        track = e->mixer->find_track(inst);
+        if(!msg.get_float(0, &f) || !isfinite(f) || track < 0) {
+            oc->malformed++; // NaN or infinity would poison the mix
+        } else if(addr[0] == 'g') {
+            if(f < 0.0) f = 0.0;
+            if(f > Mixer::MAX_TRACK_GAIN) f = Mixer::MAX_TRACK_GAIN;
+            e->mixer->set_gain(track, f);
+        } else {
+            e->mixer->set_pan(track, f);
+        }
+    } else {
+        oc->unknown++;
+    }
+}
+
+void OscController::farewell() {
+    printf("[Info] OSC: %lu messages, %lu dropped, %lu malformed, %lu unknown\n",
+           this->messages, this->dropped, this->malformed, this->unknown);
+}
+
+void OscController::info(const char *msg) {
+    std::cout << "[Info] " << msg << "\n";
+}
+
+void OscController::error(const char *msg) {
+    std::cerr << "[Error] " << msg << "\n";
+}
@@ -9,13 +9,28 @@
 #ifndef controller_h
 #define controller_h
 
+#include "wavetable.h"
+#include "eventloop.h"
+#include "midifile.h"
+#include "osc.h"
 #include <iostream>
+#include <string>
+#include <vector>
 
-// Controller abstract base class
+class Instrument;
+
+/*
+ Controller abstract base class.  A controller is driven by the Daw's
+ event loop: attach() registers the file descriptors and timers it reads
+ from, once per instrument mapped to it, and its handlers queue events
+ on the Daw as input arrives.  detach() runs after the loop has stopped.
+*/
 class Controller {
 public:
+    virtual ~Controller() {};
     // abstract interface
-    virtual void input_loop(bool*, void*, void*) {}; // Engine*, Instrument*
+    virtual int attach(EventLoop*, void*, void*) { return 0; }; // Daw*, Instrument*
+    virtual void detach() {};
     virtual void salutation() {};
     virtual void farewell() {};
     virtual void help() {};
@@ -26,9 +41,29 @@ public:
 };
 
 class ShellController : public Controller {
+    EventLoop *loop;
+    void *daw; // Daw*
+    Instrument *instrument;
+    std::string pending; // input not yet ended by a newline
+    int mode;
+    int custom_next; // harmonic asked for next in MODE_CUSTOM
+    int harmonics[WaveTable::HIGHEST_HARMONIC];
+    int stats_timer; // -1 while the periodic stats line is off
+    static void on_input(int, void*);
+    static void on_stats(int, void*);
+    void handle_line(const std::string&);
+    void custom_line(const std::string&);
+    void prompt();
 public:
+    static const int STATS_INTERVAL_MS = 2000;
+    static const int INPUT_CHUNK = 256;
+    // INPUT MODES
+    static const int MODE_PLAY = 0;   // each character is a key
+    static const int MODE_CUSTOM = 1; // each line is a harmonic amplitude
+    ShellController();
     // Controller interface overrides
-    void input_loop(bool*, void*, void*); // Engine*, Instrument*
+    int attach(EventLoop*, void*, void*); // Daw*, Instrument*
+    void detach();
     void salutation();
     void farewell();
     void help();
@@ -37,7 +72,123 @@ public:
     void error(const char[]);
     void error(const char[], void*);
     // ShellController specific methods
-    void custom_wave(int[]);
+    void custom_wave();
+    void dsp_report(void*); // Daw*
+    void stats_line(void*); // Daw*
+    void toggle_stats(void*); // Daw*
+    void record(const char*);
+    static int key_note(const char);
+};
+
+// Plays a timed list of shell commands: driven by the offline backend
+// when rendering, or from event loop timers alongside other controllers.
+// Notes are queued a little ahead, stamped with their exact frame.
+class ScriptController : public Controller {
+    struct ScriptEvent {
+        unsigned long frame;
+        char command;
+        int harmonics[WaveTable::HIGHEST_HARMONIC];
+    };
+    std::vector<ScriptEvent> events;
+    int next;
+    int next_target; // first instrument the next event has not reached
+    int sample_rate;
+    unsigned long origin; // engine frame the script's time 0 lands on
+    // live playback from the event loop
+    EventLoop *loop;
+    void *daw; // Daw*
+    std::vector<Instrument*> targets;
+    int timer;
+    static void on_tick(int, void*);
+public:
+    static const int TICK_MS = 5;
+    static const int LOOKAHEAD_MS = 20; // how far ahead notes are queued
+    ScriptController();
+    int load(const char*, int);
+    void play(unsigned long, void*, std::vector<Instrument*>&); // frame, Daw*
+    bool done();
+    // Controller interface overrides
+    int attach(EventLoop*, void*, void*); // Daw*, Instrument*
+    void detach();
+    void info(const char[]);
+    void error(const char[]);
+};
+
+/*
+ Plays a Standard MIDI File.  Each part (track, or channel in a format 0
+ file) plays one of the mapped instruments, in mapping order, wrapping
+ around when there are more parts than instruments.  Notes are queued a
+ little ahead of the audio thread, stamped with their exact frame.
+*/
+class SequencerController : public Controller {
+    MidiFile file;
+    int next;
+    int sample_rate;
+    unsigned long origin; // engine frame the file's frame 0 lands on
+    // live playback from the event loop
+    EventLoop *loop;
+    void *daw; // Daw*
+    std::vector<Instrument*> targets;
+    int timer;
+    static void on_tick(int, void*);
+public:
+    static const int TICK_MS = 5;
+    static const int LOOKAHEAD_MS = 20; // how far ahead notes are queued
+    SequencerController();
+    int load(const char*, int);
+    void play(unsigned long, void*, std::vector<Instrument*>&); // frame, Daw*
+    bool done();
+    // Controller interface overrides
+    int attach(EventLoop*, void*, void*); // Daw*, Instrument*
+    void detach();
+    void info(const char[]);
+    void error(const char[]);
+};
+
+/*
+ Takes OSC over UDP on localhost and over a Unix datagram socket, so
+ other processes can play the engine.  Addresses may start with "/N",
+ the index of a mapped instrument (0 when left out):
+     /note/on i       /note/off i      note constants
+     /timbre s        "sine" or "square"
+     /wave i...       harmonic amplitudes {0..100}, fundamental first
+     /gain f          /pan f           the instrument's mixer track (gain 0..4)
+ Notes in a bundle play on the bundle's timetag; everything else takes
+ effect when it arrives.  Every datagram is decoded in place.
+*/
+class OscController : public Controller, public OscConstants {
+    EventLoop *loop;
+    void *daw; // Daw*
+    std::vector<Instrument*> targets;
+    int port;
+    std::string path;
+    int udp_fd;
+    int unix_fd;
+    unsigned char packet[OscController::MAX_PACKET];
+    // counters
+    unsigned long messages;
+    unsigned long dropped;   // event queue full, or scheduled too far ahead
+    unsigned long malformed;
+    unsigned long unknown;
+    static void on_packet(int, void*);
+    static void on_message(const OscMessage&, void*);
+    unsigned long frame_for(uint64_t);
+    int open_sockets();
+    void close_sockets();
+public:
+    static const int DEFAULT_PORT = 9000;
+    static const int PACKETS_PER_WAKE = 256; // then other inputs get a turn
+    static const int RECEIVE_BUFFER = 1 << 20;
+    static const int MAX_AHEAD_MS = 10000; // latest timetag accepted
+    OscController(int port=OscController::DEFAULT_PORT,
+                  const char *path="/tmp/littledaw.osc");
+    ~OscController();
+    // Controller interface overrides
+    int attach(EventLoop*, void*, void*); // Daw*, Instrument*
+    void detach();
+    void farewell();
+    void info(const char[]);
+    void error(const char[]);
 };
 
 #endif /* controller_h */
@@ -0,0 +1,38 @@
+//
+//  denormals.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef denormals_h
+#define denormals_h
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+/*
+ Flush denormal floats to zero on the calling thread: FTZ and DAZ on x86,
+ FZ on ARM.  Decaying tails and filter states otherwise drift into the
+ denormal range, where every operation can cost a hundred times more.
+ The mode is per thread, so each audio thread calls this itself; it is
+ cheap enough to call at the start of every callback.
+*/
+inline void flush_denormals() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1ULL << 24)));
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+    uint32_t fpscr;
+    __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+    __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1U << 24)));
+#endif
+}
+
+#endif /* denormals_h */
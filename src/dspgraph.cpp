@@ -0,0 +1,407 @@
+//
+//  dspgraph.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "dspgraph.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ DspSchedule constructor: no operations, no buffers
+*/
+DspSchedule::DspSchedule() {
+    this->block = NULL;
+    this->num_scratch = 0;
+    this->mix_begin = 0;
+    for(int x = 0; x < DspSchedule::MAX_TRACKS; x++) {
+        this->track_begin[x] = this->track_end[x] = 0;
+    }
+}
+
+/*
+ DspSchedule destructor
+*/
+DspSchedule::~DspSchedule() {
+    free(this->block);
+}
+
+/*
+ Allocate the scratch buffers, cache-line aligned and back to back
+   TAKES:
+     count --> int buffers of BLOCK_SAMPLES floats
+*/
+void DspSchedule::allocate(int count) {
+    size_t bytes = (size_t)count * DspSchedule::BLOCK_SAMPLES * sizeof(float);
+    
+    free(this->block);
+    this->block = NULL;
+    this->num_scratch = count;
+    if(count == 0) return;
+    if(posix_memalign(&(this->block), 64, bytes) != 0) {
+        this->block = NULL;
+        this->num_scratch = 0;
+        return;
+    }
+    memset(this->block, 0, bytes);
+}
+
+/*
+ Scratch buffer
+   TAKES:
+     index --> int buffer number, 0 .. num_scratch - 1
+*/
+float *DspSchedule::scratch(int index) {
+    return (float*)this->block + ((size_t)index * DspSchedule::BLOCK_SAMPLES);
+}
+
+/*
+ Whether a track has an insert chain; such a track is processed every
+ block, sounding or not, so its effects' tails ring out
+*/
+bool DspSchedule::has_inserts(int track) {
+    return this->track_end[track] > this->track_begin[track];
+}
+
+/*
+ DspGraph constructor: every track straight into the master
+*/
+DspGraph::DspGraph() {
+    for(int b = 0; b < DspGraph::MAX_BUSES; b++) {
+        this->bus_used[b] = false;
+        this->bus_return[b] = 1.0;
+    }
+}
+
+/*
+ Node of a bus
+*/
+int DspGraph::bus_node(int bus) {
+    return DspGraph::FIRST_BUS + bus;
+}
+
+/*
+ Open a send/return bus
+   TAKES:
+     return_level --> float gain of the bus into the master
+   RETURNS:
+     bus index, or -1 if every bus is in use
+*/
+int DspGraph::add_bus(float return_level) {
+    for(int b = 0; b < DspGraph::MAX_BUSES; b++) {
+        if(this->bus_used[b]) continue;
+        this->bus_used[b] = true;
+        this->bus_return[b] = return_level;
+        return b;
+    }
+    return -1;
+}
+
+/*
+ Close a bus, with its sends and its insert chain.  The effects are not
+ deleted.
+   RETURNS:
+     0 on success, 1 if the bus was not open
+*/
+int DspGraph::remove_bus(int bus) {
+    const int node = DspGraph::bus_node(bus);
+    size_t kept = 0;
+    
+    if(bus < 0 || bus >= DspGraph::MAX_BUSES || !this->bus_used[bus]) return 1;
+    for(size_t i = 0; i < this->sends.size(); i++) {
+        if(this->sends[i].from != node && this->sends[i].to != node) {
+            this->sends[kept++] = this->sends[i];
+        }
+    }
+    this->sends.resize(kept);
+    this->inserts[node].clear();
+    this->bus_used[bus] = false;
+    return 0;
+}
+
+/*
+ Whether a node can carry an insert chain or a send
+*/
+static bool valid_node(int node, const bool *bus_used) {
+    if(node < 0 || node >= DspGraph::NUM_NODES) return false;
+    if(node >= DspGraph::FIRST_BUS && node < DspGraph::MASTER) {
+        return bus_used[node - DspGraph::FIRST_BUS];
+    }
+    return true;
+}
+
+/*
+ Put an effect on a node's insert chain
+   TAKES:
+     node     --> int track index, bus_node(bus) or MASTER
+     effect   --> Effect * to run; still owned by the caller
+     position --> int place in the chain, or -1 for the end
+   RETURNS:
+     0 on success, 1 if the node is not open or its chain is full
+*/
+int DspGraph::add_insert(int node, Effect *effect, int position) {
+    std::vector<Effect*> *chain;
+    
+    if(!valid_node(node, this->bus_used) || effect == NULL) return 1;
+    chain = &(this->inserts[node]);
+    if((int)chain->size() >= DspGraph::MAX_INSERTS) return 1;
+    if(position < 0 || position > (int)chain->size()) position = (int)chain->size();
+    chain->insert(chain->begin() + position, effect);
+    return 0;
+}
+
+/*
+ Take an effect off a node's insert chain.  It is not deleted.
+   RETURNS:
+     0 on success, 1 if it was not on the chain
+*/
+int DspGraph::remove_insert(int node, Effect *effect) {
+    std::vector<Effect*> *chain;
+    
+    if(node < 0 || node >= DspGraph::NUM_NODES) return 1;
+    chain = &(this->inserts[node]);
+    for(size_t i = 0; i < chain->size(); i++) {
+        if((*chain)[i] == effect) {
+            chain->erase(chain->begin() + i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ Number of effects on a node's insert chain
+*/
+int DspGraph::num_inserts(int node) {
+    if(node < 0 || node >= DspGraph::NUM_NODES) return 0;
+    return (int)this->inserts[node].size();
+}
+
+/*
+ Send a track or bus into a bus
+   TAKES:
+     from  --> int track index or bus_node(bus)
+     bus   --> int bus index to feed
+     level --> float send gain, 0 to remove the send
+   RETURNS:
+     0 on success, 1 if a node is not open or the send would close a
+     loop between buses
+*/
+int DspGraph::set_send(int from, int bus, float level) {
+    int order[DspGraph::MAX_BUSES];
+    Send send;
+    bool found = false;
+    size_t i;
+    
+    if(from >= DspGraph::MASTER || !valid_node(from, this->bus_used) ||
+       bus < 0 || bus >= DspGraph::MAX_BUSES || !this->bus_used[bus] ||
+       from == DspGraph::bus_node(bus)) return 1;
+    send.from = from;
+    send.to = DspGraph::bus_node(bus);
+    send.level = level;
+    for(i = 0; i < this->sends.size(); i++) {
+        if(this->sends[i].from == from && this->sends[i].to == send.to) {
+            found = true;
+            break;
+        }
+    }
+    if(level <= 0.0) {
+        if(found) this->sends.erase(this->sends.begin() + i);
+        return 0;
+    }
+    if(found) {
+        this->sends[i] = send;
+        return 0;
+    }
+    this->sends.push_back(send);
+    if(this->order_buses(order) < 0) {
+        this->sends.pop_back(); // a feedback loop has no schedule
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ Set a bus's gain into the master
+   RETURNS:
+     0 on success, 1 if the bus is not open
+*/
+int DspGraph::set_return(int bus, float level) {
+    if(bus < 0 || bus >= DspGraph::MAX_BUSES || !this->bus_used[bus]) return 1;
+    this->bus_return[bus] = (level > 0.0) ? level : 0.0;
+    return 0;
+}
+
+/*
+ Order the open buses so every bus comes after the buses sending to it
+ (Kahn's algorithm)
+   TAKES:
+     order --> int * MAX_BUSES bus indices, filled
+   RETURNS:
+     number of buses ordered, or -1 if the sends between them form a loop
+*/
+int DspGraph::order_buses(int *order) {
+    int incoming[DspGraph::MAX_BUSES];
+    int b, n = 0, open = 0, head = 0;
+    
+    for(b = 0; b < DspGraph::MAX_BUSES; b++) incoming[b] = 0;
+    for(size_t i = 0; i < this->sends.size(); i++) {
+        if(this->sends[i].from >= DspGraph::FIRST_BUS) {
+            incoming[this->sends[i].to - DspGraph::FIRST_BUS]++;
+        }
+    }
+    for(b = 0; b < DspGraph::MAX_BUSES; b++) {
+        if(!this->bus_used[b]) continue;
+        open++;
+        if(incoming[b] == 0) order[n++] = b;
+    }
+    while(head < n) {
+        b = order[head++];
+        for(size_t i = 0; i < this->sends.size(); i++) {
+            if(this->sends[i].from != DspGraph::bus_node(b)) continue;
+            if(--incoming[this->sends[i].to - DspGraph::FIRST_BUS] == 0) {
+                order[n++] = this->sends[i].to - DspGraph::FIRST_BUS;
+            }
+        }
+    }
+    return (n == open) ? n : -1;
+}
+
+/*
+ Append an operation; a bus buffer is cleared before its first write
+   TAKES:
+     written --> bool * per bus, whether its buffer has been started
+*/
+void DspGraph::emit(DspSchedule *s, int type, int track, Effect *effect, int src,
+                    int dst, float level, bool *written) {
+    DspOp op;
+    
+    if(dst >= 0 && !written[dst]) {
+        written[dst] = true;
+        if(type != DspGraph::OP_CLEAR) {
+            this->emit(s, DspGraph::OP_CLEAR, -1, NULL, dst, dst, 0.0, written);
+        }
+    }
+    op.type = type;
+    op.track = track;
+    op.effect = effect;
+    op.src = src;
+    op.dst = dst;
+    op.level = level;
+    s->ops.push_back(op);
+}
+
+/*
+ Compile the graph into a schedule.  Runs on the control thread; the
+ result is ready to publish.
+   RETURNS:
+     DspSchedule *, or NULL if the buses form a loop
+*/
+DspSchedule *DspGraph::compile() {
+    DspSchedule *s;
+    int order[DspGraph::MAX_BUSES];
+    bool written[DspGraph::MAX_BUSES];
+    int n, i, b, x, node;
+    size_t k;
+    
+    n = this->order_buses(order);
+    if(n < 0) return NULL;
+    s = new DspSchedule();
+    // each track's own chain, run where the track is rendered
+    for(x = 0; x < DspGraph::MAX_TRACKS; x++) {
+        s->track_begin[x] = (int)s->ops.size();
+        for(k = 0; k < this->inserts[x].size(); k++) {
+            this->emit(s, DspGraph::OP_INSERT, x, this->inserts[x][k],
+                       DspGraph::BUFFER_TRACK, DspGraph::BUFFER_TRACK, 0.0, NULL);
+        }
+        s->track_end[x] = (int)s->ops.size();
+    }
+    // the mix: tracks in order, each into its buses and then the master...
+    s->mix_begin = (int)s->ops.size();
+    for(b = 0; b < DspGraph::MAX_BUSES; b++) written[b] = false;
+    for(x = 0; x < DspGraph::MAX_TRACKS; x++) {
+        for(k = 0; k < this->sends.size(); k++) {
+            if(this->sends[k].from != x) continue;
+            this->emit(s, DspGraph::OP_SEND, x, NULL, DspGraph::BUFFER_TRACK,
+                       this->sends[k].to - DspGraph::FIRST_BUS, this->sends[k].level, written);
+        }
+        this->emit(s, DspGraph::OP_TRACK, x, NULL, DspGraph::BUFFER_TRACK,
+                   DspGraph::BUFFER_OUT, 1.0, written);
+    }
+    // ...then the buses, each after every bus that feeds it...
+    for(i = 0; i < n; i++) {
+        b = order[i];
+        node = DspGraph::bus_node(b);
+        if(!written[b]) {
+            this->emit(s, DspGraph::OP_CLEAR, -1, NULL, b, b, 0.0, written);
+        }
+        for(k = 0; k < this->inserts[node].size(); k++) {
+            this->emit(s, DspGraph::OP_INSERT, -1, this->inserts[node][k], b, b, 0.0, written);
+        }
+        for(k = 0; k < this->sends.size(); k++) {
+            if(this->sends[k].from != node) continue;
+            this->emit(s, DspGraph::OP_SEND, -1, NULL, b,
+                       this->sends[k].to - DspGraph::FIRST_BUS, this->sends[k].level, written);
+        }
+        if(this->bus_return[b] > 0.0) {
+            this->emit(s, DspGraph::OP_SEND, -1, NULL, b, DspGraph::BUFFER_OUT,
+                       this->bus_return[b], written);
+        }
+    }
+    // ...then the master's chain
+    for(k = 0; k < this->inserts[DspGraph::MASTER].size(); k++) {
+        this->emit(s, DspGraph::OP_INSERT, -1, this->inserts[DspGraph::MASTER][k],
+                   DspGraph::BUFFER_OUT, DspGraph::BUFFER_OUT, 0.0, written);
+    }
+    this->assign_buffers(s);
+    return s;
+}
+
+/*
+ Map each bus onto a scratch buffer.  A bus's buffer is live from the
+ op that clears it to the last op that touches it; buses whose lives
+ do not overlap share a buffer, lowest free first (linear scan).
+*/
+void DspGraph::assign_buffers(DspSchedule *s) {
+    int first[DspGraph::MAX_BUSES], last[DspGraph::MAX_BUSES];
+    int physical[DspGraph::MAX_BUSES];
+    bool busy[DspGraph::MAX_BUSES];
+    int i, b, slot, count = 0;
+    DspOp *op;
+    
+    for(b = 0; b < DspGraph::MAX_BUSES; b++) {
+        first[b] = last[b] = -1;
+        physical[b] = -1;
+        busy[b] = false;
+    }
+    for(i = s->mix_begin; i < (int)s->ops.size(); i++) {
+        op = &(s->ops[i]);
+        if(op->src >= 0) {
+            if(first[op->src] < 0) first[op->src] = i;
+            last[op->src] = i;
+        }
+        if(op->dst >= 0) {
+            if(first[op->dst] < 0) first[op->dst] = i;
+            last[op->dst] = i;
+        }
+    }
+    for(i = s->mix_begin; i < (int)s->ops.size(); i++) {
+        op = &(s->ops[i]);
+        for(b = 0; b < DspGraph::MAX_BUSES; b++) {
+            if(first[b] != i) continue;
+            for(slot = 0; busy[slot]; slot++);
+            busy[slot] = true;
+            physical[b] = slot;
+            if(slot + 1 > count) count = slot + 1;
+        }
+        if(op->src >= 0) op->src = physical[op->src];
+        if(op->dst >= 0) op->dst = physical[op->dst];
+        for(b = 0; b < DspGraph::MAX_BUSES; b++) {
+            if(last[b] == i) busy[physical[b]] = false;
+        }
+    }
+    s->allocate(count);
+}
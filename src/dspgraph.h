@@ -0,0 +1,102 @@
+//
+//  dspgraph.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef dspgraph_h
+#define dspgraph_h
+
+#include "effect.h"
+#include <vector>
+
+class DspGraphConstants {
+public:
+    static const int MAX_TRACKS = 16; // as the mixer's
+    static const int MAX_BUSES = 8;
+    static const int MAX_INSERTS = 8; // per chain
+    static const int BLOCK_SAMPLES = 2048; // scratch buffer, frames * channels
+    // NODES: tracks are 0 .. MAX_TRACKS-1, then the buses, then the master
+    static const int FIRST_BUS = MAX_TRACKS;
+    static const int MASTER = MAX_TRACKS + MAX_BUSES;
+    static const int NUM_NODES = MASTER + 1;
+    // OPERATIONS
+    static const int OP_INSERT = 0; // run effect on dst in place
+    static const int OP_CLEAR = 1;  // zero dst
+    static const int OP_TRACK = 2;  // track into OUT through its fader
+    static const int OP_SEND = 3;   // dst += src * level
+    // BUFFERS, besides the scratch buffers numbered from 0
+    static const int BUFFER_OUT = -1;   // the mix being built
+    static const int BUFFER_TRACK = -2; // the op's track's own buffer
+};
+
+struct DspOp {
+    int type;
+    int track;      // track whose signal the op reads, or -1
+    Effect *effect; // OP_INSERT
+    int src, dst;   // buffers
+    float level;    // OP_SEND
+};
+
+/*
+ Class DspSchedule:
+   A compiled graph: a flat list of operations in dependency order, and
+   the scratch buffers its buses run in.  Each track's inserts come
+   first, in their own ranges, so they can run on the worker that
+   rendered the track; the mix section follows.  Immutable once built,
+   and published to the audio thread whole.
+*/
+class DspSchedule : public DspGraphConstants {
+    void *block;
+public:
+    std::vector<DspOp> ops;
+    int track_begin[MAX_TRACKS], track_end[MAX_TRACKS]; // insert ops per track
+    int mix_begin;
+    int num_scratch;
+    DspSchedule();
+    ~DspSchedule();
+    void allocate(int);
+    float *scratch(int);
+    bool has_inserts(int);
+};
+
+/*
+ Class DspGraph:
+   The editable signal flow behind the mixer: an insert chain on every
+   track, bus and the master; send/return buses fed from tracks or from
+   other buses; and a return level per bus into the master.  Sends are
+   taken pre-fader, after the source's inserts.  compile() turns it into
+   a DspSchedule: buses are put in topological order, and each bus's
+   buffer is assigned by liveness, so a bus whose signal has been passed
+   on hands its buffer to the next, keeping the working set small.
+   Control side only.
+*/
+class DspGraph : public DspGraphConstants {
+    struct Send {
+        int from, to; // nodes; to is a bus
+        float level;
+    };
+    std::vector<Effect*> inserts[NUM_NODES];
+    std::vector<Send> sends;
+    bool bus_used[MAX_BUSES];
+    float bus_return[MAX_BUSES];
+    // helper method(s)
+    int order_buses(int*);
+    void emit(DspSchedule*, int, int, Effect*, int, int, float, bool*);
+    void assign_buffers(DspSchedule*);
+public:
+    DspGraph();
+    int add_bus(float return_level=1.0);
+    int remove_bus(int);
+    int add_insert(int, Effect*, int position=-1);
+    int remove_insert(int, Effect*);
+    int set_send(int, int, float);
+    int set_return(int, float);
+    int num_inserts(int);
+    DspSchedule *compile();
+    static int bus_node(int);
+};
+
+#endif /* dspgraph_h */
@@ -0,0 +1,115 @@
+//
+//  dspstats.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "dspstats.h"
+
+/*
+ DspStats constructor
+*/
+DspStats::DspStats() : buffers(0), underflows(0), overflows(0), priming(0),
+latency_ms(0.0), period(0.0) {
+    for(int i = 0; i < DspStats::WINDOW; i++) {
+        this->render_us[i].store(0.0, std::memory_order_relaxed);
+        this->load[i].store(0.0, std::memory_order_relaxed);
+        this->voices[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+/*
+ Record one buffer (audio thread)
+   TAKES:
+     render_us --> float time spent in the callback, microseconds
+     period_us --> float length of the buffer, microseconds
+     flags     --> unsigned long stream status flags
+     voices    --> int voices sounding
+*/
+void DspStats::record(float render_us, float period_us, unsigned long flags,
+                      int voices) {
+    unsigned long n = this->buffers.load(std::memory_order_relaxed);
+    int slot = n % DspStats::WINDOW;
+    
+    this->render_us[slot].store(render_us, std::memory_order_relaxed);
+    this->load[slot].store(render_us / period_us, std::memory_order_relaxed);
+    this->voices[slot].store(voices, std::memory_order_relaxed);
+    this->period.store(period_us, std::memory_order_relaxed);
+    if(flags & DspStats::FLAG_OUTPUT_UNDERFLOW) {
+        this->underflows.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(flags & DspStats::FLAG_OUTPUT_OVERFLOW) {
+        this->overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(flags & DspStats::FLAG_PRIMING_OUTPUT) {
+        this->priming.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->buffers.store(n + 1, std::memory_order_release);
+}
+
+/*
+ Record the current output latency reported by the backend (audio thread)
+*/
+void DspStats::set_latency(float ms) {
+    this->latency_ms.store(ms, std::memory_order_relaxed);
+}
+
+/*
+ Summarize the rolling window
+   RETURNS:
+     Report with min/mean/p99/max render time and load, counters
+*/
+DspStats::Report DspStats::report() {
+    Report r;
+    int histogram[DspStats::HISTOGRAM_BINS + 1] = {0};
+    float render, load, render_sum = 0.0, load_sum = 0.0;
+    long voice_sum = 0;
+    int i, v, bin, count, target;
+    
+    r.buffers = this->buffers.load(std::memory_order_acquire);
+    r.window = (r.buffers < DspStats::WINDOW) ? (int)r.buffers : DspStats::WINDOW;
+    r.period_us = this->period.load(std::memory_order_relaxed);
+    r.render_min_us = r.render_mean_us = r.render_p99_us = r.render_max_us = 0.0;
+    r.load_mean = r.load_p99 = r.load_max = 0.0;
+    r.headroom_min_us = 0.0;
+    r.voices_mean = 0.0;
+    r.voices_max = 0;
+    r.underflows = this->underflows.load(std::memory_order_relaxed);
+    r.overflows = this->overflows.load(std::memory_order_relaxed);
+    r.priming = this->priming.load(std::memory_order_relaxed);
+    r.latency_ms = this->latency_ms.load(std::memory_order_relaxed);
+    if(r.window == 0) return r;
+    for(i = 0; i < r.window; i++) {
+        render = this->render_us[i].load(std::memory_order_relaxed);
+        load = this->load[i].load(std::memory_order_relaxed);
+        v = this->voices[i].load(std::memory_order_relaxed);
+        if(i == 0 || render < r.render_min_us) r.render_min_us = render;
+        if(render > r.render_max_us) r.render_max_us = render;
+        if(load > r.load_max) r.load_max = load;
+        if(v > r.voices_max) r.voices_max = v;
+        render_sum += render;
+        load_sum += load;
+        voice_sum += v;
+        bin = (int)(load * 100.0 * DspStats::BINS_PER_PERCENT);
+        if(bin > DspStats::HISTOGRAM_BINS) bin = DspStats::HISTOGRAM_BINS;
+        histogram[bin]++;
+    }
+    r.render_mean_us = render_sum / r.window;
+    r.load_mean = 100.0 * load_sum / r.window;
+    r.load_max *= 100.0;
+    r.voices_mean = (float)voice_sum / r.window;
+    // 99th percentile from the load histogram
+    target = (r.window * 99 + 99) / 100;
+    count = 0;
+    for(bin = 0; bin <= DspStats::HISTOGRAM_BINS; bin++) {
+        count += histogram[bin];
+        if(count >= target) break;
+    }
+    r.load_p99 = (float)(bin + 1) / DspStats::BINS_PER_PERCENT;
+    if(r.load_p99 > r.load_max) r.load_p99 = r.load_max;
+    r.render_p99_us = r.period_us * r.load_p99 / 100.0;
+    r.headroom_min_us = r.period_us - r.render_max_us;
+    return r;
+}
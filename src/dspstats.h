@@ -0,0 +1,65 @@
+//
+//  dspstats.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef dspstats_h
+#define dspstats_h
+
+#include <atomic>
+
+class DspStatsConstants {
+public:
+    static const int WINDOW = 1024;      // buffers in the rolling window
+    static const int HISTOGRAM_BINS = 1000; // 0.2% load per bin, to 200%
+    static const int BINS_PER_PERCENT = 5;
+    // status flags (same bits as PaStreamCallbackFlags)
+    static const unsigned long FLAG_OUTPUT_UNDERFLOW = 0x04;
+    static const unsigned long FLAG_OUTPUT_OVERFLOW = 0x08;
+    static const unsigned long FLAG_PRIMING_OUTPUT = 0x10;
+};
+
+/*
+ Class DspStats:
+   Per-buffer timing recorded by the audio callback without locks: the
+   callback writes into a ring of the last WINDOW buffers plus a few
+   counters, and report() summarizes a copy of the ring on the caller's
+   thread.
+*/
+class DspStats : public DspStatsConstants {
+    // rolling window, written by the audio thread only
+    std::atomic<float> render_us[WINDOW];
+    std::atomic<float> load[WINDOW]; // render time / buffer period
+    std::atomic<int> voices[WINDOW];
+    std::atomic<unsigned long> buffers;
+    // counters
+    std::atomic<unsigned long> underflows;
+    std::atomic<unsigned long> overflows;
+    std::atomic<unsigned long> priming;
+    std::atomic<float> latency_ms;
+    std::atomic<float> period;
+public:
+    struct Report {
+        unsigned long buffers;
+        int window;        // buffers summarized below
+        float period_us;
+        float render_min_us, render_mean_us, render_p99_us, render_max_us;
+        float load_mean, load_p99, load_max; // percent of the buffer period
+        float headroom_min_us;
+        float voices_mean;
+        int voices_max;
+        unsigned long underflows, overflows, priming;
+        float latency_ms;
+    };
+    DspStats();
+    // audio thread
+    void record(float, float, unsigned long, int);
+    void set_latency(float);
+    // any other thread
+    Report report();
+};
+
+#endif /* dspstats_h */
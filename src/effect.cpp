@@ -0,0 +1,200 @@
+//
+//  effect.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "effect.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ FilterEffect constructor
+   TAKES:
+     type        --> int FILTER_LOWPASS or FILTER_HIGHPASS
+     cutoff      --> float corner frequency in Hz
+     q           --> float resonance, DEFAULT_Q for a flat passband
+     sample_rate --> int sample rate in Hz
+*/
+FilterEffect::FilterEffect(int type, float cutoff, float q, int sample_rate) :
+type(type), cutoff(cutoff), q(q) {
+    this->sample_rate = sample_rate;
+    this->used_type = -1; // designed on the first block
+    this->used_cutoff = 0.0;
+    this->used_q = 0.0;
+    this->b0 = 1.0;
+    this->b1 = this->b2 = this->a1 = this->a2 = 0.0;
+    memset(this->z1, 0, sizeof(this->z1));
+    memset(this->z2, 0, sizeof(this->z2));
+}
+
+/*
+ Switch between low- and high-pass; other values are ignored
+*/
+void FilterEffect::set_type(int type) {
+    if(type != FilterEffect::FILTER_LOWPASS && type != FilterEffect::FILTER_HIGHPASS) return;
+    this->type.store(type, std::memory_order_relaxed);
+}
+
+/*
+ Set the corner frequency, clamped below Nyquist
+*/
+void FilterEffect::set_cutoff(float hz) {
+    if(hz < 10.0) hz = 10.0;
+    if(hz > 0.45 * this->sample_rate) hz = 0.45 * this->sample_rate;
+    this->cutoff.store(hz, std::memory_order_relaxed);
+}
+
+/*
+ Set the resonance
+*/
+void FilterEffect::set_q(float q) {
+    if(q < 0.1) q = 0.1;
+    this->q.store(q, std::memory_order_relaxed);
+}
+
+/*
+ Compute the coefficients for the current settings
+*/
+void FilterEffect::design() {
+    double w = 2.0 * M_PI * this->used_cutoff / this->sample_rate;
+    double alpha = sin(w) / (2.0 * this->used_q);
+    double c = cos(w);
+    double a0 = 1.0 + alpha;
+    
+    if(this->used_type == FilterEffect::FILTER_HIGHPASS) {
+        this->b0 = (float)(((1.0 + c) / 2.0) / a0);
+        this->b1 = (float)(-(1.0 + c) / a0);
+    } else {
+        this->b0 = (float)(((1.0 - c) / 2.0) / a0);
+        this->b1 = (float)((1.0 - c) / a0);
+    }
+    this->b2 = this->b0;
+    this->a1 = (float)((-2.0 * c) / a0);
+    this->a2 = (float)((1.0 - alpha) / a0);
+}
+
+/*
+ Filter a block in place (transposed direct form II)
+   TAKES:
+     buf      --> float * interleaved block (frames * channels)
+     frames   --> number of frames
+     channels --> number of interleaved channels; past MAX_CHANNELS pass
+*/
+void FilterEffect::process(float *buf, unsigned long frames, int channels) {
+    const int t = this->type.load(std::memory_order_relaxed);
+    const float fc = this->cutoff.load(std::memory_order_relaxed);
+    const float fq = this->q.load(std::memory_order_relaxed);
+    const int chans = (channels < FilterEffect::MAX_CHANNELS) ? channels :
+                      FilterEffect::MAX_CHANNELS;
+    unsigned long i;
+    float x, y;
+    int c;
+    
+    if(t != this->used_type || fc != this->used_cutoff || fq != this->used_q) {
+        this->used_type = t;
+        this->used_cutoff = fc;
+        this->used_q = fq;
+        this->design();
+    }
+    for(c = 0; c < chans; c++) {
+        float s1 = this->z1[c], s2 = this->z2[c];
+        for(i = 0; i < frames; i++) {
+            x = buf[(i * channels) + c];
+            y = (this->b0 * x) + s1;
+            s1 = (this->b1 * x) - (this->a1 * y) + s2;
+            s2 = (this->b2 * x) - (this->a2 * y);
+            buf[(i * channels) + c] = y;
+        }
+        this->z1[c] = s1;
+        this->z2[c] = s2;
+    }
+}
+
+/*
+ DelayEffect constructor
+   TAKES:
+     ms          --> float delay time
+     feedback    --> float share of the output fed back, 0 .. <1
+     max_ms      --> int longest delay set_time() will accept
+     sample_rate --> int sample rate in Hz
+*/
+DelayEffect::DelayEffect(float ms, float feedback, int max_ms, int sample_rate) :
+delay(1), feedback(0.0), wet(1.0) {
+    this->sample_rate = sample_rate;
+    this->max_frames = (int)(((long)max_ms * sample_rate) / 1000) + 1;
+    this->line = new float[this->max_frames * DelayEffect::MAX_CHANNELS];
+    memset(this->line, 0, this->max_frames * DelayEffect::MAX_CHANNELS * sizeof(float));
+    this->write = 0;
+    this->set_time(ms);
+    this->set_feedback(feedback);
+}
+
+/*
+ DelayEffect destructor
+*/
+DelayEffect::~DelayEffect() {
+    delete [] this->line;
+}
+
+/*
+ Set the delay time, clamped to the line's length
+*/
+void DelayEffect::set_time(float ms) {
+    int frames = (int)((ms * this->sample_rate) / 1000.0);
+    if(frames < 1) frames = 1;
+    if(frames > this->max_frames - 1) frames = this->max_frames - 1;
+    this->delay.store(frames, std::memory_order_relaxed);
+}
+
+/*
+ Set the share of the output fed back, kept below 1 so the line decays
+*/
+void DelayEffect::set_feedback(float feedback) {
+    if(feedback < 0.0) feedback = 0.0;
+    if(feedback > 0.95) feedback = 0.95;
+    this->feedback.store(feedback, std::memory_order_relaxed);
+}
+
+/*
+ Set the wet/dry mix
+*/
+void DelayEffect::set_wet(float wet) {
+    if(wet < 0.0) wet = 0.0;
+    if(wet > 1.0) wet = 1.0;
+    this->wet.store(wet, std::memory_order_relaxed);
+}
+
+/*
+ Delay a block in place
+   TAKES:
+     buf      --> float * interleaved block (frames * channels)
+     frames   --> number of frames
+     channels --> number of interleaved channels; past MAX_CHANNELS pass
+*/
+void DelayEffect::process(float *buf, unsigned long frames, int channels) {
+    const int d = this->delay.load(std::memory_order_relaxed);
+    const float fb = this->feedback.load(std::memory_order_relaxed);
+    const float w = this->wet.load(std::memory_order_relaxed);
+    const int chans = (channels < DelayEffect::MAX_CHANNELS) ? channels :
+                      DelayEffect::MAX_CHANNELS;
+    int read = this->write - d;
+    unsigned long i;
+    float *in, *tap, *wr;
+    int c;
+    
+    if(read < 0) read += this->max_frames;
+    for(i = 0; i < frames; i++) {
+        in = buf + (i * channels);
+        tap = this->line + (read * DelayEffect::MAX_CHANNELS);
+        wr = this->line + (this->write * DelayEffect::MAX_CHANNELS);
+        for(c = 0; c < chans; c++) {
+            wr[c] = in[c] + (tap[c] * fb);
+            in[c] += w * (tap[c] - in[c]);
+        }
+        if(++read == this->max_frames) read = 0;
+        if(++this->write == this->max_frames) this->write = 0;
+    }
+}
@@ -0,0 +1,88 @@
+//
+//  effect.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef effect_h
+#define effect_h
+
+#include <atomic>
+
+class EffectConstants {
+public:
+    static const int MAX_CHANNELS = 8;
+    // FILTER TYPES
+    static const int FILTER_LOWPASS = 0;
+    static const int FILTER_HIGHPASS = 1;
+    constexpr static const float DEFAULT_Q = 0.7071; // Butterworth
+    static const int DEFAULT_MAX_DELAY_MS = 2000;
+};
+
+/*
+ Class Effect:
+   A processor on an insert chain (a track's, a bus's or the master's),
+   run in place on an interleaved block by the audio thread or a render
+   worker.  Effects allocate everything at construction, so adding one
+   to the graph never allocates on the audio thread; their setters are
+   safe from any thread and take effect at the next block.
+*/
+class Effect : public EffectConstants {
+public:
+    virtual ~Effect() {};
+    virtual void process(float*, unsigned long, int) = 0;
+};
+
+/*
+ Class FilterEffect:
+   Biquad low- or high-pass (RBJ cookbook), one state per channel.
+   Coefficients are recomputed on the audio thread when a setting
+   changes.
+*/
+class FilterEffect : public Effect {
+    std::atomic<int> type;
+    std::atomic<float> cutoff; // Hz
+    std::atomic<float> q;
+    int sample_rate;
+    // coefficients for the settings below, audio thread only
+    int used_type;
+    float used_cutoff, used_q;
+    float b0, b1, b2, a1, a2;
+    float z1[FilterEffect::MAX_CHANNELS], z2[FilterEffect::MAX_CHANNELS];
+    void design();
+public:
+    FilterEffect(int type=FilterEffect::FILTER_LOWPASS, float cutoff=1000.0,
+                 float q=FilterEffect::DEFAULT_Q, int sample_rate=44100);
+    void set_type(int);
+    void set_cutoff(float);
+    void set_q(float);
+    void process(float*, unsigned long, int);
+};
+
+/*
+ Class DelayEffect:
+   Feedback delay with a wet/dry mix, on a line preallocated for the
+   longest delay.  Fully wet (the default) suits a return bus; on an
+   insert, mix some dry signal back in.
+*/
+class DelayEffect : public Effect {
+    std::atomic<int> delay;      // frames
+    std::atomic<float> feedback; // 0 .. <1
+    std::atomic<float> wet;      // 0 dry .. 1 wet only
+    int sample_rate;
+    float *line; // max_frames * MAX_CHANNELS, frame-interleaved
+    int max_frames;
+    int write;
+public:
+    DelayEffect(float ms=250.0, float feedback=0.3,
+                int max_ms=DelayEffect::DEFAULT_MAX_DELAY_MS, int sample_rate=44100);
+    ~DelayEffect();
+    void set_time(float);
+    void set_feedback(float);
+    void set_wet(float);
+    void process(float*, unsigned long, int);
+};
+
+#endif /* effect_h */
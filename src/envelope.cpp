@@ -7,60 +7,186 @@
 //
 
 #include "envelope.h"
+#include "voice.h"
+#include <limits.h>
+#include <math.h>
 
 /*
  Envelope constructor
    TAKES:
-     continuous --> indicates continuous envelope
      a --> attack length in samples
      d --> decay length in samples
-     s --> sustain length in samples
+     s --> sustain length in samples, or SUSTAIN_HOLD to hold until release
      r --> release length in samples
-     sustain_level --> 0 <= x <= 100
-     
+     sustain_level --> 0 <= x <= 1
+     curve --> CURVE_LINEAR or CURVE_EXPONENTIAL segments
 */
 Envelope::Envelope(int a, 
                    int d, 
                    int s, 
                    int r, 
-                   float sustain_level) {
-    this->length = a + d + s + r;
-    this->node1 = a;
-    this->node2 = node1 + d;
-    this->node3 = node2 + s;
+                   float sustain_level,
+                   int curve) {
+    this->attack = a;
+    this->decay = d;
+    this->sustain = s;
+    this->release_len = r;
     this->sustain_level = sustain_level;
+    this->curve = curve;
+    this->cull_level = Envelope::DEFAULT_CULL_LEVEL;
+    this->length = a + d + ((s > 0) ? s : 0) + r;
 }
 
 /*
- Set envelope level based on envelope parameters and pos.
+ Set the level below which a releasing voice is cut off
+   TAKES:
+     level --> float 0 <= x < 1, 0 to let releases run to the end
 */
-float Envelope::calculate(int pos, bool triggered) {
-    double node_height;
-    int node_index;
-    double progress;
-    float level;
+void Envelope::set_cull_level(float level) {
+    this->cull_level = (level > 0.0) ? level : 0.0;
+}
+
+/*
+ Start a voice's envelope with an attack from its current level (zero for a
+ fresh voice, wherever it was for a stolen one)
+   TAKES:
+     pool --> VoicePool * holding the voice
+     v    --> int voice index
+*/
+void Envelope::start(VoicePool *pool, int v) {
+    pool->active[v] = 1;
+    this->enter(pool, v, Envelope::STAGE_ATTACK);
+}
+
+/*
+ Note-off: move a sounding voice to its release, from its current level
+*/
+void Envelope::release(VoicePool *pool, int v) {
+    if(pool->active[v] && pool->envelope_stage[v] != Envelope::STAGE_RELEASE) {
+        this->enter(pool, v, Envelope::STAGE_RELEASE);
+    }
+}
+
+/*
+ Advance a voice's envelope one sample
+   RETURNS:
+     bool true if the voice finished on this sample
+*/
+bool Envelope::advance(VoicePool *pool, int v) {
+    if(!pool->active[v]) return false;
+    pool->envelope_level[v] = (pool->envelope_level[v] * pool->envelope_mul[v]) +
+                              pool->envelope_add[v];
+    return this->elapse(pool, v, 1);
+}
+
+/*
+ Count samples off the current stage after a renderer has already stepped
+ the level itself, and move on to the next stage when it runs out.
+ Renderers must not step past envelope_remaining samples at once.
+   TAKES:
+     pool    --> VoicePool * holding the voice
+     v       --> int voice index
+     samples --> int samples the level was stepped
+   RETURNS:
+     bool true if the voice finished
+*/
+bool Envelope::elapse(VoicePool *pool, int v, int samples) {
+    int stage = pool->envelope_stage[v];
+    
+    if(!pool->active[v]) return false;
+    if(pool->envelope_remaining[v] != INT_MAX) {
+        pool->envelope_remaining[v] -= samples;
+    }
+    if(pool->envelope_remaining[v] > 0) return false;
+    // land exactly on the goal, then go on
+    if(stage == Envelope::STAGE_ATTACK) {
+        pool->envelope_level[v] = pool->gain[v];
+        this->enter(pool, v, Envelope::STAGE_DECAY);
+    } else if(stage == Envelope::STAGE_DECAY) {
+        pool->envelope_level[v] = this->sustain_level * pool->gain[v];
+        this->enter(pool, v, Envelope::STAGE_SUSTAIN);
+    } else if(stage == Envelope::STAGE_SUSTAIN) {
+        this->enter(pool, v, Envelope::STAGE_RELEASE);
+    } else {
+        this->enter(pool, v, Envelope::STAGE_IDLE);
+    }
+    return !pool->active[v];
+}
+
+/*
+ Set a voice up to run a stage from its current level: work out the
+ multiply-add coefficients and how many samples reach the goal.  Stages
+ with nothing to do are passed straight through.
+   TAKES:
+     pool  --> VoicePool * holding the voice
+     v     --> int voice index
+     stage --> int STAGE_* to enter
+*/
+void Envelope::enter(VoicePool *pool, int v, int stage) {
+    const float gain = pool->gain[v];
+    double level, from, goal, end, ratio, coef, target, n;
+    int len;
     
-    if(triggered) {
-        if(pos < this->node1) {
-            node_height = (double)1.0;
-            node_index = pos;
-            progress = (double)node_index / (double)this->node1;
-            return (float)(progress * node_height);
-        } else if(pos < this->node2) {
-            node_height = (double)1.0 - (double)this->sustain_level;
-            node_index = pos - this->node1;
-            progress = (double)node_index / ((double)(this->node2 - this->node1));
-            return 1.0 - (progress * node_height);
-        } else if(pos < this->node3) {
-            return this->sustain_level;
+    while(true) {
+        level = pool->envelope_level[v];
+        pool->envelope_stage[v] = stage;
+        pool->envelope_mul[v] = 1.0;
+        pool->envelope_add[v] = 0.0;
+        pool->envelope_remaining[v] = INT_MAX;
+        if(stage == Envelope::STAGE_IDLE) {
+            pool->active[v] = 0;
+            pool->envelope_level[v] = 0.0;
+            return;
+        }
+        if(stage == Envelope::STAGE_SUSTAIN) {
+            if(level <= this->cull_level) {
+                stage = Envelope::STAGE_IDLE; // nothing audible to hold
+                continue;
+            }
+            if(this->sustain == Envelope::SUSTAIN_HOLD) return;
+            if(this->sustain > 0) {
+                pool->envelope_remaining[v] = this->sustain;
+                return;
+            }
+            stage = Envelope::STAGE_RELEASE;
+            continue;
+        }
+        if(stage == Envelope::STAGE_ATTACK) {
+            len = this->attack;
+            from = 0.0;
+            goal = gain;
+            ratio = Envelope::ATTACK_OVERSHOOT;
+        } else if(stage == Envelope::STAGE_DECAY) {
+            len = this->decay;
+            from = gain;
+            goal = this->sustain_level * gain;
+            ratio = Envelope::DECAY_OVERSHOOT;
         } else {
-            node_height = (double)this->sustain_level;
-            node_index = pos - this->node3;
-            progress = (double)node_index / 
-                       ((double)(this->length - this->node3));
-            return this->sustain_level - (progress * node_height);
+            len = this->release_len;
+            from = level;
+            goal = 0.0;
+            ratio = Envelope::DECAY_OVERSHOOT;
         }
-    } else {
-        return 0.0;
+        // a release stops once it falls through the cull level
+        end = (stage == Envelope::STAGE_RELEASE) ? this->cull_level : goal;
+        // run the stage only if the level still has to travel toward its end
+        if(len > 0 && ((end - level) * (goal - from)) > 0.0) {
+            if(this->curve == Envelope::CURVE_EXPONENTIAL) {
+                coef = exp(-log((1.0 + ratio) / ratio) / len);
+                target = goal + (ratio * (goal - from));
+                pool->envelope_mul[v] = (float)coef;
+                pool->envelope_add[v] = (float)(target * (1.0 - coef));
+                n = log((end - target) / (level - target)) / log(coef);
+            } else {
+                pool->envelope_add[v] = (float)((goal - from) / len);
+                n = (end - level) / ((goal - from) / len);
+            }
+            pool->envelope_remaining[v] = (n > 1.0) ? (int)ceil(n - 1e-6) : 1;
+            return;
+        }
+        pool->envelope_level[v] = (float)goal;
+        stage = (stage == Envelope::STAGE_ATTACK) ? Envelope::STAGE_DECAY :
+                (stage == Envelope::STAGE_DECAY) ? Envelope::STAGE_SUSTAIN :
+                Envelope::STAGE_IDLE;
     }
 }
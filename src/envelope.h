@@ -9,6 +9,8 @@
 #ifndef envelope_h
 #define envelope_h
 
+class VoicePool;
+
 class EnvelopeConstants {
 public:
     static const int DEFAULT_ATTACK = 1000;
@@ -16,21 +18,60 @@ public:
     static const int DEFAULT_SUSTAIN = 1000;
     static const int DEFAULT_RELEASE = 50000;
     constexpr static const float DEFAULT_SUSTAIN_LEVEL = 0.5;
+    // sustain length that holds until release() instead of timing out
+    static const int SUSTAIN_HOLD = -1;
+    // SEGMENT CURVES
+    static const int CURVE_LINEAR = 0;
+    static const int CURVE_EXPONENTIAL = 1;
+    // exponential segments aim past their goal by this fraction of the
+    // segment's height, so they arrive in finite time
+    constexpr static const float ATTACK_OVERSHOOT = 0.3;
+    constexpr static const float DECAY_OVERSHOOT = 0.0001;
+    // voices are culled once their release falls below this level (-80 dB)
+    constexpr static const float DEFAULT_CULL_LEVEL = 0.0001;
+    // STAGES
+    static const int STAGE_IDLE = 0;
+    static const int STAGE_ATTACK = 1;
+    static const int STAGE_DECAY = 2;
+    static const int STAGE_SUSTAIN = 3;
+    static const int STAGE_RELEASE = 4;
 };
 
-// Finite Envelope
-class Envelope : public EnvelopeConstants{
+/*
+ Class Envelope:
+   ADSR parameters shared by an instrument's voices.  The per voice state
+   (stage, level, samples left in the stage, and the coefficients) lives in
+   the VoicePool; each sample the level advances by one multiply-add,
+     level = (level * mul) + add
+   which is a straight ramp when mul is 1 and an exponential approach
+   otherwise.  Stages end after a precomputed number of samples, landing
+   exactly on their goal level.  Sustain holds until release(), or for a
+   fixed number of samples; release starts from whatever level the voice
+   has reached, and a voice whose release ends is marked inactive.  A
+   release ends as soon as the level passes below the cull level, rather
+   than trailing off inaudibly, and a voice that would sustain below it
+   ends straight away.
+*/
+class Envelope : public EnvelopeConstants {
     // envelope parameters
-    int node1, node2, node3;
+    int attack, decay, sustain, release_len;
     float sustain_level;
+    int curve;
+    float cull_level;
+    void enter(VoicePool*, int, int);
 public:
-    int length; // in samples
+    int length; // in samples, attack to end of release when sustain times out
     Envelope(int a=Envelope::DEFAULT_ATTACK, 
              int d=Envelope::DEFAULT_DECAY, 
              int s=Envelope::DEFAULT_SUSTAIN, 
              int r=Envelope::DEFAULT_RELEASE, 
-             float sustain_level=Envelope::DEFAULT_SUSTAIN_LEVEL);
-    float calculate(int, bool);
+             float sustain_level=Envelope::DEFAULT_SUSTAIN_LEVEL,
+             int curve=Envelope::CURVE_LINEAR);
+    void set_cull_level(float);
+    void start(VoicePool*, int);
+    void release(VoicePool*, int);
+    bool advance(VoicePool*, int);
+    bool elapse(VoicePool*, int, int);
 };
 
-#endif /* envelope_h */
\ No newline at end of file
+#endif /* envelope_h */
@@ -0,0 +1,212 @@
+//
+//  eventloop.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "eventloop.h"
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ EventLoop constructor: no sources, no timers, running
+*/
+EventLoop::EventLoop() : running(true) {
+    this->num_sources = 0;
+    this->num_timers = 0;
+    this->next_timer_id = 0;
+    if(pipe(this->wake_pipe) != 0) {
+        this->wake_pipe[0] = this->wake_pipe[1] = -1; // poll() skips fd -1
+    } else {
+        fcntl(this->wake_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(this->wake_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+/*
+ EventLoop destructor.  Registered descriptors belong to their
+ controllers and are left open.
+*/
+EventLoop::~EventLoop() {
+    if(this->wake_pipe[0] >= 0) close(this->wake_pipe[0]);
+    if(this->wake_pipe[1] >= 0) close(this->wake_pipe[1]);
+}
+
+/*
+ Watch a file descriptor; registering one again replaces its handler
+   TAKES:
+     fd      --> int descriptor to watch for input
+     handler --> Handler called with fd when it is readable, hung up or
+                 in error, until the fd is removed
+     data    --> void * passed through to handler
+   RETURNS:
+     0 on success, 1 if MAX_SOURCES are already watched
+*/
+int EventLoop::add_fd(int fd, Handler handler, void *data) {
+    int s = this->find_source(fd);
+    
+    if(s < 0) {
+        if(this->num_sources >= EventLoop::MAX_SOURCES) return 1;
+        s = this->num_sources++;
+    }
+    this->sources[s].fd = fd;
+    this->sources[s].handler = handler;
+    this->sources[s].data = data;
+    return 0;
+}
+
+/*
+ Stop watching a file descriptor (it is not closed)
+*/
+void EventLoop::remove_fd(int fd) {
+    int s = this->find_source(fd);
+    
+    if(s < 0) return;
+    for(; s < this->num_sources - 1; s++) this->sources[s] = this->sources[s + 1];
+    this->num_sources--;
+}
+
+/*
+ Start a repeating timer
+   TAKES:
+     interval_ms --> int period, first due one period from now
+     handler     --> Handler called with the timer id
+     data        --> void * passed through to handler
+   RETURNS:
+     int timer id, or -1 if MAX_TIMERS are already running
+*/
+int EventLoop::add_timer(int interval_ms, Handler handler, void *data) {
+    Timer *t;
+    
+    if(this->num_timers >= EventLoop::MAX_TIMERS) return -1;
+    if(interval_ms < 1) interval_ms = 1;
+    t = &(this->timers[this->num_timers++]);
+    t->id = this->next_timer_id++;
+    t->interval_ms = interval_ms;
+    t->due = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval_ms);
+    t->handler = handler;
+    t->data = data;
+    return t->id;
+}
+
+/*
+ Cancel a timer
+   TAKES:
+     id --> int from add_timer
+*/
+void EventLoop::remove_timer(int id) {
+    int t = this->find_timer(id);
+    
+    if(t < 0) return;
+    for(; t < this->num_timers - 1; t++) this->timers[t] = this->timers[t + 1];
+    this->num_timers--;
+}
+
+/*
+ Wait until a watched fd is ready, a timer is due, stop() is called or
+ the timeout passes, then run every handler that is due
+   TAKES:
+     timeout_ms --> int longest wait, -1 to wait for an event
+   RETURNS:
+     int number of handlers run, -1 if poll() failed
+*/
+int EventLoop::run_once(int timeout_ms) {
+    struct pollfd fds[EventLoop::MAX_SOURCES + 1];
+    int ready[EventLoop::MAX_SOURCES];
+    int due[EventLoop::MAX_TIMERS];
+    int n, i, s, num_ready = 0, num_due = 0, handled = 0;
+    long long wait_us;
+    char drain[64];
+    Handler handler;
+    void *data;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    
+    // sleep no longer than the next timer, rounding up so it is due on waking
+    for(i = 0; i < this->num_timers; i++) {
+        wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      this->timers[i].due - now).count();
+        wait_us = (wait_us > 0) ? (wait_us + 999) / 1000 : 0;
+        if(timeout_ms < 0 || wait_us < timeout_ms) timeout_ms = (int)wait_us;
+    }
+    fds[0].fd = this->wake_pipe[0];
+    fds[0].events = POLLIN;
+    for(i = 0; i < this->num_sources; i++) {
+        fds[i + 1].fd = this->sources[i].fd;
+        fds[i + 1].events = POLLIN;
+    }
+    n = poll(fds, this->num_sources + 1, timeout_ms);
+    if(n < 0) return (errno == EINTR) ? 0 : -1;
+    if(n > 0 && (fds[0].revents & POLLIN)) {
+        while(read(this->wake_pipe[0], drain, sizeof(drain)) > 0) {}
+    }
+    // note what is ready before any handler changes the tables
+    for(i = 0; n > 0 && i < this->num_sources; i++) {
+        if(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) {
+            ready[num_ready++] = fds[i + 1].fd;
+        }
+    }
+    for(i = 0; i < num_ready && this->is_running(); i++) {
+        s = this->find_source(ready[i]);
+        if(s < 0) continue; // removed by an earlier handler
+        handler = this->sources[s].handler;
+        data = this->sources[s].data;
+        handler(ready[i], data);
+        handled++;
+    }
+    now = std::chrono::steady_clock::now();
+    for(i = 0; i < this->num_timers; i++) {
+        if(this->timers[i].due <= now) due[num_due++] = this->timers[i].id;
+    }
+    for(i = 0; i < num_due && this->is_running(); i++) {
+        s = this->find_timer(due[i]);
+        if(s < 0) continue;
+        // reschedule first, so the handler may cancel its own timer;
+        // a loop that fell behind skips the missed periods
+        this->timers[s].due += std::chrono::milliseconds(this->timers[s].interval_ms);
+        if(this->timers[s].due <= now) {
+            this->timers[s].due = now + std::chrono::milliseconds(this->timers[s].interval_ms);
+        }
+        handler = this->timers[s].handler;
+        data = this->timers[s].data;
+        handler(due[i], data);
+        handled++;
+    }
+    return handled;
+}
+
+/*
+ False once stop() has been called
+*/
+bool EventLoop::is_running() {
+    return this->running.load(std::memory_order_acquire);
+}
+
+/*
+ Ask the loop to finish.  Safe from any thread, and from handlers; a
+ run_once() blocked in poll() returns straight away.
+*/
+void EventLoop::stop() {
+    char c = 0;
+    this->running.store(false, std::memory_order_release);
+    if(this->wake_pipe[1] >= 0) {
+        if(write(this->wake_pipe[1], &c, 1) < 0) {} // full pipe is already awake
+    }
+}
+
+int EventLoop::find_source(int fd) {
+    for(int s = 0; s < this->num_sources; s++) {
+        if(this->sources[s].fd == fd) return s;
+    }
+    return -1;
+}
+
+int EventLoop::find_timer(int id) {
+    for(int t = 0; t < this->num_timers; t++) {
+        if(this->timers[t].id == id) return t;
+    }
+    return -1;
+}
@@ -0,0 +1,68 @@
+//
+//  eventloop.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef eventloop_h
+#define eventloop_h
+
+#include <atomic>
+#include <chrono>
+
+class EventLoopConstants {
+public:
+    static const int MAX_SOURCES = 16; // file descriptors watched at once
+    static const int MAX_TIMERS = 16;
+};
+
+/*
+ Class EventLoop:
+   Single-threaded poll() loop for the controller side of the DAW.
+   Controllers register file descriptors, handled when readable, and
+   repeating timers; run_once() sleeps in poll() until one of them is due,
+   so idle input costs no CPU.  Handlers run on the loop's thread one
+   after another, which keeps that thread the only producer of audio
+   events.  Handlers may add or remove sources and timers, their own
+   included.
+*/
+class EventLoop : public EventLoopConstants {
+public:
+    typedef void (*Handler)(int, void*); // fd or timer id, user data
+private:
+    struct Source {
+        int fd;
+        Handler handler;
+        void *data;
+    };
+    struct Timer {
+        int id;
+        int interval_ms;
+        std::chrono::steady_clock::time_point due;
+        Handler handler;
+        void *data;
+    };
+    Source sources[MAX_SOURCES];
+    int num_sources;
+    Timer timers[MAX_TIMERS];
+    int num_timers;
+    int next_timer_id;
+    int wake_pipe[2]; // lets stop() interrupt poll() from any thread
+    std::atomic<bool> running;
+    int find_source(int);
+    int find_timer(int);
+public:
+    EventLoop();
+    ~EventLoop();
+    int add_fd(int, Handler, void*);
+    void remove_fd(int);
+    int add_timer(int, Handler, void*);
+    void remove_timer(int);
+    int run_once(int timeout_ms=-1);
+    bool is_running();
+    void stop();
+};
+
+#endif /* eventloop_h */
@@ -0,0 +1,186 @@
+//
+//  eventqueue.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef eventqueue_h
+#define eventqueue_h
+
+#include <atomic>
+
+class Instrument;
+
+class EventConstants {
+public:
+    // EVENT TYPES
+    static const int EVENT_NOTE = 0;     // value = note constant
+    static const int EVENT_NOTE_OFF = 1; // value = note constant
+    static const int CACHE_LINE = 64;
+};
+
+/*
+ Struct Event:
+   A note for one instrument, applied on the audio thread at an engine
+   frame.  Frames already passed (0 included) apply at the start of the
+   next buffer.
+*/
+struct Event : public EventConstants {
+    int type;
+    Instrument *instrument;
+    int value;
+    unsigned long frame;
+};
+
+/*
+ Class EventQueue:
+   Bounded single-producer/single-consumer ring.  push(), stage() and
+   publish() belong to the controller thread and pop() to the audio
+   thread; none of them allocates, locks or waits.  SIZE must be a power
+   of two.
+*/
+template <class T, unsigned SIZE>
+class EventQueue : public EventConstants {
+    T items[SIZE];
+    char pad0[EventQueue::CACHE_LINE];
+    std::atomic<unsigned> head; // next slot the consumer may read, owned by producer
+    unsigned staged;            // next slot to write, owned by producer
+    char pad1[EventQueue::CACHE_LINE];
+    std::atomic<unsigned> tail; // next slot to read, owned by consumer
+    char pad2[EventQueue::CACHE_LINE];
+public:
+    EventQueue() : head(0), staged(0), tail(0) {
+        static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+    }
+    
+    /*
+     Producer: copy an item into the ring
+       RETURNS:
+         false if the ring is full
+    */
+    bool push(const T &item) {
+        if(!this->stage(item)) return false;
+        this->publish();
+        return true;
+    }
+    
+    /*
+     Producer: copy an item into the ring without handing it over yet;
+     publish() releases everything staged so far at once, so the consumer
+     sees a batch in one piece
+       RETURNS:
+         false if the ring is full
+    */
+    bool stage(const T &item) {
+        unsigned s = this->staged;
+        if(s - this->tail.load(std::memory_order_acquire) == SIZE) return false;
+        this->items[s & (SIZE - 1)] = item;
+        this->staged = s + 1;
+        return true;
+    }
+    
+    /*
+     Producer: hand every staged item to the consumer
+    */
+    void publish() {
+        this->head.store(this->staged, std::memory_order_release);
+    }
+    
+    /*
+     Consumer: copy the oldest item out of the ring
+       RETURNS:
+         false if the ring is empty
+    */
+    bool pop(T &item) {
+        unsigned t = this->tail.load(std::memory_order_relaxed);
+        if(t == this->head.load(std::memory_order_acquire)) return false;
+        item = this->items[t & (SIZE - 1)];
+        this->tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    
+    /*
+     Approximate number of queued items (exact from either owning thread)
+    */
+    unsigned size() {
+        return this->head.load(std::memory_order_acquire) -
+               this->tail.load(std::memory_order_acquire);
+    }
+};
+
+/*
+ Class EventSchedule:
+   Events taken off the queue but not yet due, kept in frame order on the
+   audio thread.  Events on the same frame stay in arrival order.  Fixed
+   capacity; nothing allocates.
+*/
+template <unsigned SIZE>
+class EventSchedule {
+    Event items[SIZE];
+    unsigned first; // oldest pending event
+    unsigned count;
+public:
+    EventSchedule() : first(0), count(0) {}
+    
+    /*
+     Add an event in frame order
+       RETURNS:
+         false if the schedule is full
+    */
+    bool insert(const Event &ev) {
+        unsigned i;
+        
+        if(this->count == SIZE) return false;
+        if(this->first + this->count == SIZE) {
+            // slide the pending events back to the front
+            for(i = 0; i < this->count; i++) this->items[i] = this->items[this->first + i];
+            this->first = 0;
+        }
+        i = this->first + this->count;
+        while(i > this->first && this->items[i - 1].frame > ev.frame) {
+            this->items[i] = this->items[i - 1];
+            i--;
+        }
+        this->items[i] = ev;
+        this->count++;
+        return true;
+    }
+    
+    /*
+     Take the earliest event if it is due
+       TAKES:
+         frame --> unsigned long events at or before this frame are due
+         ev    --> Event & to copy it into
+       RETURNS:
+         false if no event is due
+    */
+    bool due(unsigned long frame, Event &ev) {
+        if(this->count == 0 || this->items[this->first].frame > frame) return false;
+        ev = this->items[this->first];
+        this->first = (--this->count == 0) ? 0 : this->first + 1;
+        return true;
+    }
+    
+    /*
+     Frame of the earliest pending event
+       RETURNS:
+         false if nothing is pending
+    */
+    bool next(unsigned long &frame) {
+        if(this->count == 0) return false;
+        frame = this->items[this->first].frame;
+        return true;
+    }
+    
+    bool full() {
+        return this->count == SIZE;
+    }
+    
+    unsigned size() {
+        return this->count;
+    }
+};
+
+#endif /* eventqueue_h */
@@ -0,0 +1,98 @@
+//
+//  fft.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "fft.h"
+#include <math.h>
+
+/*
+ FFT constructor
+   TAKES:
+     size --> int transform length, a power of two
+*/
+FFT::FFT(int size) {
+    int i, bits = 0, r, b;
+    
+    this->size = size;
+    while((1 << bits) < size) bits++;
+    this->reversed = new int[size];
+    for(i = 0; i < size; i++) {
+        r = 0;
+        for(b = 0; b < bits; b++) {
+            if(i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        this->reversed[i] = r;
+    }
+    this->cosines = new float[size / 2];
+    this->sines = new float[size / 2];
+    for(i = 0; i < size / 2; i++) {
+        this->cosines[i] = (float)cos((2.0 * M_PI * i) / size);
+        this->sines[i] = (float)sin((2.0 * M_PI * i) / size);
+    }
+}
+
+/*
+ FFT destructor
+*/
+FFT::~FFT() {
+    delete [] this->reversed;
+    delete [] this->cosines;
+    delete [] this->sines;
+}
+
+/*
+ Forward transform, X[k] = sum x[n] e^(-2 pi i k n / N)
+   TAKES:
+     re --> float * size real parts, transformed in place
+     im --> float * size imaginary parts, transformed in place
+*/
+void FFT::forward(float *re, float *im) {
+    this->transform(re, im, -1.0);
+}
+
+/*
+ Inverse transform, x[n] = sum X[k] e^(2 pi i k n / N).  Not scaled by
+ 1 / N.
+*/
+void FFT::inverse(float *re, float *im) {
+    this->transform(re, im, 1.0);
+}
+
+/*
+ Iterative decimation-in-time butterflies
+   TAKES:
+     sign --> float -1 forward, 1 inverse
+*/
+void FFT::transform(float *re, float *im, float sign) {
+    int i, j, len, half, step, k;
+    float t, wr, wi, xr, xi;
+    
+    for(i = 0; i < this->size; i++) {
+        j = this->reversed[i];
+        if(j > i) {
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for(len = 2; len <= this->size; len <<= 1) {
+        half = len >> 1;
+        step = this->size / len;
+        for(i = 0; i < this->size; i += len) {
+            for(k = 0; k < half; k++) {
+                wr = this->cosines[k * step];
+                wi = sign * this->sines[k * step];
+                j = i + k + half;
+                xr = (re[j] * wr) - (im[j] * wi);
+                xi = (re[j] * wi) + (im[j] * wr);
+                re[j] = re[i + k] - xr;
+                im[j] = im[i + k] - xi;
+                re[i + k] += xr;
+                im[i + k] += xi;
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+//
+//  fft.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef fft_h
+#define fft_h
+
+/*
+ Class FFT:
+   In-place radix-2 complex FFT of a fixed power-of-two size.  Twiddle
+   factors and the bit reversal permutation are computed once in the
+   constructor; transforms keep no other state, so one FFT can be shared
+   by several threads.
+*/
+class FFT {
+    int size;
+    int *reversed;  // bit reversal permutation
+    float *cosines; // size / 2 twiddles
+    float *sines;
+    void transform(float*, float*, float);
+public:
+    FFT(int);
+    ~FFT();
+    void forward(float*, float*);
+    void inverse(float*, float*);
+};
+
+#endif /* fft_h */
@@ -7,6 +7,11 @@
 //
 
 #include "instrument.h"
+#include <string.h>
+#include <math.h>
+
+// storage for constants passed by reference (unoptimized builds)
+const int WaveTableSynthConstants::RECLAIM_INTERVAL_MS;
 
 /*
  Instrument constructor
@@ -15,36 +20,135 @@ Instrument::Instrument(int num_c, int num_v) {
     this->curr_voice = 0;
     this->num_channels = num_c;
     this->envelope = new Envelope();
-    for(int i = 0; i < num_v; i++) {
-        Voice *v = new Voice();
-        this->voices.push_back(v);
-    }
+    this->voices = new VoicePool(num_v, num_c);
+    this->steal_policy = Instrument::STEAL_OLDEST;
+    this->steals = 0;
+    this->drops = 0;
+    this->pan = Instrument::PAN_CENTER;
+    this->spread = 0.0;
 }
 
 /*
- WaveTableSynth destructor
+ Instrument destructor
 */
 Instrument::~Instrument() {
     delete this->envelope;
-    for(int i = 0; i < this->voices.size(); i++) {
-        delete this->voices[i];
-    }
+    delete this->voices;
 }
 
 /*
- Trigger a note
+ Trigger a note on a free voice, or on a stolen one when all are sounding
    TAKES:
      note --> the note to trigger
+   RETURNS:
+     int 0 if the note sounds, 1 if it was dropped
 */
 int Instrument::trigger(const int note_const) {
-    if(this->voices[this->curr_voice]->is_triggered()) {
-        return 1; // No free voices
-    } else {
-        this->trigger_template(note_const);
-        this->voices[this->curr_voice]->trigger();
-        this->curr_voice++;
-        this->curr_voice %= this->voices.size();
-        return 0;
+    const int policy = this->steal_policy.load(std::memory_order_relaxed);
+    int v = -1;
+    
+    if(policy == Instrument::STEAL_SAME_NOTE) {
+        v = this->voices->find_note(note_const);
+        if(v >= 0) this->steals.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(v < 0) v = this->voices->allocate();
+    if(v < 0) {
+        if(policy == Instrument::STEAL_QUIETEST) {
+            v = this->quietest();
+        } else if(policy != Instrument::STEAL_NONE) {
+            v = this->voices->oldest();
+        }
+        if(v < 0) {
+            this->drops.fetch_add(1, std::memory_order_relaxed);
+            return 1; // No free voices
+        }
+        this->steals.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->curr_voice = v;
+    this->trigger_template(note_const);
+    this->voices->start(v, note_const);
+    this->place(v);
+    this->envelope->start(this->voices, v);
+    return 0;
+}
+
+/*
+ Whether a number is a note constant; notes from outside the process are
+ checked before they reach the pitch tables
+*/
+bool Instrument::playable(int note_const) {
+    return note_const >= 0 && note_const <= Instrument::HIGHEST_NOTE;
+}
+
+/*
+ Note-off: release every voice playing a note
+   TAKES:
+     note --> the note to release
+   RETURNS:
+     int 0 if a voice was released, 1 if none was playing the note
+*/
+int Instrument::release(const int note_const) {
+    VoicePool *p = this->voices;
+    int status = 1;
+    
+    for(int v = 0; v < p->used; v++) {
+        if(p->active[v] && p->note[v] == note_const) {
+            this->envelope->release(p, v);
+            status = 0;
+        }
+    }
+    return status;
+}
+
+/*
+ Sounding voice with the lowest envelope level
+   RETURNS:
+     int voice index, or -1
+*/
+int Instrument::quietest() {
+    VoicePool *p = this->voices;
+    float level, best_level = 0.0;
+    int best = -1;
+    
+    for(int v = 0; v < p->used; v++) {
+        if(!p->active[v]) continue;
+        level = p->envelope_level[v];
+        if(best < 0 || level < best_level) {
+            best = v;
+            best_level = level;
+        }
+    }
+    return best;
+}
+
+/*
+ Set a starting voice's channel gains from the instrument's pan and
+ spread.  Spread offsets each voice from the pan by a golden ratio
+ sequence over its start order, so successive notes land far apart.  The
+ pan law is constant power, scaled so a centred voice plays at full
+ level in both channels; channels past the second are not panned.
+   TAKES:
+     v --> int voice index
+*/
+void Instrument::place(int v) {
+    VoicePool *p = this->voices;
+    double position, offset, angle;
+    int c;
+    
+    if(p->channels < 2) {
+        p->pan_gain[v] = 1.0;
+        return;
+    }
+    offset = fmod(p->started[v] * 0.6180339887, 1.0);
+    position = this->pan.load(std::memory_order_relaxed) +
+               (this->spread.load(std::memory_order_relaxed) * ((2.0 * offset) - 1.0));
+    if(position < Instrument::PAN_LEFT) position = Instrument::PAN_LEFT;
+    if(position > Instrument::PAN_RIGHT) position = Instrument::PAN_RIGHT;
+    angle = (position + 1.0) * (M_PI / 4.0);
+    p->pan_gain[v] = (float)(M_SQRT2 * cos(angle));
+    p->pan_gain[p->capacity + v] = (float)(M_SQRT2 * sin(angle));
+    for(c = 2; c < p->channels; c++) {
+        p->pan_gain[(c * p->capacity) + v] = 1.0;
     }
 }
 
@@ -55,67 +159,194 @@ void Instrument::advance() {
     int i;
     this->advance_template();
     // advance voices
-    for(i = 0; i < this->voices.size(); i++) {
-        this->voices[i]->advance(this->envelope->length);
+    for(i = 0; i < this->voices->used; i++) {
+        this->envelope->advance(this->voices, i);
     }
+    this->voices->compact();
+}
+
+/*
+ Number of voices currently sounding
+*/
+int Instrument::active_voices() {
+    return this->voices->count_active();
+}
+
+/*
+ Choose what happens to a note when every voice is sounding.  Safe to
+ call from any thread.
+   TAKES:
+     policy --> int STEAL_NONE, STEAL_OLDEST, STEAL_QUIETEST or STEAL_SAME_NOTE
+*/
+void Instrument::set_steal_policy(int policy) {
+    if(policy < Instrument::STEAL_NONE || policy > Instrument::STEAL_SAME_NOTE) return;
+    this->steal_policy.store(policy, std::memory_order_relaxed);
+}
+
+/*
+ Replace the envelope shared by the instrument's voices.  Not safe while
+ the instrument is being rendered; voices already sounding keep their
+ current stage until it ends.
+   TAKES:
+     envelope --> const Envelope & to copy
+*/
+void Instrument::set_envelope(const Envelope &envelope) {
+    *(this->envelope) = envelope;
+}
+
+/*
+ Place the instrument's notes in the stereo field.  Safe to call from
+ any thread; applies to notes started afterwards.
+   TAKES:
+     pan --> float PAN_LEFT (-1) to PAN_RIGHT (1)
+*/
+void Instrument::set_pan(float pan) {
+    if(pan < Instrument::PAN_LEFT) pan = Instrument::PAN_LEFT;
+    if(pan > Instrument::PAN_RIGHT) pan = Instrument::PAN_RIGHT;
+    this->pan.store(pan, std::memory_order_relaxed);
+}
+
+/*
+ Scatter successive notes around the pan position.  Safe to call from
+ any thread; applies to notes started afterwards.
+   TAKES:
+     spread --> float 0 (every note at the pan position) to 1 (anywhere
+                from hard left to hard right of it)
+*/
+void Instrument::set_spread(float spread) {
+    if(spread < 0.0) spread = 0.0;
+    if(spread > 1.0) spread = 1.0;
+    this->spread.store(spread, std::memory_order_relaxed);
 }
 
 /*
- Calculates a note frequency
+ Set the level below which releasing voices are cut off, so their
+ inaudible tails are not rendered.  Not safe while the instrument is
+ being rendered.
    TAKES:
-     
+     level --> float 0 <= x < 1, 0 to let releases run to the end
+*/
+void Instrument::set_cull_level(float level) {
+    this->envelope->set_cull_level(level);
+}
+
+/*
+ Notes that took over a sounding voice, since construction
+*/
+unsigned long Instrument::get_steals() {
+    return this->steals.load(std::memory_order_relaxed);
+}
+
+/*
+ Notes dropped for want of a voice, since construction
+*/
+unsigned long Instrument::get_drops() {
+    return this->drops.load(std::memory_order_relaxed);
+}
+
+/*
+ Render a block of interleaved frames.  This default implementation is the
+ slow per-sample path, built on output() and advance(); subclasses should
+ override it with a real block renderer.
+   TAKES:
+     out      --> float * interleaved output buffer (frames * channels)
+     frames   --> number of frames to render
+     channels --> number of interleaved channels in out
+*/
+void Instrument::render(float *out, unsigned long frames, int channels) {
+    unsigned long i;
+    int c;
+    
+    for(i = 0; i < frames; i++) {
+        for(c = 0; c < channels; c++) {
+            *out++ = this->output(c);
+        }
+        this->advance();
+    }
+}
+
+/*
+ Whether the next block would be silence: no voice has been started or
+ is still sounding.  Lets the mixer skip the instrument entirely; call on
+ the audio thread, between blocks.
+   RETURNS:
+     bool true if render() would write only zeros
+*/
+bool Instrument::silent() {
+    return this->voices->used == 0;
+}
+
+/*
+ Calculates a note's table increment
+   TAKES:
+     note_const --> const int note constant
+   RETURNS:
+     float table positions per sample
 */
 float WaveTableSynth::calculate_note(const int note_const) {
     double base_hz = this->BASE_HZ[note_const % 12];
     double octave = (double)(note_const / (int)12);
-    return (float)((base_hz * pow((double)2, octave)) / 110);
+    double hz = base_hz * pow((double)2, octave);
+    return (float)((hz * WaveTable::TABLE_SIZE) / WaveTableSynth::SAMPLE_RATE);
 }
 
 /*
  WaveTableSynth default constructor
 */
 WaveTableSynth::WaveTableSynth(int num_c, int num_v) : 
-Instrument::Instrument(num_c, num_v) {
-    int i;
-    this->pitch_incrementers = new float[this->voices.size()];
-    this->wavetable_positions = new float[(this->voices.size()*this->num_channels)];
-    for(i = 0; i < this->voices.size(); i++) {
-        this->pitch_incrementers[i] = START_NOTE;
-    }
-    for(int i = 0; i < (this->voices.size()*this->num_channels); i++){
-        this->wavetable_positions[i] = 0.0;
+Instrument::Instrument(num_c, num_v), table(new WaveTable()) {
+    VoicePool *p = this->voices;
+    float inc = this->calculate_note(START_NOTE);
+    for(int v = 0; v < p->capacity; v++) {
+        // padding voices stay silent and still
+        p->increment[v] = (v < p->size) ? WaveTable::phase_increment(inc) : 0;
+        p->table_offset[v] = WaveTable::level_offset(WaveTable::level_for(inc));
     }
+    this->accumulators = new float[this->num_channels * VoiceKernel::KERNEL_FRAMES *
+                                   VoiceKernel::MAX_LANES];
+    this->voice_out = new float[VoiceKernel::KERNEL_FRAMES * VoiceKernel::MAX_LANES];
+    this->kernel = VoiceKernel::best();
+    this->choose_render_path();
+    this->interpolation = WaveTable::INTERP_LINEAR;
+    this->build_command = 0;
+    this->build_busy = false;
+    this->build_quit = false;
+    this->builder = std::thread(&WaveTableSynth::build_loop, this);
 }
 
 /*
  WaveTableSynth destructor
 */
 WaveTableSynth::~WaveTableSynth() {
-    delete [] this->pitch_incrementers;
-    delete [] this->wavetable_positions;
+    {
+        std::lock_guard<std::mutex> lock(this->build_mutex);
+        this->build_quit = true;
+    }
+    this->build_cond.notify_all();
+    this->builder.join();
+    delete [] this->accumulators;
+    delete [] this->voice_out;
 }
 
 /*
  WaveTableSynth override of trigger_template
 */
 void WaveTableSynth::trigger_template(const int note_const) {
-    this->pitch_incrementers[this->curr_voice] = this->calculate_note(note_const);
+    float inc = this->calculate_note(note_const);
+    this->voices->increment[this->curr_voice] = WaveTable::phase_increment(inc);
+    // pick the band-limited table for this pitch once, at trigger time
+    this->voices->table_offset[this->curr_voice] =
+        WaveTable::level_offset(WaveTable::level_for(inc));
 }
 
 /*
  WaveTableSynth override of advance_template
 */
 void WaveTableSynth::advance_template() {
-    int v, c, x;
-    // advance channel positions
-    for(v = 0; v < this->voices.size(); v++) {
-        for(c = 0; c < this->num_channels; c++) {
-            x = (v*this->num_channels) + c;
-            this->wavetable_positions[x] += this->pitch_incrementers[v];
-            if(this->wavetable_positions[x] > WaveTable::TABLE_SIZE) {
-                this->wavetable_positions[x] -=  WaveTable::TABLE_SIZE;
-            }
-        }
+    VoicePool *p = this->voices;
+    // advance phases, wrapping at 2^32
+    for(int v = 0; v < p->used; v++) {
+        p->phase[v] += p->increment[v];
     }
 }
 
@@ -127,41 +358,309 @@ void WaveTableSynth::advance_template() {
      float added voices
 */
 float WaveTableSynth::output(int chann) {
+    VoicePool *p = this->voices;
     float out = 0.0;
-    int i, wt_index;
+    int i;
+    const int mode = this->interpolation.load(std::memory_order_relaxed);
     float voice_signal;
     float envelope_signal;
+    WaveTable *wt = this->table.read_lock();
     
-    for(i = 0; i < this->voices.size(); i++) {
-        wt_index = (int)(this->wavetable_positions[(i*this->num_channels)+chann]);
-        voice_signal = this->table.table[wt_index];
-        envelope_signal = this->envelope->calculate(this->voices[i]->envelope_pos, 
-                                                    this->voices[i]->is_triggered());
-        out += (voice_signal * envelope_signal);
+    for(i = 0; i < p->used; i++) {
+        voice_signal = WaveTable::read(wt->levels + p->table_offset[i],
+                                       p->phase[i], mode);
+        envelope_signal = p->envelope_level[i]; // includes gain
+        out += (voice_signal * envelope_signal * p->pan_gain[(chann*p->capacity)+i]);
     }
+    this->table.read_unlock();
     return out;
 }
 
 /*
- WaveTableSynth-specific command processing
+ Render a block of interleaved frames straight from the voice pool, on
+ the render path chosen for this instrument's layout and kernel.  The
+ interpolation mode picks the kernel loop once per block.
+   TAKES:
+     out      --> float * interleaved output buffer (frames * channels)
+     frames   --> number of frames to render
+     channels --> number of interleaved channels in out
+*/
+void WaveTableSynth::render(float *out, unsigned long frames, int channels) {
+    WaveTable *wt = this->table.read_lock(); // held for the whole block
+    const int mode = this->interpolation.load(std::memory_order_relaxed);
+    VoiceKernel::Run run = this->kernel.run[mode];
+    
+    if(channels == this->voices->channels) {
+        (this->*render_path)(wt, out, frames, channels, run);
+    } else {
+        (this->*render_generic)(wt, out, frames, channels, run);
+    }
+    this->table.read_unlock();
+}
+
+/*
+ Add a group's mono kernel output into one channel's accumulators, each
+ lane scaled by its voice's pan gain.  The buffers never overlap, which
+ lets the compiler keep whole frames of lanes in vector registers.
+   TAKES:
+     acc    --> float * channel accumulators, frames * LANES
+     in     --> const float * kernel output, frames * LANES
+     gain   --> const float * LANES pan gains
+     frames --> int frames to add
+*/
+template<int LANES>
+static inline void place_lanes(float *__restrict acc, const float *__restrict in,
+                               const float *gain, int frames) {
+    float g[LANES];
+    int i, l;
+    
+    for(l = 0; l < LANES; l++) g[l] = gain[l];
+    for(i = 0; i < frames * LANES; i += LANES) {
+        for(l = 0; l < LANES; l++) acc[i + l] += in[i + l] * g[l];
+    }
+}
+
+/*
+ Render path body.  CHANNELS is the pool and output channel count, or 0
+ to read both at run time; LANES is the kernel width.  With both fixed the
+ channel loops and the lane fold unroll, and the fold vectorizes.
+ Voices are rendered LANES at a time, in spans that stop wherever an
+ envelope in the group changes stage; groups with nothing sounding only
+ advance their phases.  The kernel renders each voice once, in mono, and
+ its pan gains then add it into every channel.  Each lane accumulates
+ separately and the lanes are summed once per frame at the end of every
+ KERNEL_FRAMES pass.
+   TAKES:
+     wt       --> WaveTable * read locked by the caller
+     out      --> float * interleaved output buffer (frames * channels)
+     frames   --> number of frames to render
+     channels --> number of interleaved channels in out
+     run      --> VoiceKernel::Run loop for the interpolation mode
+*/
+template<int CHANNELS, int LANES>
+void WaveTableSynth::render_voices(WaveTable *wt, float *out, unsigned long frames,
+                                   int channels, VoiceKernel::Run run) {
+    VoicePool *p = this->voices;
+    const int pool_chans = CHANNELS ? CHANNELS : p->channels;
+    const int out_chans = CHANNELS ? CHANNELS : channels;
+    const int chans = (out_chans < pool_chans) ? out_chans : pool_chans;
+    const int acc_stride = VoiceKernel::KERNEL_FRAMES * LANES; // per channel
+    unsigned long done = 0;
+    int n, g, i, l, v, c, span;
+    bool sounding;
+    float sum;
+    float *acc;
+    
+    memset(out, 0, frames * out_chans * sizeof(float));
+    while(done < frames) {
+        n = (int)(((frames - done) < VoiceKernel::KERNEL_FRAMES) ?
+                  (frames - done) : VoiceKernel::KERNEL_FRAMES);
+        memset(this->accumulators, 0, chans * acc_stride * sizeof(float));
+        for(g = 0; g < p->used; g += LANES) {
+            for(i = 0; i < n; i += span) {
+                // run to the first stage change in the group, or the pass end
+                span = n - i;
+                sounding = false;
+                for(l = 0; l < LANES; l++) {
+                    v = g + l;
+                    if(p->active[v]) {
+                        if(p->envelope_remaining[v] < span) span = p->envelope_remaining[v];
+                        sounding = true;
+                    }
+                }
+                if(sounding) {
+                    // each voice once, in mono, then placed in every channel
+                    run(wt->levels, p->table_offset + g, p->phase + g,
+                        p->increment + g, p->envelope_level + g,
+                        p->envelope_mul + g, p->envelope_add + g,
+                        this->voice_out, span);
+                    for(c = 0; c < chans; c++) {
+                        place_lanes<LANES>(this->accumulators + (c * acc_stride) + (i * LANES),
+                                           this->voice_out,
+                                           p->pan_gain + (c * p->capacity) + g, span);
+                    }
+                } else {
+                    for(l = 0; l < LANES; l++) {
+                        p->phase[g + l] += p->increment[g + l] * (uint32_t)span;
+                    }
+                }
+                for(l = 0; l < LANES; l++) {
+                    this->envelope->elapse(p, g + l, span);
+                }
+            }
+        }
+        // fold the lanes
+        for(c = 0; c < chans; c++) {
+            acc = this->accumulators + (c * acc_stride);
+            for(i = 0; i < n; i++) {
+                sum = 0.0;
+                for(l = 0; l < LANES; l++) sum += acc[(i * LANES) + l];
+                out[((done + i) * out_chans) + c] = sum;
+            }
+        }
+        p->compact();
+        done += n;
+    }
+}
+
+/*
+ Pick the render paths for the pool's channel count and the kernel's
+ width.  Mono and stereo get fully specialized paths.
+*/
+void WaveTableSynth::choose_render_path() {
+    const int channels = this->voices->channels;
+    
+    if(this->kernel.lanes == 8) {
+        this->render_generic = &WaveTableSynth::render_voices<0, 8>;
+        this->render_path = (channels == 1) ? &WaveTableSynth::render_voices<1, 8> :
+                            (channels == 2) ? &WaveTableSynth::render_voices<2, 8> :
+                            this->render_generic;
+    } else {
+        this->render_generic = &WaveTableSynth::render_voices<0, 4>;
+        this->render_path = (channels == 1) ? &WaveTableSynth::render_voices<1, 4> :
+                            (channels == 2) ? &WaveTableSynth::render_voices<2, 4> :
+                            this->render_generic;
+    }
+}
+
+/*
+ Select how table entries are interpolated.  Safe to call from any thread;
+ takes effect at the next buffer.
+   TAKES:
+     mode --> int WaveTable::INTERP_TRUNCATE, INTERP_LINEAR or INTERP_CUBIC
+*/
+void WaveTableSynth::set_interpolation(int mode) {
+    if(mode < WaveTable::INTERP_TRUNCATE || mode > WaveTable::INTERP_CUBIC) return;
+    this->interpolation.store(mode, std::memory_order_relaxed);
+}
+
+/*
+ Current interpolation mode
+*/
+int WaveTableSynth::get_interpolation() {
+    return this->interpolation.load(std::memory_order_relaxed);
+}
+
+/*
+ Replace the render kernel chosen at construction, e.g. with a scalar
+ reference.  Not safe while the instrument is being rendered.
+   TAKES:
+     kernel --> VoiceKernel from VoiceKernel::available or reference
+*/
+void WaveTableSynth::set_kernel(VoiceKernel kernel) {
+    this->kernel = kernel;
+    this->choose_render_path();
+}
+
+/*
+ Name of the render kernel in use
+*/
+const char *WaveTableSynth::kernel_name() {
+    return this->kernel.name;
+}
+
+/*
+ WaveTableSynth-specific command processing.  Called from a controller
+ thread: the new table is built in the background and swapped in at the
+ start of a later buffer, so playback is never interrupted.
    TAKES:
      command --> const int command code
      data    --> void * any data passed with command
 */
 void WaveTableSynth::command(const int command, void *data) {
-    switch(command) {
-        case COMMAND_SINE_WAVE:
-            this->table.sine_wave();
-            break;
-        case COMMAND_SQUARE_WAVE:
-            this->table.square_wave();
-            break;
-        case COMMAND_CUSTOM_WAVE:
-            int *d = (int*)data;
-            for(int i=0; i < WaveTable::HIGHEST_HARMONIC; i++) {
-                this->table.harmonic_amplitudes[i] = d[i];
+    int *d = (int*)data;
+    Spectrum *spectrum = (Spectrum*)data;
+    
+    if(command == COMMAND_INTERPOLATION) {
+        this->set_interpolation(*d);
+        return;
+    }
+    if(command != COMMAND_SINE_WAVE && command != COMMAND_SQUARE_WAVE &&
+       command != COMMAND_CUSTOM_WAVE && command != COMMAND_SPECTRUM) return;
+    {
+        std::lock_guard<std::mutex> lock(this->build_mutex);
+        // a newer request replaces one that has not been built yet
+        this->build_command = command;
+        if(command == COMMAND_CUSTOM_WAVE) {
+            for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
+                this->build_harmonics[i] = d[i];
+            }
+        }
+        if(command == COMMAND_SPECTRUM) {
+            this->build_amplitudes.assign(spectrum->amplitudes,
+                                          spectrum->amplitudes + spectrum->count);
+            this->build_phases.assign(spectrum->count, 0.0);
+            if(spectrum->phases != NULL) {
+                this->build_phases.assign(spectrum->phases,
+                                          spectrum->phases + spectrum->count);
+            }
+        }
+    }
+    this->build_cond.notify_all();
+}
+
+/*
+ Block until every table requested so far has been published
+*/
+void WaveTableSynth::sync() {
+    std::unique_lock<std::mutex> lock(this->build_mutex);
+    while(this->build_command != 0 || this->build_busy) {
+        this->build_cond.wait(lock);
+    }
+}
+
+/*
+ Table builder thread: builds requested tables into fresh buffers,
+ publishes them, and frees tables the audio thread has let go of.
+*/
+void WaveTableSynth::build_loop() {
+    std::unique_lock<std::mutex> lock(this->build_mutex);
+    int command;
+    int harmonics[WaveTable::HIGHEST_HARMONIC];
+    std::vector<float> amplitudes;
+    std::vector<float> phases;
+    WaveTable *wt;
+    
+    while(!this->build_quit) {
+        if(this->build_command == 0) {
+            this->build_cond.wait_for(lock,
+                std::chrono::milliseconds(WaveTableSynth::RECLAIM_INTERVAL_MS));
+        }
+        if(this->build_command != 0 && !this->build_quit) {
+            command = this->build_command;
+            this->build_command = 0;
+            this->build_busy = true;
+            for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
+                harmonics[i] = this->build_harmonics[i];
             }
-            this->table.custom_wave();
-            break;
+            amplitudes.swap(this->build_amplitudes);
+            phases.swap(this->build_phases);
+            // build without holding the lock
+            lock.unlock();
+            wt = new WaveTable();
+            switch(command) {
+                case COMMAND_SINE_WAVE:
+                    wt->sine_wave();
+                    break;
+                case COMMAND_SQUARE_WAVE:
+                    wt->square_wave();
+                    break;
+                case COMMAND_CUSTOM_WAVE:
+                    for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
+                        wt->harmonic_amplitudes[i] = harmonics[i];
+                    }
+                    wt->custom_wave();
+                    break;
+                case COMMAND_SPECTRUM:
+                    wt->set_spectrum(amplitudes.data(), phases.data(),
+                                     (int)amplitudes.size());
+                    break;
+            }
+            this->table.publish(wt);
+            lock.lock();
+            this->build_busy = false;
+            this->build_cond.notify_all();
+        }
+        this->table.reclaim();
     }
 }
@@ -12,13 +12,30 @@
 #include "voice.h"
 #include "envelope.h"
 #include "wavetable.h"
+#include "rcu.h"
+#include "voicekernel.h"
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 class InstrumentConstants {
 public:
     static const int DEFAULT_NUM_VOICES = 6;
-    constexpr static const float START_NOTE = 2.0275;
+    static const int START_NOTE = 36; // A3, where idle voices sit
+    static const int SAMPLE_RATE = 44100; // rate note pitches assume
+    // VOICE STEALING POLICIES, when every voice is sounding
+    static const int STEAL_NONE = 0;      // drop the new note
+    static const int STEAL_OLDEST = 1;
+    static const int STEAL_QUIETEST = 2;
+    static const int STEAL_SAME_NOTE = 3; // retrigger the voice already on
+                                          // the note, else the oldest
+    // PAN POSITIONS, -1 (left) to 1 (right)
+    constexpr static const float PAN_LEFT = -1.0;
+    constexpr static const float PAN_CENTER = 0.0;
+    constexpr static const float PAN_RIGHT = 1.0;
     // NOTE CONSTANTS:
     static const int A1 = 12;
     static const int AS1 = 13;
@@ -80,6 +97,7 @@ public:
     static const int FS5 = 69;
     static const int G5 = 70;
     static const int GS5 = 71;
+    static const int HIGHEST_NOTE = GS5;
 };
 
 class WaveTableSynthConstants {
@@ -91,32 +109,84 @@ public:
     static const int COMMAND_SINE_WAVE = 100;
     static const int COMMAND_SQUARE_WAVE = 101;
     static const int COMMAND_CUSTOM_WAVE = 102;
+    static const int COMMAND_SPECTRUM = 103; // data is a Spectrum *
+    static const int COMMAND_INTERPOLATION = 104; // data is an int * mode
+    // how often the table builder frees retired tables
+    static const int RECLAIM_INTERVAL_MS = 50;
+};
+
+// COMMAND_SPECTRUM payload, copied before command() returns
+struct Spectrum {
+    int count; // harmonics 1..count
+    const float *amplitudes;
+    const float *phases; // radians, or NULL for sine phase
 };
 
 // Instrument abstract base class
 class Instrument : public InstrumentConstants {
 protected:
-    std::vector<Voice*> voices;
+    VoicePool *voices;
     Envelope *envelope;
-    int curr_voice;
+    int curr_voice; // voice being started, for trigger_template
     int num_channels;
+    std::atomic<int> steal_policy;
+    std::atomic<unsigned long> steals;
+    std::atomic<unsigned long> drops;
+    std::atomic<float> pan;
+    std::atomic<float> spread;
+    int quietest();
+    void place(int);
 public:
     Instrument(int num_channels=2, int num_v=Instrument::DEFAULT_NUM_VOICES);
-    ~Instrument();
+    virtual ~Instrument();
     int trigger(const int);
+    int release(const int);
+    static bool playable(int);
     void advance();
+    int active_voices();
+    void set_steal_policy(int);
+    void set_envelope(const Envelope&);
+    void set_pan(float);
+    void set_spread(float);
+    void set_cull_level(float);
+    unsigned long get_steals();
+    unsigned long get_drops();
     // abstract interface
     virtual void trigger_template(const int) {};
     virtual void advance_template() {};
     virtual float output(int) { return 0.0; };
+    virtual void render(float*, unsigned long, int);
+    virtual bool silent(); // the next block would be all zeros
     virtual void command(const int, void*) {};
+    virtual void sync() {}; // wait for earlier commands to take effect
 };
 
 // Synth instrument class
 class WaveTableSynth : public Instrument, public WaveTableSynthConstants {
-    WaveTable table;
-    float *wavetable_positions;
-    float *pitch_incrementers;
+    RcuPointer<WaveTable> table; // read by the audio thread
+    float *accumulators; // per channel, KERNEL_FRAMES * lanes
+    float *voice_out;    // mono kernel output, KERNEL_FRAMES * lanes
+    VoiceKernel kernel;
+    std::atomic<int> interpolation; // WaveTable::INTERP_* mode
+    // block renderers compiled for a channel count (0 = any) and kernel width
+    typedef void (WaveTableSynth::*RenderPath)(WaveTable*, float*, unsigned long, int,
+                                               VoiceKernel::Run);
+    RenderPath render_path;    // output channels match the voice pool
+    RenderPath render_generic; // any other output layout
+    template<int CHANNELS, int LANES>
+    void render_voices(WaveTable*, float*, unsigned long, int, VoiceKernel::Run);
+    void choose_render_path();
+    // background table builder
+    std::thread builder;
+    std::mutex build_mutex;
+    std::condition_variable build_cond;
+    int build_command; // 0 when nothing is pending
+    int build_harmonics[WaveTable::HIGHEST_HARMONIC];
+    std::vector<float> build_amplitudes;
+    std::vector<float> build_phases;
+    bool build_busy;
+    bool build_quit;
+    void build_loop();
     // helper method(s)
     float calculate_note(const int);
 public:
@@ -127,7 +197,13 @@ public:
     void trigger_template(const int);
     void advance_template();
     float output(int);
+    void render(float*, unsigned long, int);
     void command(const int, void*);
+    void sync();
+    void set_interpolation(int);
+    int get_interpolation();
+    void set_kernel(VoiceKernel);
+    const char *kernel_name();
 };
 
 #endif /* instrument_h */
\ No newline at end of file
@@ -7,6 +7,9 @@
 //
 
 #include "littledaw.h"
+#include "denormals.h"
+#include <chrono>
+#include <string.h>
 
 /*
  Mapping struct for Instruments
@@ -18,52 +21,53 @@ struct Mapping {
 
 /*
  Daw constructor
+   TAKES:
+     backend --> AudioBackend * to drive the engine, or NULL for the
+                 default PortAudio output (the daw then owns it)
 */
-Daw::Daw() {
+Daw::Daw(AudioBackend *backend) {
     // objects
-    this->mixer = new Mixer;
-    this->outputParameters = new PaStreamParameters;
-    this->err = Pa_Initialize();
-    if(this->err != paNoError) this->error();
-    // setup output parameters for Pa_OpenStream()
-    this->outputParameters->device = Pa_GetDefaultOutputDevice();
-    this->outputParameters->channelCount = Daw::DEFAULT_NUM_CHANNELS; // stereo
-    this->outputParameters->sampleFormat = paFloat32; // 32 bit floating point samples
-    this->outputParameters->suggestedLatency = Pa_GetDeviceInfo(
-                                               this->outputParameters->device)->
-      defaultLowOutputLatency;
-    this->outputParameters->hostApiSpecificStreamInfo = NULL;
-    // open stream
-    this->err = Pa_OpenStream(&(this->stream),
-                              NULL,
-                              this->outputParameters,
-                              Daw::DEFAULT_SAMPLE_RATE,
-                              Daw::DEFAULT_FRAMES_PER_BUFFER,
-                              paClipOff,
-                              this->callback,
-                              this);
-    if(this->err != paNoError) this->error();
-    // start stream
-    this->err = Pa_StartStream(this->stream);
-    if(this->err != paNoError) this->error();
+    this->mixer = new Mixer(Daw::DEFAULT_SAMPLE_RATE);
+    this->stats = new DspStats;
+    this->events = new EventQueue<Event, Daw::EVENT_QUEUE_SIZE>;
+    this->schedule = new EventSchedule<Daw::EVENT_QUEUE_SIZE>;
+    this->batching = false;
+    this->clock = 0;
+    this->owns_backend = (backend == NULL);
+    this->backend = this->owns_backend ? new PortAudioBackend() : backend;
+    // open and start the audio stream
+    if(this->backend->open(this, Daw::DEFAULT_SAMPLE_RATE,
+                           Daw::DEFAULT_NUM_CHANNELS,
+                           Daw::DEFAULT_FRAMES_PER_BUFFER)) this->error();
+    if(this->backend->start()) this->error();
 }
 
 /*
  Daw destructor
 */
 Daw::~Daw() {
+  this->stop_recording();
+  if(this->owns_backend) delete this->backend;
+  delete this->mixer->set_pool(NULL);
   delete this->mixer;
-  delete this->outputParameters;
+  delete this->stats;
+  delete this->events;
+  delete this->schedule;
   for(int i = 0; i < this->mappings.size(); i++) {
       delete this->mappings[i];
   }
 }
 
 /*
- Register an instrument with the daw
+ Register an instrument with the daw and give it a mixer track
 */
 void Daw::add_instrument(Instrument *instrument) {
     this->instruments.push_back(instrument);
+    if(this->mixer->add_track(instrument) < 0) {
+        for(int i = 0; i < this->controllers.size(); i++) {
+            this->controllers[i]->error("no free mixer tracks");
+        }
+    }
 }
 
 /*
@@ -83,13 +87,234 @@ void Daw::map_controller(Controller *c, Instrument *i) {
     this->mappings.push_back(m);
 }
 
+/*
+ Render instruments on a pool of worker threads
+   TAKES:
+     num_workers --> int helper threads; 0 renders on the audio thread only
+*/
+void Daw::set_workers(int num_workers) {
+    WorkerPool *pool = (num_workers > 0) ? new WorkerPool(num_workers) : NULL;
+    delete this->mixer->set_pool(pool);
+}
+
+/*
+ Start recording to disk (control thread).  Files ending in ".raw" are
+ raw float32, anything else a float32 WAV.
+   TAKES:
+     path       --> const char * output file
+     instrument --> Instrument * whose track to record pre-fader, or NULL
+                    for the master output
+   RETURNS:
+     0 on success, 1 if the file could not be created or the
+     instrument has no track
+*/
+int Daw::record(const char *path, Instrument *instrument) {
+    Recorder *r, *old;
+    size_t len = strlen(path);
+    int format = Recorder::FORMAT_WAV;
+    int track = -1;
+    
+    if(instrument != NULL) {
+        track = this->mixer->find_track(instrument);
+        if(track < 0) return 1;
+    }
+    if(len > 4 && strcmp(path + len - 4, ".raw") == 0) format = Recorder::FORMAT_RAW;
+    r = new Recorder();
+    if(r->open(path, Daw::DEFAULT_SAMPLE_RATE, Daw::DEFAULT_NUM_CHANNELS, format)) {
+        delete r;
+        return 1;
+    }
+    if(track < 0) {
+        old = this->mixer->set_recorder(r);
+    } else {
+        old = this->mixer->set_track_recorder(track, r);
+    }
+    // a new take on a tap ends the one before
+    for(size_t i = 0; i < this->recorders.size(); i++) {
+        if(this->recorders[i] == old) {
+            this->recorders.erase(this->recorders.begin() + i);
+            this->recorder_tracks.erase(this->recorder_tracks.begin() + i);
+            break;
+        }
+    }
+    delete old;
+    this->recorders.push_back(r);
+    this->recorder_tracks.push_back(track);
+    return 0;
+}
+
+/*
+ Stop every recording and close its files (control thread)
+*/
+void Daw::stop_recording() {
+    for(size_t i = 0; i < this->recorders.size(); i++) {
+        if(this->recorder_tracks[i] < 0) {
+            this->mixer->set_recorder(NULL);
+        } else {
+            this->mixer->set_track_recorder(this->recorder_tracks[i], NULL);
+        }
+        if(this->recorders[i]->close()) {
+            for(size_t c = 0; c < this->controllers.size(); c++) {
+                this->controllers[c]->error("recording failed, take is incomplete");
+            }
+        }
+        delete this->recorders[i];
+    }
+    this->recorders.clear();
+    this->recorder_tracks.clear();
+}
+
+/*
+ True while any tap is recording
+*/
+bool Daw::recording() {
+    return !this->recorders.empty();
+}
+
+/*
+ Queue an event for the audio thread, or stage it inside a batch
+   RETURNS:
+     0 on success, 1 if the event queue is full
+*/
+int Daw::push_event(const Event &ev) {
+    if(this->batching) return this->events->stage(ev) ? 0 : 1;
+    return this->events->push(ev) ? 0 : 1;
+}
+
+/*
+ Hold back events queued from now on until end_batch(), so the audio
+ thread takes them all in the same buffer (controller thread)
+*/
+void Daw::begin_batch() {
+    this->batching = true;
+}
+
+/*
+ Hand every event queued since begin_batch() to the audio thread at once
+*/
+void Daw::end_batch() {
+    this->batching = false;
+    this->events->publish();
+}
+
+/*
+ Engine frame at the start of the next buffer.  Events stamped a little
+ ahead of it play at their exact frame.
+*/
+unsigned long Daw::frame_time() {
+    return this->clock.load(std::memory_order_acquire);
+}
+
+/*
+ Queue a note for an instrument
+   TAKES:
+     instrument --> Instrument * to play
+     note       --> note constant
+     frame      --> unsigned long engine frame to start on; 0, or a frame
+                    already passed, starts it with the next buffer
+   RETURNS:
+     0 on success, 1 if the event queue is full
+*/
+int Daw::trigger(Instrument *instrument, const int note, unsigned long frame) {
+    Event ev;
+    ev.type = Event::EVENT_NOTE;
+    ev.instrument = instrument;
+    ev.value = note;
+    ev.frame = frame;
+    return this->push_event(ev);
+}
+
+/*
+ Queue a note-off for an instrument; its voices on the note start their
+ release
+   TAKES:
+     instrument --> Instrument * to release
+     note       --> note constant
+     frame      --> unsigned long engine frame to release on, as trigger()
+   RETURNS:
+     0 on success, 1 if the event queue is full
+*/
+int Daw::release(Instrument *instrument, const int note, unsigned long frame) {
+    Event ev;
+    ev.type = Event::EVENT_NOTE_OFF;
+    ev.instrument = instrument;
+    ev.value = note;
+    ev.frame = frame;
+    return this->push_event(ev);
+}
+
+/*
+ Send an instrument command.  Commands are handled on the calling
+ thread; instruments do any heavy work (like rebuilding wavetables) off
+ the audio thread and publish the result safely themselves.
+   TAKES:
+     instrument --> Instrument * to receive the command
+     command    --> command constant
+     data       --> const int * HIGHEST_HARMONIC values, or NULL
+   RETURNS:
+     0
+*/
+int Daw::command(Instrument *instrument, const int command, const int *data) {
+    instrument->command(command, (void*)data);
+    return 0;
+}
+
+/*
+ Move queued events into the schedule (audio thread, start of each
+ buffer).  Once the schedule is full the rest wait in the queue.
+*/
+void Daw::collect_events() {
+    Event ev;
+    while(!this->schedule->full() && this->events->pop(ev)) {
+        this->schedule->insert(ev);
+    }
+}
+
+/*
+ Render one buffer, applying each event on its frame: the mix is split
+ wherever an event falls inside the buffer (audio thread)
+   TAKES:
+     out    --> float * interleaved output buffer
+     frames --> number of frames to render
+*/
+void Daw::render(float *out, unsigned long frames) {
+    unsigned long start = this->clock.load(std::memory_order_relaxed);
+    unsigned long end = start + frames;
+    unsigned long pos = start, stop;
+    Event ev;
+    
+    this->collect_events();
+    while(pos < end) {
+        while(this->schedule->due(pos, ev)) {
+            switch(ev.type) {
+                case Event::EVENT_NOTE:
+                    ev.instrument->trigger(ev.value);
+                    break;
+                case Event::EVENT_NOTE_OFF:
+                    ev.instrument->release(ev.value);
+                    break;
+            }
+        }
+        if(!this->schedule->next(stop) || stop > end) stop = end;
+        this->mixer->mix(out + ((pos - start) * Daw::DEFAULT_NUM_CHANNELS),
+                         stop - pos, Daw::DEFAULT_NUM_CHANNELS);
+        pos = stop;
+    }
+    this->clock.store(end, std::memory_order_release);
+}
+
 /*
  Clean exit
 */
 void Daw::error() {
-    Pa_Terminate();
+    const char *msg = this->backend->error_text();
+    
+    this->backend->close();
+    if(this->controllers.size() == 0) {
+        std::cerr << "[Error] " << msg << "\n";
+    }
     for(int i = 0; i < this->controllers.size(); i++) {
-        this->controllers[i]->error(Pa_GetErrorText(this->err));
+        this->controllers[i]->error(msg);
     }
     exit(0);
 }
@@ -99,14 +324,9 @@ void Daw::error() {
 */
 void Daw::end() {
     // stream is stopped
-    this->err = Pa_StopStream(this->stream);
-    if(this->err != paNoError) this->error();
-    // stream is closed
-    this->err = Pa_CloseStream(this->stream);
-    if(this->err != paNoError) this->error();
-    // PortAudio library is terminated
-    this->err = Pa_Terminate();
-    if(this->err != paNoError) this->error();
+    if(this->backend->stop()) this->error();
+    // stream is closed, backend released
+    if(this->backend->close()) this->error();
     // farewell
     for(int i = 0; i < this->controllers.size(); i++) {
         this->controllers[i]->farewell();
@@ -114,26 +334,35 @@ void Daw::end() {
 }
 
 /*
- Run daw loop: get user commands, execute commands.
+ Run daw loop: every mapped controller attaches its inputs to one event
+ loop, which dispatches them as they become ready until a controller
+ stops it.
 */
 void Daw::run() {
     int i;
     Mapping *m;
-    bool loop = true;
+    EventLoop loop;
     
     this->mixer->fade_in();
     for(i = 0; i < this->controllers.size(); i++) {
         this->controllers[i]->salutation();
     }
-    // get input from all controllers, process
-    while(loop) {
-        for(i = 0; i < this->mappings.size(); i++) {
-            // call controller callback
-            m = this->mappings[i];
-            m->controller->input_loop(&loop, this, m->instrument);
-        }
+    // every controller registers its inputs with the one loop
+    for(i = 0; i < this->mappings.size(); i++) {
+        m = this->mappings[i];
+        m->controller->attach(&loop, this, m->instrument);
+    }
+    // whatever a round of handlers queues reaches the audio thread together
+    while(loop.is_running()) {
+        this->begin_batch();
+        if(loop.run_once() < 0) loop.stop();
+        this->end_batch();
+    }
+    for(i = 0; i < this->mappings.size(); i++) {
+        this->mappings[i]->controller->detach();
     }
     this->mixer->fade_out();
+    this->stop_recording();
     this->end();
     return;
 }
@@ -149,24 +378,23 @@ int Daw::callback(const void *inputBuffer, void *outputBuffer,
 {
     Daw *e = (Daw*)userData;
     float *out = (float*)outputBuffer;
-    int i, x; //for looping use...
+    std::chrono::steady_clock::time_point start, end;
+    float render_us, period_us;
     // casting the unused arguments as void to avoid 'unused' errors
-    (void) timeInfo;
-    (void) statusFlags;
     (void) inputBuffer;
     
-    // write each frame to the output buffer
-    for(i = 0; i<framesPerBuffer; i++)
-    {
-        // add each channel
-        for(x = 0; x < Daw::DEFAULT_NUM_CHANNELS; x++) {
-            *out++ = e->mixer->mix(x, e->instruments);
-        }
-        // Advance system
-        e->mixer->advance();
-        for(x = 0; x < e->instruments.size(); x++) {
-            e->instruments[x]->advance();
-        }
+    flush_denormals();
+    start = std::chrono::steady_clock::now();
+    if(timeInfo != NULL) {
+        e->stats->set_latency((timeInfo->outputBufferDacTime -
+                               timeInfo->currentTime) * 1000.0);
     }
+    // render and mix the buffer, applying controller events on their frames
+    e->render(out, framesPerBuffer);
+    // load and xrun accounting
+    end = std::chrono::steady_clock::now();
+    render_us = std::chrono::duration<float, std::micro>(end - start).count();
+    period_us = (1000000.0 * framesPerBuffer) / Daw::DEFAULT_SAMPLE_RATE;
+    e->stats->record(render_us, period_us, statusFlags, e->mixer->active_voices());
     return paContinue;
 }
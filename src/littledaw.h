@@ -14,8 +14,14 @@
 #include "envelope.h"
 #include "controller.h"
 #include "instrument.h"
+#include "sampler.h"
+#include "audiobackend.h"
+#include "eventqueue.h"
+#include "dspstats.h"
+#include "eventloop.h"
 #include "portaudio.h"
 #include <vector>
+#include <atomic>
 
 struct Mapping;
 
@@ -24,14 +30,23 @@ public:
     static const int DEFAULT_SAMPLE_RATE = 44100;
     static const int DEFAULT_NUM_CHANNELS = 2;
     static const int DEFAULT_FRAMES_PER_BUFFER = 192;
+    static const unsigned EVENT_QUEUE_SIZE = 1024;
 };
 
 class Daw : public DawConstants {
 protected:
-    // portaudio objects
-    PaStreamParameters *outputParameters; //struct for stream parameters
-    PaStream *stream;
-    PaError err;
+    // audio output
+    AudioBackend *backend;
+    bool owns_backend;
+    // controller -> audio thread events
+    EventQueue<Event, Daw::EVENT_QUEUE_SIZE> *events;
+    EventSchedule<Daw::EVENT_QUEUE_SIZE> *schedule; // audio thread only
+    bool batching; // events are staged until end_batch()
+    std::atomic<unsigned long> clock; // frame at the start of the next buffer
+    int push_event(const Event&);
+    void collect_events();
+    void render(float*, unsigned long);
+    std::vector<int> recorder_tracks; // per recorder; -1 is the master
     // housekeeping
     void error();
     void end();
@@ -41,13 +56,26 @@ public:
     std::vector<Controller*> controllers;
     std::vector<Instrument*> instruments;
     Mixer *mixer;
+    DspStats *stats;
+    std::vector<Recorder*> recorders; // takes in progress
     // ----- USER METHODS -----
-    Daw();
+    Daw(AudioBackend *backend=NULL);
     ~Daw();
     void add_instrument(Instrument*);
     void add_controller(Controller*);
     void map_controller(Controller*, Instrument*);
+    void set_workers(int);
+    int record(const char*, Instrument *instrument=NULL);
+    void stop_recording();
+    bool recording();
     void run();
+    // ----- EVENT METHODS (controller thread) -----
+    unsigned long frame_time();
+    int trigger(Instrument*, const int, unsigned long frame=0);
+    int release(Instrument*, const int, unsigned long frame=0);
+    int command(Instrument*, const int, const int *data=NULL);
+    void begin_batch();
+    void end_batch();
     // ----- PORTAUDIO CALLBACK METHODS -----
     static int callback(const void*,
                         void*,
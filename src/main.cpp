@@ -6,21 +6,276 @@
 //  Copyright © 2017 Zach Snyder. All rights reserved.
 //
 #include "littledaw.h"
+#include <string.h>
+
+/*
+ Pumps the session script or MIDI file from the offline backend: every
+ command starting inside the next buffer is queued on its frame.  Timbre
+ changes are waited for, so they land on that buffer and renders stay
+ reproducible; live playback never waits.
+*/
+struct ScriptSession {
+    ScriptController *script;
+    SequencerController *sequencer;
+    Daw *daw;
+};
+
+static void play_script(unsigned long frame, unsigned long frames, void *data) {
+    ScriptSession *s = (ScriptSession*)data;
+    if(s->script != NULL) s->script->play(frame + frames, s->daw, s->daw->instruments);
+    if(s->sequencer != NULL) s->sequencer->play(frame + frames, s->daw, s->daw->instruments);
+    for(size_t i = 0; i < s->daw->instruments.size(); i++) {
+        s->daw->instruments[i]->sync();
+    }
+}
+
+/*
+ True if a path names a Standard MIDI File
+*/
+static bool is_midi(const char *path) {
+    size_t len = strlen(path);
+    return len > 4 && (strcmp(path + len - 4, ".mid") == 0 ||
+                       strcmp(path + len - 4, ".MID") == 0);
+}
+
+/*
+ The live or offline instrument: a sampler playing the library in a
+ sample map, or the wavetable synth when there is none
+   TAKES:
+     samples --> const char * sample map, or NULL
+     offline --> bool true if rendering offline, faster than realtime
+   RETURNS:
+     Instrument *, or NULL if the library could not be loaded
+*/
+static Instrument *make_instrument(const char *samples, bool offline) {
+    Sampler *sampler;
+    
+    if(samples == NULL) return new WaveTableSynth();
+    sampler = new Sampler();
+    if(sampler->load(samples)) {
+        std::cerr << "[Error] could not load the sample map " << samples << "\n";
+        delete sampler;
+        return NULL;
+    }
+    sampler->set_offline(offline);
+    return sampler;
+}
+
+/*
+ The effects asked for on the command line: a send/return delay bus fed
+ from every track, and a low-pass on the master.  The effects are
+ returned so they can be deleted after the daw.
+   TAKES:
+     daw        --> Daw * whose tracks are all in place
+     delay_ms   --> float delay time, 0 for no delay bus
+     lowpass_hz --> float master cutoff, 0 for no filter
+     effects    --> std::vector<Effect*> * to append the effects to
+*/
+static void add_effects(Daw *daw, float delay_ms, float lowpass_hz,
+                        std::vector<Effect*> *effects) {
+    Effect *effect;
+    int bus, track;
+    
+    if(delay_ms > 0.0) {
+        effect = new DelayEffect(delay_ms, 0.35, DelayEffect::DEFAULT_MAX_DELAY_MS,
+                                 Daw::DEFAULT_SAMPLE_RATE);
+        effects->push_back(effect);
+        bus = daw->mixer->add_bus(0.5);
+        daw->mixer->add_insert(DspGraph::bus_node(bus), effect);
+        for(size_t i = 0; i < daw->instruments.size(); i++) {
+            track = daw->mixer->find_track(daw->instruments[i]);
+            if(track >= 0) daw->mixer->set_send(track, bus, 1.0);
+        }
+    }
+    if(lowpass_hz > 0.0) {
+        effect = new FilterEffect(FilterEffect::FILTER_LOWPASS, lowpass_hz,
+                                  FilterEffect::DEFAULT_Q, Daw::DEFAULT_SAMPLE_RATE);
+        effects->push_back(effect);
+        daw->mixer->add_insert(DspGraph::MASTER, effect);
+    }
+}
+
+/*
+ Offline render mode:
+     littledaw [--workers N] [--synths N] [--samples MAP] [--delay MS] [--lowpass HZ]
+               --render SECONDS OUTFILE [SCRIPT]
+ Renders SECONDS of the (optionally scripted) session as fast as possible
+ into OUTFILE (float32 WAV, or raw float32 if it ends in ".raw") and
+ reports the realtime factor.  The script plays every synth; a SCRIPT
+ ending in ".mid" is a MIDI file whose parts are spread over the synths.
+ With a sample map the synths are samplers playing its library.
+*/
+static int render(int argc, char *argv[], int workers, int synths, const char *samples,
+                  float delay_ms, float lowpass_hz) {
+    double seconds;
+    const char *path;
+    size_t len;
+    int format = OfflineBackend::FORMAT_WAV;
+    int err, i;
+    Instrument *instrument;
+    std::vector<Effect*> effects;
+    
+    if(argc < 4) {
+        std::cerr << "usage: littledaw [--workers N] [--synths N] [--samples MAP] "
+                  << "[--delay MS] [--lowpass HZ] --render SECONDS OUTFILE [SCRIPT]\n";
+        return 1;
+    }
+    seconds = atof(argv[2]);
+    path = argv[3];
+    len = strlen(path);
+    if(len > 4 && strcmp(path + len - 4, ".raw") == 0) {
+        format = OfflineBackend::FORMAT_RAW;
+    }
+    OfflineBackend *backend = new OfflineBackend(path, format);
+    Daw *daw = new Daw(backend);
+    ScriptController *script = new ScriptController();
+    SequencerController *sequencer = new SequencerController();
+    ScriptSession session = {NULL, NULL, daw};
+    
+    daw->add_controller(script);
+    for(i = 0; i < synths; i++) {
+        instrument = make_instrument(samples, true);
+        if(instrument == NULL) return 1;
+        daw->add_instrument(instrument);
+    }
+    add_effects(daw, delay_ms, lowpass_hz, &effects);
+    daw->set_workers(workers);
+    if(argc > 4 && is_midi(argv[4])) {
+        if(sequencer->load(argv[4], Daw::DEFAULT_SAMPLE_RATE)) {
+            sequencer->error("could not read MIDI file");
+            return 1;
+        }
+        session.sequencer = sequencer;
+        backend->set_hook(play_script, &session);
+    } else if(argc > 4) {
+        if(script->load(argv[4], Daw::DEFAULT_SAMPLE_RATE)) {
+            script->error("could not read script");
+            return 1;
+        }
+        session.script = script;
+        backend->set_hook(play_script, &session);
+    }
+    daw->mixer->fade_in(false);
+    err = backend->render(seconds);
+    if(err) {
+        script->error(backend->error_text());
+    } else {
+        printf("[Info] rendered %.2f s in %.3f s, realtime factor %.1fx\n",
+               seconds, seconds / backend->realtime_factor(),
+               backend->realtime_factor());
+    }
+    
+    std::vector<Instrument*> instruments = daw->instruments;
+    delete daw;
+    delete backend;
+    for(i = 0; i < instruments.size(); i++) {
+        delete instruments[i];
+    }
+    for(size_t k = 0; k < effects.size(); k++) {
+        delete effects[k];
+    }
+    delete script;
+    delete sequencer;
+    
+    return err;
+}
 
 int main(int argc, char *argv[]) {
+    int workers = 0;
+    int synths = 1;
+    const char *script_path = NULL;
+    const char *midi_path = NULL;
+    int osc_port = 0;
+    const char *record_path = NULL;
+    const char *samples = NULL;
+    float delay_ms = 0.0;
+    float lowpass_hz = 0.0;
+    std::vector<Effect*> effects;
+    
+    // options
+    while(argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+        if(strcmp(argv[1], "--workers") == 0) {
+            workers = atoi(argv[2]);
+        } else if(strcmp(argv[1], "--synths") == 0) {
+            synths = atoi(argv[2]);
+        } else if(strcmp(argv[1], "--script") == 0) {
+            script_path = argv[2];
+        } else if(strcmp(argv[1], "--midi") == 0) {
+            midi_path = argv[2];
+        } else if(strcmp(argv[1], "--osc") == 0) {
+            osc_port = atoi(argv[2]);
+        } else if(strcmp(argv[1], "--record") == 0) {
+            record_path = argv[2];
+        } else if(strcmp(argv[1], "--samples") == 0) {
+            samples = argv[2];
+        } else if(strcmp(argv[1], "--delay") == 0) {
+            delay_ms = atof(argv[2]);
+        } else if(strcmp(argv[1], "--lowpass") == 0) {
+            lowpass_hz = atof(argv[2]);
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if(argc > 1 && strcmp(argv[1], "--render") == 0) {
+        return render(argc, argv, workers, synths, samples, delay_ms, lowpass_hz);
+    }
+    Instrument *synth = make_instrument(samples, false);
+    if(synth == NULL) return 1;
     Daw *daw = new Daw();
     ShellController *shell = new ShellController();
-    WaveTableSynth *synth = new WaveTableSynth();
+    ScriptController *script = NULL;
+    SequencerController *sequencer = NULL;
+    OscController *osc = NULL;
     
     daw->add_instrument(synth);
     daw->add_controller(shell);
     daw->map_controller(shell, synth);
+    // a live script plays alongside the keyboard
+    if(script_path != NULL) {
+        script = new ScriptController();
+        if(script->load(script_path, Daw::DEFAULT_SAMPLE_RATE)) {
+            script->error("could not read script");
+        } else {
+            daw->add_controller(script);
+            daw->map_controller(script, synth);
+        }
+    }
+    // so can a MIDI file, every part on the one synth
+    if(midi_path != NULL) {
+        sequencer = new SequencerController();
+        if(sequencer->load(midi_path, Daw::DEFAULT_SAMPLE_RATE)) {
+            sequencer->error("could not read MIDI file");
+        } else {
+            daw->add_controller(sequencer);
+            daw->map_controller(sequencer, synth);
+        }
+    }
+    // and other processes, over OSC
+    if(osc_port > 0) {
+        osc = new OscController(osc_port);
+        daw->add_controller(osc);
+        daw->map_controller(osc, synth);
+    }
+    add_effects(daw, delay_ms, lowpass_hz, &effects);
+    daw->set_workers(workers);
+    // record the whole session
+    if(record_path != NULL && daw->record(record_path)) {
+        shell->error("could not start recording");
+    }
     daw->run(); // go
 
 
     delete daw;
     delete synth;
     delete shell;
+    delete script;
+    delete sequencer;
+    delete osc;
+    for(size_t i = 0; i < effects.size(); i++) {
+        delete effects[i];
+    }
     
     return 0;
 }
@@ -0,0 +1,246 @@
+//
+//  midifile.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "midifile.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+/*
+ Big-endian field readers for the chunk headers
+*/
+static unsigned long get_u32(const unsigned char *p) {
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+           ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+static unsigned get_u16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+/*
+ Read a variable-length quantity
+   RETURNS:
+     0 on success, 1 if it runs past end
+*/
+static int get_vlq(const unsigned char **p, const unsigned char *end,
+                   unsigned long *value) {
+    unsigned long v = 0;
+    for(int i = 0; i < 4; i++) {
+        if(*p >= end) return 1;
+        v = (v << 7) | (**p & 0x7f);
+        if((*(*p)++ & 0x80) == 0) {
+            *value = v;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ MidiFile default constructor
+*/
+MidiFile::MidiFile() {
+    this->num_parts = 0;
+}
+
+/*
+ Load a .mid file
+   TAKES:
+     path        --> const char * file to read
+     sample_rate --> int used to convert times to frames
+   RETURNS:
+     0 on success, 1 if the file could not be read or is not a
+     format 0 or 1 MIDI file
+*/
+int MidiFile::load(const char *path, int sample_rate) {
+    FILE *f = fopen(path, "rb");
+    std::vector<unsigned char> data;
+    unsigned char buf[4096];
+    size_t n;
+    
+    if(f == NULL) return 1;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    if(data.empty()) return 1;
+    return this->parse(&data[0], data.size(), sample_rate);
+}
+
+/*
+ Parse a MIDI file held in memory
+   TAKES:
+     data        --> const unsigned char * file contents
+     size        --> unsigned long bytes in data
+     sample_rate --> int used to convert times to frames
+   RETURNS:
+     0 on success, 1 if the data is not a format 0 or 1 MIDI file
+*/
+int MidiFile::parse(const unsigned char *data, unsigned long size, int sample_rate) {
+    std::vector<RawNote> raw;
+    std::vector<TempoChange> tempos;
+    std::vector<int> part_map;
+    unsigned long pos, len, tick, last_tick;
+    unsigned format, tracks, division;
+    int track, t, us_per_quarter;
+    double seconds, seconds_per_tick;
+    Note n;
+    
+    this->notes.clear();
+    this->num_parts = 0;
+    if(size < 14 || memcmp(data, "MThd", 4) != 0) return 1;
+    len = get_u32(data + 4);
+    if(len < 6 || 8 + len > size) return 1;
+    format = get_u16(data + 8);
+    tracks = get_u16(data + 10);
+    division = get_u16(data + 12);
+    if(format > 1 || division == 0) return 1;
+    // each track (format 1) or channel (format 0) may become a part
+    part_map.assign((format == 0) ? 16 : tracks, -1);
+    pos = 8 + len;
+    for(track = 0; track < (int)tracks && pos + 8 <= size; pos += 8 + len) {
+        len = get_u32(data + pos + 4);
+        if(pos + 8 + len > size) return 1;
+        if(memcmp(data + pos, "MTrk", 4) != 0) continue; // unknown chunk
+        if(this->read_track(data + pos + 8, len, track, format, raw, tempos, part_map)) {
+            return 1;
+        }
+        track++;
+    }
+    std::stable_sort(raw.begin(), raw.end(), [](const RawNote &a, const RawNote &b) {
+        return (a.tick != b.tick) ? a.tick < b.tick : a.order < b.order;
+    });
+    std::stable_sort(tempos.begin(), tempos.end(),
+                     [](const TempoChange &a, const TempoChange &b) {
+        return a.tick < b.tick;
+    });
+    // walk the notes through the tempo map
+    us_per_quarter = MidiFile::DEFAULT_TEMPO;
+    seconds = 0.0;
+    last_tick = 0;
+    t = 0;
+    for(size_t i = 0; i < raw.size(); i++) {
+        tick = raw[i].tick;
+        while(true) {
+            unsigned long step = tick;
+            bool change = (t < (int)tempos.size() && tempos[t].tick <= tick);
+            if(change) step = tempos[t].tick;
+            if(division & 0x8000) {
+                // SMPTE: frames per second and ticks per frame, no tempo
+                seconds_per_tick = 1.0 / ((double)(256 - (division >> 8)) *
+                                          (double)(division & 0xff));
+            } else {
+                seconds_per_tick = us_per_quarter / (1000000.0 * division);
+            }
+            seconds += (step - last_tick) * seconds_per_tick;
+            last_tick = step;
+            if(!change) break;
+            us_per_quarter = tempos[t++].us_per_quarter;
+        }
+        n.frame = (unsigned long)(seconds * sample_rate + 0.5);
+        n.part = raw[i].part;
+        n.note = raw[i].note;
+        n.on = raw[i].on;
+        this->notes.push_back(n);
+    }
+    return 0;
+}
+
+/*
+ Collect the notes and tempo changes of one track chunk
+   TAKES:
+     data     --> const unsigned char * track events
+     len      --> unsigned long bytes in data
+     track    --> int track index
+     format   --> unsigned file format, 0 or 1
+     raw      --> notes found, appended
+     tempos   --> tempo changes found, appended
+     part_map --> part of each track or channel, -1 until it plays
+   RETURNS:
+     0 on success, 1 if the track is malformed
+*/
+int MidiFile::read_track(const unsigned char *data, unsigned long len, int track,
+                         int format, std::vector<RawNote> &raw,
+                         std::vector<TempoChange> &tempos, std::vector<int> &part_map) {
+    const unsigned char *p = data, *end = data + len;
+    unsigned long tick = 0, delta, length;
+    int status = 0, type, key;
+    unsigned char d1, d2;
+    RawNote rn;
+    TempoChange tc;
+    
+    while(p < end) {
+        if(get_vlq(&p, end, &delta) || p >= end) return 1;
+        tick += delta;
+        if(*p & 0x80) {
+            status = *p++;
+        } else if(status == 0) {
+            return 1; // running status with nothing to run
+        }
+        if(status == 0xff) {
+            // meta event
+            if(p >= end) return 1;
+            type = *p++;
+            if(get_vlq(&p, end, &length) || length > (unsigned long)(end - p)) return 1;
+            if(type == 0x51 && length == 3) {
+                tc.tick = tick;
+                tc.us_per_quarter = (p[0] << 16) | (p[1] << 8) | p[2];
+                if(tc.us_per_quarter > 0) tempos.push_back(tc);
+            }
+            p += length;
+            status = 0; // meta events cancel running status
+            if(type == 0x2f) break; // end of track
+            continue;
+        }
+        if(status == 0xf0 || status == 0xf7) {
+            // sysex, skipped
+            if(get_vlq(&p, end, &length) || length > (unsigned long)(end - p)) return 1;
+            p += length;
+            status = 0;
+            continue;
+        }
+        type = status & 0xf0;
+        if(type == 0xc0 || type == 0xd0) {
+            if(p >= end) return 1;
+            p++; // program change, channel pressure: ignored
+            continue;
+        }
+        if(end - p < 2) return 1;
+        d1 = *p++ & 0x7f;
+        d2 = *p++ & 0x7f;
+        if(type != 0x80 && type != 0x90) continue; // other channel messages
+        if(d1 < MidiFile::NOTE_OFFSET) continue; // below the lowest note
+        key = (format == 0) ? (status & 0x0f) : track;
+        if(part_map[key] < 0) {
+            if(type == 0x80 || d2 == 0) continue; // part has not started
+            part_map[key] = this->num_parts++;
+        }
+        rn.tick = tick;
+        rn.order = (int)raw.size();
+        rn.part = part_map[key];
+        rn.note = d1 - MidiFile::NOTE_OFFSET;
+        rn.on = (type == 0x90 && d2 > 0); // velocity 0 is a note-off
+        raw.push_back(rn);
+    }
+    return 0;
+}
+
+/*
+ Notes in time order
+*/
+const std::vector<MidiFile::Note> &MidiFile::events() {
+    return this->notes;
+}
+
+/*
+ Number of tracks (or channels) that play notes
+*/
+int MidiFile::parts() {
+    return this->num_parts;
+}
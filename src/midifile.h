@@ -0,0 +1,63 @@
+//
+//  midifile.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef midifile_h
+#define midifile_h
+
+#include <vector>
+
+class MidiFileConstants {
+public:
+    static const int DEFAULT_TEMPO = 500000; // us per quarter note, 120 bpm
+    static const int NOTE_OFFSET = 21; // MIDI note - NOTE_OFFSET = note constant
+                                       // (MIDI 69 = A4 = 440 Hz)
+};
+
+/*
+ Class MidiFile:
+   Reads a Standard MIDI File (format 0 or 1) into a flat list of note
+   on/off events, in time order, with times converted to frames through
+   the file's tempo map.  Each note belongs to a part: its track in a
+   format 1 file, its channel in a format 0 file.  Parts are numbered in
+   the order they first play a note.
+*/
+class MidiFile : public MidiFileConstants {
+public:
+    struct Note {
+        unsigned long frame;
+        int part;
+        int note; // Instrument note constant
+        bool on;
+    };
+private:
+    struct RawNote {
+        unsigned long tick;
+        int order; // position in the file, keeps simultaneous events stable
+        int part;
+        int note;
+        bool on;
+    };
+    struct TempoChange {
+        unsigned long tick;
+        int us_per_quarter;
+    };
+    std::vector<Note> notes;
+    int num_parts;
+    // helper method(s)
+    int read_track(const unsigned char*, unsigned long, int, int,
+                   std::vector<RawNote>&, std::vector<TempoChange>&,
+                   std::vector<int>&);
+public:
+    MidiFile();
+    int load(const char*, int);
+    int parse(const unsigned char*, unsigned long, int);
+    const std::vector<Note> &events();
+    int parts();
+};
+
+#endif /* midifile_h */
@@ -7,75 +7,539 @@
 //
 
 #include "mixer.h"
+#include <math.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+static_assert(Mixer::MAX_TRACKS == DspGraph::MAX_TRACKS &&
+              Mixer::MAX_BLOCK_SAMPLES == DspGraph::BLOCK_SAMPLES,
+              "the DSP graph is sized for the mixer");
+
+/*
+ Track constructor: strip starts free, at unity gain, centered
+*/
+Track::Track() : instrument(NULL), recorder(NULL), gain(1.0), pan(0.0), mute(1.0) {
+    this->buffer = new float[Track::MAX_BLOCK_SAMPLES];
+}
+
+/*
+ Track destructor
+*/
+Track::~Track() {
+    delete [] this->buffer;
+}
 
 /*
- Mixer default constructor
+ Mixer constructor
+   TAKES:
+     sample_rate --> int sample rate in Hz
 */
-Mixer::Mixer() {
-    this->master = 0.0;
-    this->fadein = false;
-    this->fadeout = false;
+Mixer::Mixer(int sample_rate) : master(0.0, sample_rate), passes(0), running(false),
+                                pool(NULL), recorder(NULL) {
+    this->active_count = 0;
+    this->active_schedule = NULL;
+    this->rendering_count = 0;
+    this->chunk_frames = 0;
+    this->chunk_channels = 0;
+    this->schedule.publish(this->graph.compile()); // every track to the master
 }
 
 /*
  Fade in signal amplitude
+   TAKES:
+     wait --> block until the fade is complete
 */
-void Mixer::fade_in() {
-    if(this->fadeout) this->fadeout = false;
-    this->fadein = true;
-    this->wait_for_fade();
+void Mixer::fade_in(bool wait) {
+    this->master.set(this->MIXER_MAX, Mixer::FADE_SAMPLES);
+    if(wait) this->wait_for_fade();
 }
 
 /*
  Fade out signal amplitude
+   TAKES:
+     wait --> block until the fade is complete
 */
-void Mixer::fade_out() {
-    if(this->fadein) this->fadein = false;
-    this->fadeout = true;
-    this->wait_for_fade();
+void Mixer::fade_out(bool wait) {
+    this->master.set(this->MIXER_MIN, Mixer::FADE_SAMPLES);
+    if(wait) this->wait_for_fade();
 }
 
 /*
- Waits for fade
+ Waits for fade.  Sleeps; the audio thread is not involved.
 */
 void Mixer::wait_for_fade() {
-    while(this->fadein || this->fadeout) {}
+    this->master.wait();
 }
 
 /*
- Mix all tracks on specified channel
+ Put an instrument on a free channel strip
    TAKES:
-     chann --> int channel to mix
-     table --> ptr WaveTable object
-     tracks --> array of Track objects
+     instrument --> Instrument * to mix
    RETURNS:
-     float mixed track signals
+     track index, or -1 if every strip is in use
 */
-float Mixer::mix(int chann, std::vector<Instrument*> instruments) {
-    float out = 0;
-    int i;
-    
-    // for each infinite synth
-    for(i = 0; i < instruments.size(); i++) {
-        out += instruments[i]->output(chann);
+int Mixer::add_track(Instrument *instrument) {
+    Track *t;
+    for(int i = 0; i < Mixer::MAX_TRACKS; i++) {
+        t = &(this->tracks[i]);
+        if(t->instrument.load(std::memory_order_acquire) == NULL) {
+            t->gain.set(1.0, 0);
+            t->pan.set(0.0, 0);
+            t->mute.set(1.0, 0);
+            t->instrument.store(instrument, std::memory_order_release);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ Free a channel strip.  Returns once the audio thread has finished any
+ mix pass that could still be rendering the instrument (at once if audio
+ is not running), so the instrument may then be deleted.
+   TAKES:
+     track --> int track index
+*/
+void Mixer::remove_track(int track) {
+    if(track < 0 || track >= Mixer::MAX_TRACKS) return;
+    this->tracks[track].instrument.store(NULL, std::memory_order_seq_cst);
+    this->wait_for_pass();
+}
+
+/*
+ Find the channel strip an instrument plays on
+   RETURNS:
+     track index, or -1 if the instrument is not on the bus
+*/
+int Mixer::find_track(Instrument *instrument) {
+    for(int i = 0; i < Mixer::MAX_TRACKS; i++) {
+        if(this->tracks[i].instrument.load(std::memory_order_acquire) == instrument) {
+            return i;
+        }
     }
-    return (out * this->master);
+    return -1;
+}
+
+/*
+ Hand the mixer a worker pool for parallel track rendering (control
+ thread).  Rendering falls back to serial when fewer than two tracks
+ are active.
+   TAKES:
+     pool --> WorkerPool *, or NULL to always render serially
+   RETURNS:
+     the previous pool, no longer in use by the audio thread
+*/
+WorkerPool *Mixer::set_pool(WorkerPool *pool) {
+    WorkerPool *old = this->pool.exchange(pool, std::memory_order_seq_cst);
+    this->wait_for_pass();
+    return old;
 }
 
 /*
- Handle fading.
+ Record the mixed output (control thread).  The recorder must be open
+ for the layout mix() is called with.
+   TAKES:
+     recorder --> Recorder *, or NULL to stop recording
+   RETURNS:
+     the previous recorder, no longer in use by the audio thread, so it
+     may be closed
 */
-void Mixer::advance() {
-    int i;
+Recorder *Mixer::set_recorder(Recorder *recorder) {
+    Recorder *old = this->recorder.exchange(recorder, std::memory_order_seq_cst);
+    this->wait_for_pass();
+    return old;
+}
 
-    if(this->fadein && (this->master < this->MIXER_MAX)) {
-        this->master += this->FADE_INCREMENT;
+/*
+ Record one track's pre-fader signal (control thread); silent passes are
+ recorded as silence, so stems stay aligned with the master
+   TAKES:
+     track    --> int track index
+     recorder --> Recorder *, or NULL to stop recording
+   RETURNS:
+     the previous recorder, no longer in use by the audio thread
+*/
+Recorder *Mixer::set_track_recorder(int track, Recorder *recorder) {
+    Recorder *old;
+    if(track < 0 || track >= Mixer::MAX_TRACKS) return NULL;
+    old = this->tracks[track].recorder.exchange(recorder, std::memory_order_seq_cst);
+    this->wait_for_pass();
+    return old;
+}
+
+/*
+ Compile the graph and hand the schedule to the audio thread.  Returns
+ once no mix pass can still be running the previous one, so effects
+ taken out of the graph are no longer in use: after two full passes
+ while audio is running, at once while it is stopped.  Caller holds
+ graph_mutex.
+   RETURNS:
+     0 on success, 1 if the graph could not be compiled
+*/
+int Mixer::rebuild() {
+    DspSchedule *next = this->graph.compile();
+    
+    if(next == NULL) return 1;
+    this->schedule.publish(next);
+    this->wait_for_pass();
+    if(this->running.load(std::memory_order_seq_cst)) {
+        this->schedule.reclaim(); // two passes since the swap
     } else {
-        this->fadein = false;
+        this->schedule.reclaim_all(); // no reader
+    }
+    return 0;
+}
+
+/*
+ Open a send/return bus
+   TAKES:
+     return_level --> float gain of the bus into the master
+   RETURNS:
+     bus index, or -1 if every bus is in use
+*/
+int Mixer::add_bus(float return_level) {
+    std::lock_guard<std::mutex> lock(this->graph_mutex);
+    int bus = this->graph.add_bus(return_level);
+    
+    if(bus >= 0) this->rebuild();
+    return bus;
+}
+
+/*
+ Close a bus, dropping its sends.  Its effects may be deleted once this
+ returns.
+   RETURNS:
+     0 on success, 1 if the bus was not open
+*/
+int Mixer::remove_bus(int bus) {
+    std::lock_guard<std::mutex> lock(this->graph_mutex);
+    if(this->graph.remove_bus(bus) != 0) return 1;
+    return this->rebuild();
+}
+
+/*
+ Put an effect on an insert chain.  The effect stays owned by the caller
+ and must outlive its place in the graph.
+   TAKES:
+     node     --> int track index, DspGraph::bus_node(bus) or DspGraph::MASTER
+     effect   --> Effect * to run
+     position --> int place in the chain, or -1 for the end
+   RETURNS:
+     0 on success, 1 if the node is not open or its chain is full
+*/
+int Mixer::add_insert(int node, Effect *effect, int position) {
+    std::lock_guard<std::mutex> lock(this->graph_mutex);
+    if(this->graph.add_insert(node, effect, position) != 0) return 1;
+    return this->rebuild();
+}
+
+/*
+ Take an effect off an insert chain; it may be deleted once this returns
+   RETURNS:
+     0 on success, 1 if it was not on the chain
+*/
+int Mixer::remove_insert(int node, Effect *effect) {
+    std::lock_guard<std::mutex> lock(this->graph_mutex);
+    if(this->graph.remove_insert(node, effect) != 0) return 1;
+    return this->rebuild();
+}
+
+/*
+ Send a track or bus into a bus, pre-fader and after its inserts
+   TAKES:
+     from  --> int track index or DspGraph::bus_node(bus)
+     bus   --> int bus index to feed
+     level --> float send gain, 0 to remove the send
+   RETURNS:
+     0 on success, 1 if a node is not open or the send would close a
+     loop between buses
+*/
+int Mixer::set_send(int from, int bus, float level) {
+    std::lock_guard<std::mutex> lock(this->graph_mutex);
+    if(this->graph.set_send(from, bus, level) != 0) return 1;
+    return this->rebuild();
+}
+
+/*
+ Set a bus's gain into the master
+   RETURNS:
+     0 on success, 1 if the bus is not open
+*/
+int Mixer::set_return(int bus, float level) {
+    std::lock_guard<std::mutex> lock(this->graph_mutex);
+    if(this->graph.set_return(bus, level) != 0) return 1;
+    return this->rebuild();
+}
+
+/*
+ Tell the mixer whether a backend is calling mix() from another thread.
+ Backends set it before their stream starts and clear it once the stream
+ has stopped; an offline render never sets it, since its passes run on
+ the thread that makes the edits.
+*/
+void Mixer::set_running(bool running) {
+    this->running.store(running, std::memory_order_seq_cst);
+}
+
+/*
+ Wait until any mix pass that started before the call has finished.
+ There is no timeout: a stalled callback is waited out, however long it
+ takes.  Returns at once when audio is not running, and as soon as the
+ stream stops.
+*/
+void Mixer::wait_for_pass() {
+    unsigned long start = this->passes.load(std::memory_order_seq_cst);
+    
+    while(this->running.load(std::memory_order_seq_cst) &&
+          this->passes.load(std::memory_order_seq_cst) < start + 2) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/*
+ Set track gain (linear, smoothed); NaN and infinity are ignored
+*/
+void Mixer::set_gain(int track, float gain) {
+    if(track < 0 || track >= Mixer::MAX_TRACKS || !isfinite(gain)) return;
+    this->tracks[track].gain.set(gain, Mixer::GAIN_SAMPLES);
+}
+
+/*
+ Set track pan, -1 (left) to 1 (right), constant power; NaN is ignored
+*/
+void Mixer::set_pan(int track, float pan) {
+    if(track < 0 || track >= Mixer::MAX_TRACKS || isnan(pan)) return;
+    if(pan < -1.0) pan = -1.0;
+    if(pan > 1.0) pan = 1.0;
+    this->tracks[track].pan.set(pan, Mixer::GAIN_SAMPLES);
+}
+
+/*
+ Mute or unmute a track (short ramp to avoid clicks)
+*/
+void Mixer::set_mute(int track, bool muted) {
+    if(track < 0 || track >= Mixer::MAX_TRACKS) return;
+    this->tracks[track].mute.set(muted ? 0.0 : 1.0, Mixer::MUTE_SAMPLES);
+}
+
+/*
+ Render every active track and run the compiled graph into an
+ interleaved block.  Tracks whose instrument reports silence are neither
+ rendered nor summed, so an idle session costs next to nothing and
+ leaves the workers parked; a silent track with inserts still runs them
+ on a zeroed buffer, so delay and filter tails ring out.
+   TAKES:
+     out      --> float * interleaved output buffer (frames * channels)
+     frames   --> number of frames to mix
+     channels --> number of interleaved channels
+*/
+void Mixer::mix(float *out, unsigned long frames, int channels) {
+    unsigned long chunk, n;
+    unsigned long max_frames = Mixer::MAX_BLOCK_SAMPLES / channels;
+    WorkerPool *workers = this->pool.load(std::memory_order_acquire);
+    Recorder *tap = this->recorder.load(std::memory_order_acquire);
+    DspSchedule *sched = this->schedule.read_lock(); // held for the whole pass
+    Instrument *inst;
+    int x, count = 0;
+    
+    // snapshot the active strips for this pass
+    for(x = 0; x < Mixer::MAX_TRACKS; x++) {
+        this->track_slot[x] = -1;
+        inst = this->tracks[x].instrument.load(std::memory_order_acquire);
+        if(inst == NULL) continue;
+        this->active[count] = &(this->tracks[x]);
+        this->active_instruments[count] = inst;
+        this->active_index[count] = x;
+        this->track_slot[x] = count;
+        count++;
+    }
+    this->active_count = count;
+    this->active_schedule = sched;
+    while(frames > 0) {
+        chunk = (frames < max_frames) ? frames : max_frames;
+        n = chunk * channels;
+        this->chunk_frames = chunk;
+        this->chunk_channels = channels;
+        this->rendering_count = 0;
+        for(x = 0; x < count; x++) {
+            this->quiet[x] = this->active_instruments[x]->silent();
+            this->sounding[x] = !this->quiet[x] || sched->has_inserts(this->active_index[x]);
+            if(this->sounding[x]) this->rendering[this->rendering_count++] = x;
+        }
+        // render every sounding track through its inserts...
+        if(workers != NULL && this->rendering_count > 1) {
+            workers->run(Mixer::render_task, this, this->rendering_count);
+        } else {
+            for(x = 0; x < this->rendering_count; x++) Mixer::render_task(x, this);
+        }
+        // ...then mix in schedule order, so the result never depends on
+        // which thread finished first
+        memset(out, 0, n * sizeof(float));
+        this->run(sched, out, chunk, channels);
+        // apply master gain (ramped per block)
+        this->master.apply(out, chunk, channels);
+        if(tap != NULL) tap->write(out, chunk);
+        out += n;
+        frames -= chunk;
     }
-    if(this->fadeout && (this->master > this->MIXER_MIN)) {
-        this->master -= this->FADE_INCREMENT;
+    this->schedule.read_unlock();
+    this->passes.fetch_add(1, std::memory_order_seq_cst);
+}
+
+/*
+ Resolve a schedule buffer for the current chunk
+   TAKES:
+     sched  --> DspSchedule * being run
+     buffer --> int scratch number, BUFFER_OUT or BUFFER_TRACK
+     track  --> int strip the op reads
+     out    --> float * the mix being built
+*/
+float *Mixer::buffer(DspSchedule *sched, int buffer, int track, float *out) {
+    if(buffer == DspGraph::BUFFER_OUT) return out;
+    if(buffer == DspGraph::BUFFER_TRACK) return this->tracks[track].buffer;
+    return sched->scratch(buffer);
+}
+
+/*
+ Run the mix section of the schedule: sends, track faders, bus inserts
+ and returns, then the master's inserts (audio thread)
+*/
+void Mixer::run(DspSchedule *sched, float *out, unsigned long frames, int channels) {
+    const unsigned long n = frames * channels;
+    Recorder *stem;
+    DspOp *op;
+    float *src, *dst;
+    unsigned long i;
+    int x;
+    
+    for(size_t k = sched->mix_begin; k < sched->ops.size(); k++) {
+        op = &(sched->ops[k]);
+        x = (op->track >= 0) ? this->track_slot[op->track] : 0;
+        if(x < 0) continue; // strip is free
+        switch(op->type) {
+            case DspGraph::OP_TRACK:
+                stem = this->active[x]->recorder.load(std::memory_order_acquire);
+                if(this->sounding[x]) {
+                    if(stem != NULL) stem->write(this->active[x]->buffer, frames);
+                    this->sum(this->active[x], out, frames, channels);
+                } else {
+                    if(stem != NULL) stem->write_silence(frames);
+                    this->skip(this->active[x], frames);
+                }
+                break;
+            case DspGraph::OP_SEND:
+                if(op->track >= 0 && !this->sounding[x]) break;
+                src = this->buffer(sched, op->src, op->track, out);
+                dst = this->buffer(sched, op->dst, op->track, out);
+                for(i = 0; i < n; i++) dst[i] += src[i] * op->level;
+                break;
+            case DspGraph::OP_CLEAR:
+                memset(this->buffer(sched, op->dst, op->track, out), 0, n * sizeof(float));
+                break;
+            case DspGraph::OP_INSERT:
+                op->effect->process(this->buffer(sched, op->dst, op->track, out),
+                                    frames, channels);
+                break;
+        }
+    }
+}
+
+/*
+ Voices sounding on the tracks of the last mix pass (audio thread)
+*/
+int Mixer::active_voices() {
+    int n = 0;
+    for(int x = 0; x < this->active_count; x++) {
+        n += this->active_instruments[x]->active_voices();
+    }
+    return n;
+}
+
+/*
+ Render one sounding track of the current chunk and run its inserts
+ (any thread)
+   TAKES:
+     index --> int position in the rendering list
+     mixer --> Mixer * owning the list
+*/
+void Mixer::render_task(int index, void *mixer) {
+    Mixer *m = (Mixer*)mixer;
+    DspSchedule *sched = m->active_schedule;
+    int x = m->rendering[index];
+    int track = m->active_index[x];
+    float *buf = m->active[x]->buffer;
+    
+    if(m->quiet[x]) {
+        memset(buf, 0, m->chunk_frames * m->chunk_channels * sizeof(float));
     } else {
-        this->fadeout = false;
+        m->active_instruments[x]->render(buf, m->chunk_frames, m->chunk_channels);
+    }
+    for(int k = sched->track_begin[track]; k < sched->track_end[track]; k++) {
+        sched->ops[k].effect->process(buf, m->chunk_frames, m->chunk_channels);
+    }
+}
+
+/*
+ Keep a silent track's gain, pan and mute ramps moving in step with the
+ bus, without touching its buffer
+*/
+void Mixer::skip(Track *t, unsigned long frames) {
+    float start, step;
+    t->gain.next_block(frames, &start, &step);
+    t->pan.next_block(frames, &start, &step);
+    t->mute.next_block(frames, &start, &step);
+}
+
+/*
+ Add one track's rendered block into the bus with gain, pan and mute.
+ Gains are evaluated per block and ramped linearly across it.
+*/
+void Mixer::sum(Track *t, float *out, unsigned long frames, int channels) {
+    float * __restrict dst = out;
+    const float * __restrict src = t->buffer;
+    unsigned long i, n = frames * channels;
+    float g0, g1, gs, p0, ps, m0, ms;
+    float l0, l1, r0, r1, ls, rs;
+    int c;
+    
+    t->gain.next_block(frames, &g0, &gs);
+    t->pan.next_block(frames, &p0, &ps);
+    t->mute.next_block(frames, &m0, &ms);
+    if(m0 == 0.0 && ms == 0.0) return; // muted
+    // fold mute into gain: start and end of block
+    g1 = (g0 + (gs * frames)) * (m0 + (ms * frames));
+    g0 *= m0;
+    gs = (g1 - g0) / frames;
+    if(channels != 2) {
+        // no panning outside stereo
+        for(i = 0; i < frames; i++) {
+            for(c = 0; c < channels; c++) {
+                *dst++ += *src++ * g0;
+            }
+            g0 += gs;
+        }
+        return;
+    }
+    // constant power pan gains at both ends of the block (unity at center)
+    l0 = g0 * (float)M_SQRT2 * cosf((p0 + 1.0f) * (float)M_PI_4);
+    r0 = g0 * (float)M_SQRT2 * sinf((p0 + 1.0f) * (float)M_PI_4);
+    p0 += ps * frames;
+    l1 = g1 * (float)M_SQRT2 * cosf((p0 + 1.0f) * (float)M_PI_4);
+    r1 = g1 * (float)M_SQRT2 * sinf((p0 + 1.0f) * (float)M_PI_4);
+    if(gs == 0.0 && ps == 0.0) {
+        for(i = 0; i < n; i += 2) {
+            dst[i] += src[i] * l0;
+            dst[i + 1] += src[i + 1] * r0;
+        }
+        return;
+    }
+    ls = (l1 - l0) / frames;
+    rs = (r1 - r0) / frames;
+    for(i = 0; i < n; i += 2) {
+        dst[i] += src[i] * l0;
+        dst[i + 1] += src[i + 1] * r0;
+        l0 += ls;
+        r0 += rs;
     }
 }
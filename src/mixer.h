@@ -10,27 +10,102 @@
 #define mixer_h
 
 #include "instrument.h"
-#include <vector>
+#include "parameter.h"
+#include "workerpool.h"
+#include "recorder.h"
+#include "dspgraph.h"
+#include "rcu.h"
+#include <atomic>
+#include <mutex>
 
 class MixerConstants {
 public:
-    const float FADE_INCREMENT = 0.00003;
+    static const int FADE_SAMPLES = 33333; // ~0.75 s at 44.1 kHz
+    static const int GAIN_SAMPLES = 1024;  // track gain/pan smoothing
+    static const int MUTE_SAMPLES = 256;
     const float MIXER_MAX = 1.0;
     const float MIXER_MIN = 0.0;
+    static const int MAX_TRACKS = 16;
+    static const int MAX_BLOCK_SAMPLES = 2048; // frames * channels
+    constexpr static const float MAX_TRACK_GAIN = 4.0; // +12 dB
 };
 
-// Mixer base class
+/*
+ Class Track:
+   One channel strip on the mixer bus.  Owns a preallocated render buffer
+   and smoothed gain, pan and mute.  A strip is in use while instrument
+   is non-NULL.  A recorder, when set, takes the strip's pre-fader signal.
+*/
+class Track : public MixerConstants {
+public:
+    std::atomic<Instrument*> instrument;
+    std::atomic<Recorder*> recorder;
+    SmoothedParameter gain;
+    SmoothedParameter pan;  // -1 (left) .. 1 (right)
+    SmoothedParameter mute; // 1 = playing, 0 = muted
+    float *buffer;
+    Track();
+    ~Track();
+};
+
+// Mixer bus
 class Mixer : public MixerConstants {
-    float master;
-    bool fadein;
-    bool fadeout;
+    SmoothedParameter master;
+    Track tracks[MAX_TRACKS];
+    std::atomic<unsigned long> passes; // completed mix() calls
+    std::atomic<bool> running;         // a backend is calling mix()
+    std::atomic<WorkerPool*> pool;     // NULL = render serially
+    std::atomic<Recorder*> recorder;   // master tap, NULL = not recording
+    DspGraph graph;                    // control side, under graph_mutex
+    RcuPointer<DspSchedule> schedule;  // compiled graph, read by mix()
+    std::mutex graph_mutex;
+    // current chunk, shared with render tasks
+    Track *active[MAX_TRACKS];
+    Instrument *active_instruments[MAX_TRACKS];
+    int active_index[MAX_TRACKS]; // strip number per active track
+    int active_count;
+    DspSchedule *active_schedule;
+    int track_slot[MAX_TRACKS];  // active index per strip, -1 = free
+    bool sounding[MAX_TRACKS];   // per active track, for the current chunk
+    bool quiet[MAX_TRACKS];      // processed for its inserts' tails only
+    int rendering[MAX_TRACKS];   // active indices of the sounding tracks
+    int rendering_count;
+    unsigned long chunk_frames;
+    int chunk_channels;
+    // helper method(s)
+    static void render_task(int, void*);
+    void sum(Track*, float*, unsigned long, int);
+    void skip(Track*, unsigned long);
+    void wait_for_pass();
+    void run(DspSchedule*, float*, unsigned long, int);
+    float *buffer(DspSchedule*, int, int, float*);
+    int rebuild();
 public:
-    Mixer();
-    void fade_in();
-    void fade_out();
+    Mixer(int sample_rate=44100);
+    void fade_in(bool wait=true);
+    void fade_out(bool wait=true);
     void wait_for_fade();
-    float mix(int, std::vector<Instrument*>);
-    void advance();
+    void set_running(bool);
+    // channel strips (control thread)
+    int add_track(Instrument*);
+    void remove_track(int);
+    int find_track(Instrument*);
+    void set_gain(int, float);
+    void set_pan(int, float);
+    void set_mute(int, bool);
+    WorkerPool *set_pool(WorkerPool*);
+    Recorder *set_recorder(Recorder*);
+    Recorder *set_track_recorder(int, Recorder*);
+    // effects and buses (control thread)
+    int add_bus(float return_level=1.0);
+    int remove_bus(int);
+    int add_insert(int, Effect*, int position=-1);
+    int remove_insert(int, Effect*);
+    int set_send(int, int, float);
+    int set_return(int, float);
+    // audio thread
+    void mix(float*, unsigned long, int);
+    int active_voices();
 };
 
-#endif /* mixer_h */
\ No newline at end of file
+#endif /* mixer_h */
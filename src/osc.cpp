@@ -0,0 +1,192 @@
+//
+//  osc.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "osc.h"
+#include <string.h>
+
+/*
+ Big-endian readers; OSC data is 4-byte aligned within the packet, but
+ the packet itself may not be
+*/
+static uint32_t get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+/*
+ Length of an OSC string with its padding
+   RETURNS:
+     bytes up to the next 4-byte boundary after the terminator, or 0 if
+     the string is not terminated before end
+*/
+static unsigned long padded_string(const unsigned char *p, const unsigned char *end) {
+    const void *nul = memchr(p, 0, end - p);
+    unsigned long n;
+    
+    if(nul == NULL) return 0;
+    n = ((const unsigned char*)nul - p) + 1;
+    n = (n + 3) & ~3UL;
+    return (n <= (unsigned long)(end - p)) ? n : 0;
+}
+
+/*
+ Read every message in a packet
+   TAKES:
+     data    --> const unsigned char * packet, left untouched
+     size    --> unsigned long bytes in the packet
+     handler --> Handler called with each message
+     user    --> void * passed through to handler
+   RETURNS:
+     0 on success, 1 if the packet is malformed (messages before the
+     fault have already been handled)
+*/
+int OscReader::parse(const unsigned char *data, unsigned long size,
+                     Handler handler, void *user) {
+    return OscReader::parse_element(data, size, OscReader::IMMEDIATELY, 0,
+                                    handler, user);
+}
+
+int OscReader::parse_element(const unsigned char *data, unsigned long size,
+                             uint64_t time, int depth, Handler handler, void *user) {
+    const unsigned char *p = data, *end = data + size;
+    unsigned long n, len;
+    OscMessage msg;
+    
+    if(size < 4 || (size & 3) != 0) return 1;
+    if(size >= 16 && memcmp(data, "#bundle", 8) == 0) {
+        if(depth >= OscReader::MAX_DEPTH) return 1;
+        time = get_u64(data + 8);
+        p += 16;
+        while(p < end) {
+            if(end - p < 4) return 1;
+            len = get_u32(p);
+            p += 4;
+            if(len > (unsigned long)(end - p)) return 1;
+            if(OscReader::parse_element(p, len, time, depth + 1, handler, user)) return 1;
+            p += len;
+        }
+        return 0;
+    }
+    if(data[0] != '/') return 1;
+    n = padded_string(p, end);
+    if(n == 0) return 1;
+    msg.address = (const char*)p;
+    p += n;
+    if(p < end && *p == ',') {
+        n = padded_string(p, end);
+        if(n == 0) return 1;
+        msg.types = (const char*)p + 1;
+        p += n;
+    } else {
+        msg.types = ""; // old senders may omit the type tags
+    }
+    msg.args = p;
+    msg.end = end;
+    msg.time = time;
+    handler(msg, user);
+    return 0;
+}
+
+/*
+ Number of arguments
+*/
+int OscMessage::count() const {
+    return (int)strlen(this->types);
+}
+
+/*
+ Locate an argument's data
+   RETURNS:
+     pointer into the packet, or NULL if index is out of range or the
+     data runs past the message
+*/
+const unsigned char *OscMessage::arg(int index) const {
+    const unsigned char *p = this->args;
+    unsigned long n;
+    int i;
+    
+    if(index < 0 || index >= this->count()) return NULL;
+    for(i = 0; ; i++) {
+        switch(this->types[i]) {
+            case 'i': case 'f': case 'c': case 'r': case 'm': n = 4; break;
+            case 'h': case 'd': case 't': n = 8; break;
+            case 's': case 'S':
+                n = padded_string(p, this->end);
+                if(n == 0) return NULL;
+                break;
+            case 'b':
+                if(this->end - p < 4) return NULL;
+                n = 4 + ((get_u32(p) + 3) & ~3UL);
+                break;
+            default: n = 0; // T F N I carry no data
+        }
+        if(n > (unsigned long)(this->end - p)) return NULL;
+        if(i == index) return p;
+        p += n;
+    }
+}
+
+/*
+ Read an argument as an int; floats are truncated
+   RETURNS:
+     false if the argument is missing or not a number
+*/
+bool OscMessage::get_int(int index, int *value) const {
+    const unsigned char *p = this->arg(index);
+    uint32_t bits;
+    float f;
+    
+    if(p == NULL) return false;
+    bits = get_u32(p);
+    if(this->types[index] == 'i') {
+        *value = (int32_t)bits;
+    } else if(this->types[index] == 'f') {
+        memcpy(&f, &bits, sizeof(f));
+        *value = (int)f;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ Read an argument as a float; ints are converted
+   RETURNS:
+     false if the argument is missing or not a number
+*/
+bool OscMessage::get_float(int index, float *value) const {
+    const unsigned char *p = this->arg(index);
+    uint32_t bits;
+    
+    if(p == NULL) return false;
+    bits = get_u32(p);
+    if(this->types[index] == 'f') {
+        memcpy(value, &bits, sizeof(*value));
+    } else if(this->types[index] == 'i') {
+        *value = (float)(int32_t)bits;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ Read a string argument, in place
+   RETURNS:
+     const char * into the packet, or NULL if it is missing or not a string
+*/
+const char *OscMessage::get_string(int index) const {
+    const unsigned char *p = this->arg(index);
+    
+    if(p == NULL || (this->types[index] != 's' && this->types[index] != 'S')) return NULL;
+    return (const char*)p;
+}
@@ -0,0 +1,57 @@
+//
+//  osc.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef osc_h
+#define osc_h
+
+#include <stdint.h>
+
+class OscConstants {
+public:
+    static const int MAX_PACKET = 8192;   // largest datagram accepted
+    static const int MAX_DEPTH = 8;       // nested bundles
+    static const uint64_t IMMEDIATELY = 1; // timetag
+    static const uint64_t NTP_UNIX_OFFSET = 2208988800ULL; // 1900 -> 1970, s
+};
+
+/*
+ Struct OscMessage:
+   One OSC message, pointing into the packet it was read from; nothing is
+   copied, so it is only valid inside the handler it is passed to.  time
+   is the timetag of the innermost enclosing bundle, IMMEDIATELY outside
+   of one.
+*/
+struct OscMessage : public OscConstants {
+    const char *address;
+    const char *types; // type tags, without the leading ','
+    const unsigned char *args;
+    const unsigned char *end;
+    uint64_t time;
+    int count() const;
+    bool get_int(int, int*) const;
+    bool get_float(int, float*) const;
+    const char *get_string(int) const;
+private:
+    const unsigned char *arg(int) const;
+};
+
+/*
+ Class OscReader:
+   Walks an OSC packet (a message or a bundle of them, nested) in place
+   and hands each message to a handler, in packet order.
+*/
+class OscReader : public OscConstants {
+public:
+    typedef void (*Handler)(const OscMessage&, void*);
+    static int parse(const unsigned char*, unsigned long, Handler, void*);
+private:
+    static int parse_element(const unsigned char*, unsigned long, uint64_t, int,
+                             Handler, void*);
+};
+
+#endif /* osc_h */
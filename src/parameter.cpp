@@ -0,0 +1,192 @@
+//
+//  parameter.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "parameter.h"
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+/*
+ SmoothedParameter constructor
+   TAKES:
+     initial     --> float starting value
+     sample_rate --> int used to size waits
+*/
+SmoothedParameter::SmoothedParameter(float initial, int sample_rate) :
+generation(0), target_value(initial), target_ramp(0),
+target_mode(SmoothedParameter::RAMP_LINEAR), settled(0),
+remaining_samples(0), current(initial) {
+    this->seen = 0;
+    this->value = initial;
+    this->target = initial;
+    this->increment = 0.0;
+    this->coef = 0.0;
+    this->remaining = 0;
+    this->mode = SmoothedParameter::RAMP_LINEAR;
+    this->ramping = false;
+    this->sample_rate = sample_rate;
+}
+
+/*
+ Start a ramp toward a new value (control thread)
+   TAKES:
+     value --> float target value
+     ramp  --> int ramp length (linear) or time constant (exponential) in
+               samples; 0 jumps at the next block
+     mode  --> RAMP_LINEAR or RAMP_EXPONENTIAL
+   RETURNS:
+     generation of this target
+*/
+unsigned SmoothedParameter::set(float value, int ramp, int mode) {
+    unsigned g;
+    {
+        std::lock_guard<std::mutex> lock(this->wait_mutex);
+        g = this->generation.load(std::memory_order_relaxed);
+        this->generation.store(g + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        this->target_value.store(value, std::memory_order_relaxed);
+        this->target_ramp.store(ramp, std::memory_order_relaxed);
+        this->target_mode.store(mode, std::memory_order_relaxed);
+        this->remaining_samples.store(ramp, std::memory_order_relaxed);
+        this->generation.store(g + 2, std::memory_order_release);
+    }
+    // wake anyone waiting on an older target
+    this->wait_cond.notify_all();
+    return g + 2;
+}
+
+/*
+ Block until the latest target is reached or replaced by a newer one.
+ Sleeps for roughly the time left in the ramp between checks.
+*/
+void SmoothedParameter::wait() {
+    std::unique_lock<std::mutex> lock(this->wait_mutex);
+    unsigned g = this->generation.load(std::memory_order_acquire);
+    long ms;
+    
+    while(this->settled.load(std::memory_order_acquire) != g &&
+          this->generation.load(std::memory_order_acquire) == g) {
+        ms = (1000L * this->remaining_samples.load(std::memory_order_relaxed)) /
+             this->sample_rate;
+        if(ms < SmoothedParameter::MIN_WAIT_MS) ms = SmoothedParameter::MIN_WAIT_MS;
+        this->wait_cond.wait_for(lock, std::chrono::milliseconds(ms));
+    }
+}
+
+/*
+ True when the audio thread has reached the latest target
+*/
+bool SmoothedParameter::is_settled() {
+    return this->settled.load(std::memory_order_acquire) ==
+           this->generation.load(std::memory_order_acquire);
+}
+
+/*
+ Value at the end of the last processed block
+*/
+float SmoothedParameter::get() {
+    return this->current.load(std::memory_order_relaxed);
+}
+
+/*
+ Advance the ramp by one block (audio thread)
+   TAKES:
+     frames --> unsigned long frames in the block
+     start  --> float * receives the value for the first frame
+     step   --> float * receives the per-frame increment (0 when steady)
+*/
+void SmoothedParameter::next_block(unsigned long frames, float *start, float *step) {
+    unsigned g1, g2;
+    float v, end;
+    int ramp, m;
+    
+    // pick up a new target (sequence lock, never retries)
+    g1 = this->generation.load(std::memory_order_acquire);
+    if(g1 != this->seen && (g1 & 1) == 0) {
+        v = this->target_value.load(std::memory_order_relaxed);
+        ramp = this->target_ramp.load(std::memory_order_relaxed);
+        m = this->target_mode.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        g2 = this->generation.load(std::memory_order_relaxed);
+        if(g1 == g2) {
+            this->seen = g1;
+            this->target = v;
+            this->mode = m;
+            this->ramping = true;
+            if(ramp <= 0) {
+                this->value = v;
+            } else if(m == SmoothedParameter::RAMP_LINEAR) {
+                this->remaining = ramp;
+                this->increment = (v - this->value) / ramp;
+            } else {
+                this->coef = expf(-1.0f / ramp);
+            }
+        }
+    }
+    *start = this->value;
+    if(!this->ramping) {
+        *step = 0.0;
+        return;
+    }
+    // value at the end of this block
+    if(this->mode == SmoothedParameter::RAMP_LINEAR) {
+        if((unsigned long)this->remaining <= frames) {
+            end = this->target;
+            this->remaining = 0;
+        } else {
+            end = this->value + (this->increment * frames);
+            this->remaining -= frames;
+        }
+    } else {
+        end = this->target + ((this->value - this->target) *
+                              powf(this->coef, (float)frames));
+        if(fabsf(end - this->target) < SmoothedParameter::SETTLE_EPSILON) {
+            end = this->target;
+        }
+    }
+    *step = (end - this->value) / frames;
+    this->value = end;
+    this->current.store(end, std::memory_order_relaxed);
+    if(end == this->target) {
+        this->ramping = false;
+        this->remaining_samples.store(0, std::memory_order_relaxed);
+        this->settled.store(this->seen, std::memory_order_release);
+    } else if(this->mode == SmoothedParameter::RAMP_LINEAR) {
+        this->remaining_samples.store(this->remaining, std::memory_order_relaxed);
+    }
+}
+
+/*
+ Scale an interleaved block by the parameter (audio thread)
+   TAKES:
+     buffer   --> float * interleaved samples, scaled in place
+     frames   --> unsigned long frames in buffer
+     channels --> int interleaved channels
+*/
+void SmoothedParameter::apply(float *buffer, unsigned long frames, int channels) {
+    unsigned long i, n = frames * channels;
+    float g, step;
+    int c;
+    
+    this->next_block(frames, &g, &step);
+    if(step == 0.0) {
+        if(g == 1.0) return;
+        if(g == 0.0) {
+            memset(buffer, 0, n * sizeof(float));
+            return;
+        }
+        for(i = 0; i < n; i++) buffer[i] *= g;
+        return;
+    }
+    for(i = 0; i < frames; i++) {
+        for(c = 0; c < channels; c++) {
+            *buffer++ *= g;
+        }
+        g += step;
+    }
+}
@@ -0,0 +1,68 @@
+//
+//  parameter.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef parameter_h
+#define parameter_h
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+class ParameterConstants {
+public:
+    // RAMP SHAPES
+    static const int RAMP_LINEAR = 0;      // ramp = length in samples
+    static const int RAMP_EXPONENTIAL = 1; // ramp = time constant in samples
+    constexpr static const float SETTLE_EPSILON = 0.00001;
+    static const int MIN_WAIT_MS = 5;
+};
+
+/*
+ Class SmoothedParameter:
+   A gain-style value set from a control thread and ramped on the audio
+   thread.  The ramp is evaluated once per block and applied with a
+   per-sample add, so a fade costs a few flops per block.  The audio side
+   never locks or signals; wait() sleeps on a condition variable that is
+   only signalled by set(), with timeouts sized to the remaining ramp.
+*/
+class SmoothedParameter : public ParameterConstants {
+    // target, written by set() under a sequence lock
+    std::atomic<unsigned> generation; // odd while a write is in progress
+    std::atomic<float> target_value;
+    std::atomic<int> target_ramp;
+    std::atomic<int> target_mode;
+    // audio thread state
+    unsigned seen;
+    float value;
+    float target;
+    float increment; // linear: per sample
+    float coef;      // exponential: per sample
+    int remaining;   // linear: samples left
+    int mode;
+    bool ramping;
+    // published to waiters
+    std::atomic<unsigned> settled; // generation of the last target reached
+    std::atomic<int> remaining_samples;
+    std::atomic<float> current;
+    // waiters
+    int sample_rate;
+    std::mutex wait_mutex;
+    std::condition_variable wait_cond;
+public:
+    SmoothedParameter(float initial=0.0, int sample_rate=44100);
+    // control thread
+    unsigned set(float, int, int mode=SmoothedParameter::RAMP_LINEAR);
+    void wait();
+    bool is_settled();
+    float get();
+    // audio thread
+    void next_block(unsigned long, float*, float*);
+    void apply(float*, unsigned long, int);
+};
+
+#endif /* parameter_h */
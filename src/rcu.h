@@ -0,0 +1,100 @@
+//
+//  rcu.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef rcu_h
+#define rcu_h
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/*
+ Class RcuPointer:
+   Publishes immutable objects from a control/worker thread to the audio
+   thread.  The reader brackets each use with read_lock()/read_unlock(),
+   which are wait-free and never free memory.  Writers swap in a new
+   object with publish(); the old one is kept on a retired list and
+   deleted by reclaim() once the reader has finished a read section that
+   started after the swap.  Read sections must not overlap each other.
+*/
+template <class T>
+class RcuPointer {
+    struct Retired {
+        T *ptr;
+        unsigned long epoch;
+    };
+    std::atomic<T*> current;
+    std::atomic<unsigned long> epoch; // completed read sections
+    std::vector<Retired> retired;     // writer side only
+    std::mutex writer;
+public:
+    RcuPointer(T *initial=NULL) : current(initial), epoch(0) {}
+    
+    ~RcuPointer() {
+        // reader must be gone by now
+        for(size_t i = 0; i < this->retired.size(); i++) {
+            delete this->retired[i].ptr;
+        }
+        delete this->current.load();
+    }
+    
+    // ----- READER (audio thread) -----
+    T *read_lock() {
+        return this->current.load(std::memory_order_seq_cst);
+    }
+    
+    void read_unlock() {
+        this->epoch.fetch_add(1, std::memory_order_seq_cst);
+    }
+    
+    // ----- WRITERS -----
+    /*
+     Swap in a new object and retire the old one
+    */
+    void publish(T *next) {
+        std::lock_guard<std::mutex> lock(this->writer);
+        Retired r;
+        r.ptr = this->current.exchange(next, std::memory_order_seq_cst);
+        r.epoch = this->epoch.load(std::memory_order_seq_cst);
+        if(r.ptr != NULL) this->retired.push_back(r);
+    }
+    
+    /*
+     Delete retired objects the reader can no longer see
+       RETURNS:
+         number of objects still waiting for a grace period
+    */
+    size_t reclaim() {
+        std::lock_guard<std::mutex> lock(this->writer);
+        unsigned long now = this->epoch.load(std::memory_order_seq_cst);
+        size_t kept = 0;
+        for(size_t i = 0; i < this->retired.size(); i++) {
+            if(now > this->retired[i].epoch) {
+                delete this->retired[i].ptr;
+            } else {
+                this->retired[kept++] = this->retired[i];
+            }
+        }
+        this->retired.resize(kept);
+        return kept;
+    }
+    
+    /*
+     Delete every retired object.  Only when the reader is known to be
+     stopped, so no read section can be open.
+    */
+    void reclaim_all() {
+        std::lock_guard<std::mutex> lock(this->writer);
+        for(size_t i = 0; i < this->retired.size(); i++) {
+            delete this->retired[i].ptr;
+        }
+        this->retired.clear();
+    }
+};
+
+#endif /* rcu_h */
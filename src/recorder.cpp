@@ -0,0 +1,395 @@
+//
+//  recorder.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "recorder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+// storage for constants passed by reference (unoptimized builds)
+const int RecorderConstants::POLL_MS;
+const int RecorderConstants::SYNC_INTERVAL_MS;
+
+/*
+ Recorder constructor: closed
+*/
+Recorder::Recorder() : head(0), tail(0), overruns(0), dropped(0), written(0),
+                       failed(false), part(0) {
+    this->ring = NULL;
+    this->capacity = 0;
+    this->num_channels = 0;
+    this->sample_rate = 0;
+    this->format = Recorder::FORMAT_WAV;
+    this->fd = -1;
+    this->direct = false;
+    this->file_frames = 0;
+    this->reserved = 0;
+    this->header = NULL;
+    this->quit = false;
+}
+
+/*
+ Recorder destructor
+*/
+Recorder::~Recorder() {
+    this->close();
+}
+
+/*
+ Start a take
+   TAKES:
+     path         --> const char * output file
+     sample_rate  --> int sample rate in Hz
+     num_channels --> int number of interleaved channels
+     format       --> FORMAT_WAV or FORMAT_RAW
+     ring_seconds --> int audio the ring holds while the disk is busy
+   RETURNS:
+     0 on success, 1 if already open or the file could not be created
+*/
+int Recorder::open(const char *path, int sample_rate, int num_channels,
+                   int format, int ring_seconds) {
+    unsigned long chunks;
+    void *mem;
+    
+    if(this->is_open() || num_channels < 1) return 1;
+    chunks = ((unsigned long)ring_seconds * sample_rate + Recorder::CHUNK_FRAMES - 1) /
+             Recorder::CHUNK_FRAMES;
+    if(chunks < 2) chunks = 2;
+    this->capacity = chunks * Recorder::CHUNK_FRAMES;
+    this->num_channels = num_channels;
+    this->sample_rate = sample_rate;
+    this->format = format;
+    this->path = path;
+    if(posix_memalign(&mem, Recorder::ALIGN,
+                      this->capacity * num_channels * sizeof(float)) != 0) return 1;
+    this->ring = (float*)mem;
+    if(posix_memalign(&mem, Recorder::ALIGN, Recorder::ALIGN) != 0) {
+        free(this->ring);
+        this->ring = NULL;
+        return 1;
+    }
+    this->header = (unsigned char*)mem;
+    this->head = 0;
+    this->tail = 0;
+    this->overruns = 0;
+    this->dropped = 0;
+    this->written = 0;
+    this->failed = false;
+    this->part = 0;
+    if(this->open_file()) {
+        free(this->ring);
+        free(this->header);
+        this->ring = NULL;
+        this->header = NULL;
+        return 1;
+    }
+    this->quit = false;
+    this->writer = std::thread(&Recorder::write_loop, this);
+    return 0;
+}
+
+/*
+ Finish the take: drain the ring, finalize and close the file.  The
+ audio thread must have stopped calling write() (see Mixer::set_recorder).
+   RETURNS:
+     0 on success, 1 if any write failed
+*/
+int Recorder::close() {
+    if(!this->is_open()) return 0;
+    {
+        std::lock_guard<std::mutex> lock(this->quit_mutex);
+        this->quit = true;
+    }
+    this->quit_cond.notify_one();
+    this->writer.join();
+    free(this->ring);
+    free(this->header);
+    this->ring = NULL;
+    this->header = NULL;
+    return this->failed.load() ? 1 : 0;
+}
+
+bool Recorder::is_open() {
+    return this->ring != NULL;
+}
+
+/*
+ Copy a block into the ring (audio thread).  Never waits: a block that
+ does not fit is dropped and counted as an overrun.
+   TAKES:
+     data   --> const float * interleaved samples
+     frames --> number of frames in data
+*/
+void Recorder::write(const float *data, unsigned long frames) {
+    unsigned long h = this->head.load(std::memory_order_relaxed);
+    unsigned long pos, first;
+    int ch = this->num_channels;
+    
+    if(this->capacity - (h - this->tail.load(std::memory_order_acquire)) < frames) {
+        this->overruns.fetch_add(1, std::memory_order_relaxed);
+        this->dropped.fetch_add(frames, std::memory_order_relaxed);
+        return;
+    }
+    pos = h % this->capacity;
+    first = this->capacity - pos;
+    if(first > frames) first = frames;
+    memcpy(this->ring + (pos * ch), data, first * ch * sizeof(float));
+    memcpy(this->ring, data + (first * ch), (frames - first) * ch * sizeof(float));
+    this->head.store(h + frames, std::memory_order_release);
+}
+
+/*
+ Record silence (audio thread), e.g. for a track that was not rendered
+*/
+void Recorder::write_silence(unsigned long frames) {
+    unsigned long h = this->head.load(std::memory_order_relaxed);
+    unsigned long pos, first;
+    int ch = this->num_channels;
+    
+    if(this->capacity - (h - this->tail.load(std::memory_order_acquire)) < frames) {
+        this->overruns.fetch_add(1, std::memory_order_relaxed);
+        this->dropped.fetch_add(frames, std::memory_order_relaxed);
+        return;
+    }
+    pos = h % this->capacity;
+    first = this->capacity - pos;
+    if(first > frames) first = frames;
+    memset(this->ring + (pos * ch), 0, first * ch * sizeof(float));
+    memset(this->ring, 0, (frames - first) * ch * sizeof(float));
+    this->head.store(h + frames, std::memory_order_release);
+}
+
+/*
+ Writer thread: write whole chunks as they fill, straight from the ring.
+ The capacity is a whole number of chunks, so a chunk never wraps.
+*/
+void Recorder::write_loop() {
+    std::chrono::steady_clock::time_point last_sync = std::chrono::steady_clock::now();
+    unsigned long h, t, n;
+    int ch = this->num_channels;
+    
+#ifdef __linux__
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), Recorder::WRITER_NICE);
+#endif
+    while(true) {
+        h = this->head.load(std::memory_order_acquire);
+        t = this->tail.load(std::memory_order_relaxed);
+        if(h - t >= (unsigned long)Recorder::CHUNK_FRAMES) {
+            this->write_frames(this->ring + ((t % this->capacity) * ch), Recorder::CHUNK_FRAMES);
+            this->tail.store(t + Recorder::CHUNK_FRAMES, std::memory_order_release);
+            continue;
+        }
+        if(std::chrono::steady_clock::now() - last_sync >=
+           std::chrono::milliseconds(Recorder::SYNC_INTERVAL_MS)) {
+            // an interrupted take stays playable up to here
+            if(!this->failed.load() && this->write_header() == 0) fdatasync(this->fd);
+            last_sync = std::chrono::steady_clock::now();
+        }
+        std::unique_lock<std::mutex> lock(this->quit_mutex);
+        if(this->quit) break;
+        this->quit_cond.wait_for(lock, std::chrono::milliseconds(Recorder::POLL_MS));
+    }
+    // whatever is left, ending in a partial chunk
+    h = this->head.load(std::memory_order_acquire);
+    t = this->tail.load(std::memory_order_relaxed);
+    while(h > t) {
+        n = (h - t < (unsigned long)Recorder::CHUNK_FRAMES) ? h - t : Recorder::CHUNK_FRAMES;
+        this->write_frames(this->ring + ((t % this->capacity) * ch), n);
+        t += n;
+    }
+    this->tail.store(t, std::memory_order_release);
+    if(this->close_file()) this->failed = true;
+}
+
+/*
+ Append frames to the current file, rolling over to the next one when
+ it would grow past MAX_FILE_BYTES (writer thread)
+   RETURNS:
+     0 on success, 1 on error (the take is marked failed and the rest of
+     it discarded)
+*/
+int Recorder::write_frames(const float *data, unsigned long frames) {
+    const char *p = (const char*)data;
+    size_t bytes = frames * this->num_channels * sizeof(float);
+    off_t offset;
+    size_t done = 0;
+    ssize_t n;
+    
+    if(this->failed.load()) return 1;
+    if(this->data_offset() + (this->file_frames * this->num_channels * sizeof(float)) +
+       bytes > Recorder::MAX_FILE_BYTES) {
+        if(this->close_file()) {
+            this->failed = true;
+            return 1;
+        }
+        this->part++;
+        if(this->open_file()) {
+            this->failed = true;
+            return 1;
+        }
+    }
+    offset = this->data_offset() + (this->file_frames * this->num_channels * sizeof(float));
+#ifdef O_DIRECT
+    if(this->direct && (bytes % Recorder::ALIGN) != 0) {
+        // unaligned tail: finish through the page cache
+        fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) & ~O_DIRECT);
+        this->direct = false;
+    }
+#endif
+#ifdef __linux__
+    if((unsigned long)offset + bytes > this->reserved) {
+        // reserve space ahead, so the file stays contiguous
+        size_t ahead = (size_t)Recorder::PREALLOCATE_CHUNKS * Recorder::CHUNK_FRAMES *
+                       this->num_channels * sizeof(float);
+        if(fallocate(this->fd, FALLOC_FL_KEEP_SIZE, this->reserved,
+                     offset + bytes + ahead - this->reserved) == 0) {
+            this->reserved = offset + bytes + ahead;
+        } else {
+            this->reserved = ULONG_MAX; // not supported here, stop trying
+        }
+    }
+#endif
+    while(done < bytes) {
+        n = pwrite(this->fd, p + done, bytes - done, offset + done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            this->failed = true;
+            return 1;
+        }
+        done += n;
+    }
+    this->file_frames += frames;
+    this->written.fetch_add(frames, std::memory_order_relaxed);
+    return 0;
+}
+
+/*
+ Create the current part's file (writer thread, or open())
+   RETURNS:
+     0 on success, 1 if it could not be created
+*/
+int Recorder::open_file() {
+    std::string name = this->file_name(this->part);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    
+    this->fd = -1;
+    this->direct = false;
+#ifdef O_DIRECT
+    this->fd = ::open(name.c_str(), flags | O_DIRECT, 0644);
+    this->direct = (this->fd >= 0);
+#endif
+    // tmpfs and some others refuse O_DIRECT
+    if(this->fd < 0) this->fd = ::open(name.c_str(), flags, 0644);
+    if(this->fd < 0) return 1;
+    this->file_frames = 0;
+    this->reserved = 0;
+    if(this->format == Recorder::FORMAT_WAV && this->write_header()) {
+        ::close(this->fd);
+        this->fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ Patch the header, give back unused reserved space and close
+   RETURNS:
+     0 on success, 1 on error
+*/
+int Recorder::close_file() {
+    int err = 0;
+    
+    if(this->fd < 0) return 0;
+    if(this->write_header()) err = 1;
+    if(ftruncate(this->fd, this->data_offset() +
+                 (this->file_frames * this->num_channels * sizeof(float))) != 0) err = 1;
+    if(fsync(this->fd) != 0) err = 1;
+    if(::close(this->fd) != 0) err = 1;
+    this->fd = -1;
+    return err;
+}
+
+/*
+ Rewrite the WAV header with the frames written so far; the header
+ buffer and its offset are aligned, so this works under O_DIRECT too
+   RETURNS:
+     0 on success (or for raw files), 1 on error
+*/
+int Recorder::write_header() {
+    if(this->format != Recorder::FORMAT_WAV) return 0;
+    WavWriter::make_header(this->header, Recorder::ALIGN, this->sample_rate,
+                           this->num_channels, this->file_frames);
+    return (pwrite(this->fd, this->header, Recorder::ALIGN, 0) == Recorder::ALIGN) ? 0 : 1;
+}
+
+/*
+ Bytes before the first sample
+*/
+int Recorder::data_offset() {
+    return (this->format == Recorder::FORMAT_WAV) ? Recorder::ALIGN : 0;
+}
+
+/*
+ File name of a part: the path itself, then "take.1.wav", "take.2.wav"...
+*/
+std::string Recorder::file_name(int part) {
+    std::string name = this->path;
+    size_t dot = name.rfind('.');
+    size_t slash = name.rfind('/');
+    char suffix[16];
+    
+    if(part == 0) return name;
+    snprintf(suffix, sizeof(suffix), ".%d", part);
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return name + suffix;
+    }
+    return name.insert(dot, suffix);
+}
+
+/*
+ Blocks dropped because the ring was full
+*/
+unsigned long Recorder::get_overruns() {
+    return this->overruns.load(std::memory_order_relaxed);
+}
+
+/*
+ Frames lost to overruns
+*/
+unsigned long Recorder::get_dropped() {
+    return this->dropped.load(std::memory_order_relaxed);
+}
+
+/*
+ Frames on disk
+*/
+unsigned long Recorder::get_written() {
+    return this->written.load(std::memory_order_relaxed);
+}
+
+/*
+ Files the take spans so far
+*/
+int Recorder::get_files() {
+    return this->part.load() + 1;
+}
+
+/*
+ True once a write has failed; the rest of the take is discarded
+*/
+bool Recorder::has_failed() {
+    return this->failed.load();
+}
@@ -0,0 +1,95 @@
+//
+//  recorder.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef recorder_h
+#define recorder_h
+
+#include "wavfile.h"
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class RecorderConstants {
+public:
+    static const int DEFAULT_RING_SECONDS = 4;
+    static const int CHUNK_FRAMES = 16384;    // frames per disk write
+    static const int ALIGN = 4096;            // O_DIRECT buffer/offset alignment
+    static const int PREALLOCATE_CHUNKS = 64; // reserved ahead with fallocate
+    static const int POLL_MS = 20;
+    static const int SYNC_INTERVAL_MS = 5000; // header patched, data flushed
+    static const int WRITER_NICE = 10;
+    static const unsigned long MAX_FILE_BYTES = 4000000000UL; // then roll over
+};
+
+/*
+ Class Recorder:
+   Captures audio from the audio thread to disk.  write() copies a block
+   into a preallocated single-producer/single-consumer ring and returns;
+   if the ring is full the block is dropped and counted, so a slow disk
+   never stalls audio.  A low-priority writer thread drains the ring in
+   CHUNK_FRAMES writes, with O_DIRECT where the file system allows it and
+   space reserved ahead with fallocate.  WAV files get a 4 KiB header so
+   the samples stay aligned; the header is patched every
+   SYNC_INTERVAL_MS, so an interrupted take is still playable.  Takes
+   longer than MAX_FILE_BYTES continue in "name.1.wav", "name.2.wav"...
+*/
+class Recorder : public RecorderConstants, public WavFileConstants {
+    // ring, frames; head written by the audio thread, tail by the writer
+    float *ring;
+    unsigned long capacity;
+    std::atomic<unsigned long> head;
+    std::atomic<unsigned long> tail;
+    int num_channels;
+    int sample_rate;
+    int format;
+    // counters
+    std::atomic<unsigned long> overruns;
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> written;
+    std::atomic<bool> failed;
+    // writer thread state
+    std::string path;
+    int fd;
+    bool direct;
+    std::atomic<int> part; // file being written, 0 = path itself
+    unsigned long file_frames;
+    unsigned long reserved; // bytes preallocated
+    unsigned char *header;
+    std::thread writer;
+    std::mutex quit_mutex;
+    std::condition_variable quit_cond;
+    bool quit;
+    // helper method(s)
+    void write_loop();
+    int open_file();
+    int close_file();
+    int write_frames(const float*, unsigned long);
+    int write_header();
+    int data_offset();
+    std::string file_name(int);
+public:
+    Recorder();
+    ~Recorder();
+    int open(const char*, int, int, int format=Recorder::FORMAT_WAV,
+             int ring_seconds=Recorder::DEFAULT_RING_SECONDS);
+    int close();
+    bool is_open();
+    // audio thread
+    void write(const float*, unsigned long);
+    void write_silence(unsigned long);
+    // any thread
+    unsigned long get_overruns();
+    unsigned long get_dropped();
+    unsigned long get_written();
+    int get_files();
+    bool has_failed();
+};
+
+#endif /* recorder_h */
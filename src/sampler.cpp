@@ -0,0 +1,622 @@
+//
+//  sampler.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "sampler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+
+// storage for constants passed by reference (unoptimized builds)
+const int SamplerConstants::PREFETCH_MS;
+
+/*
+ Little-endian field readers for the RIFF chunks
+*/
+static unsigned get_u16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned long get_u32(const unsigned char *p) {
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static uint64_t pack(uint64_t generation, unsigned long frame) {
+    return (generation << Sampler::GENERATION_SHIFT) | frame;
+}
+
+/*
+ Sampler constructor: an empty library
+*/
+Sampler::Sampler(int num_c, int num_v) : Instrument::Instrument(num_c, num_v),
+                                         hits(0), misses(0), starvations(0) {
+    // compact() only exchanges slots among voices in use, so a voice's
+    // slot is always below the pool size
+    this->num_streams = this->voices->size;
+    this->streams = new SamplerStream[this->num_streams];
+    for(int i = 0; i < this->num_streams; i++) {
+        SamplerStream *s = &this->streams[i];
+        s->sample = NULL;
+        s->fill = 0;
+        s->consumed = 0;
+        s->ring = new float[Sampler::RING_FRAMES];
+        s->generation = 0;
+        s->position = 0.0;
+        s->step = 1.0;
+    }
+    for(int k = 0; k < Sampler::NUM_KEYS; k++) this->keys[k] = -1;
+    this->interpolation = WaveTable::INTERP_LINEAR;
+    this->prefetch_quit = false;
+    this->prefetch_wake = false;
+    this->offline = false;
+    this->prefetcher = std::thread(&Sampler::prefetch_loop, this);
+}
+
+/*
+ Sampler destructor: unmaps the library
+*/
+Sampler::~Sampler() {
+    {
+        std::lock_guard<std::mutex> lock(this->prefetch_mutex);
+        this->prefetch_quit = true;
+    }
+    this->prefetch_cond.notify_all();
+    this->prefetcher.join();
+    for(int i = 0; i < this->num_streams; i++) {
+        delete [] this->streams[i].ring;
+    }
+    delete [] this->streams;
+    for(size_t i = 0; i < this->samples.size(); i++) {
+        SamplerSample *smp = this->samples[i];
+        munmap((void*)smp->map, smp->map_size);
+        close(smp->fd);
+        delete [] smp->head;
+        delete smp;
+    }
+}
+
+/*
+ Load a library from a sample map, one sample per line:
+     FILE ROOT [LOW HIGH]
+ FILE is a WAV file, relative to the map's directory; ROOT is the MIDI
+ key it was recorded at; LOW and HIGH are the MIDI keys it plays, and
+ keys no sample claims go to the nearest sample without a range.  Blank
+ lines and lines starting with '#' are skipped.  Not safe while the
+ instrument is being rendered.
+   TAKES:
+     path --> const char * map file
+   RETURNS:
+     0 on success, 1 if the map, or any sample in it, could not be read
+*/
+int Sampler::load(const char *path) {
+    FILE *f = fopen(path, "r");
+    std::string dir, file;
+    const char *slash = strrchr(path, '/');
+    char line[1024], name[1024];
+    int root, low, high, n;
+    
+    if(f == NULL) return 1;
+    if(slash != NULL) dir.assign(path, slash - path + 1);
+    while(fgets(line, sizeof(line), f) != NULL) {
+        n = sscanf(line, " %1023s %d %d %d", name, &root, &low, &high);
+        if(n <= 0 || name[0] == '#') continue;
+        if(n != 2 && n != 4) {
+            fclose(f);
+            return 1;
+        }
+        if(n == 2) low = high = -1;
+        file = (name[0] == '/') ? std::string(name) : dir + name;
+        if(this->add_sample(file.c_str(), root, low, high)) {
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+    return this->samples.empty() ? 1 : 0;
+}
+
+/*
+ Map a WAV file into the library: 16, 24 or 32-bit PCM, or 32-bit float,
+ any number of channels.  Its head is decoded now.  Not safe while the
+ instrument is being rendered.
+   TAKES:
+     path --> const char * WAV file
+     root --> int MIDI key the sample was recorded at
+     low  --> int lowest MIDI key it plays, or -1 to take the nearest keys
+     high --> int highest MIDI key it plays
+   RETURNS:
+     0 on success, 1 if the file could not be mapped or is not a WAV
+     file in a supported encoding
+*/
+int Sampler::add_sample(const char *path, int root, int low, int high) {
+    SamplerSample *smp;
+    struct stat st;
+    const unsigned char *map, *p, *end, *fmt = NULL;
+    unsigned long len, fmt_len = 0, data_bytes = 0;
+    unsigned format = 0, bits = 0;
+    int fd;
+    
+    if(root < 0 || root >= Sampler::NUM_KEYS || low >= Sampler::NUM_KEYS ||
+       high >= Sampler::NUM_KEYS || (low >= 0 && high < low)) return 1;
+    fd = open(path, O_RDONLY);
+    if(fd < 0) return 1;
+    if(fstat(fd, &st) != 0 || st.st_size < 12) {
+        close(fd);
+        return 1;
+    }
+    map = (const unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == (const unsigned char*)MAP_FAILED) {
+        close(fd);
+        return 1;
+    }
+    smp = new SamplerSample();
+    smp->path = path;
+    smp->fd = fd;
+    smp->map = map;
+    smp->map_size = st.st_size;
+    smp->data = NULL;
+    smp->head = NULL;
+    // walk the chunks for the format and the data
+    end = map + st.st_size;
+    if(memcmp(map, "RIFF", 4) == 0 && memcmp(map + 8, "WAVE", 4) == 0) {
+        for(p = map + 12; end - p >= 8; p += 8 + len + (len & 1)) {
+            len = get_u32(p + 4);
+            if(memcmp(p, "fmt ", 4) == 0 && len >= 16 &&
+               len <= (unsigned long)(end - p - 8)) {
+                fmt = p + 8;
+                fmt_len = len;
+            } else if(memcmp(p, "data", 4) == 0) {
+                smp->data = p + 8;
+                data_bytes = (len < (unsigned long)(end - p - 8)) ? len : end - p - 8;
+                break;
+            }
+            if(len > (unsigned long)(end - p - 8)) break;
+        }
+    }
+    if(fmt != NULL) {
+        format = get_u16(fmt);
+        smp->channels = get_u16(fmt + 2);
+        smp->sample_rate = (int)get_u32(fmt + 4);
+        bits = get_u16(fmt + 14);
+        // WAVE_FORMAT_EXTENSIBLE carries the real format in its subformat
+        if(format == 0xfffe && fmt_len >= 40) format = get_u16(fmt + 24);
+    }
+    smp->encoding = -1;
+    if(format == 1 && bits == 16) smp->encoding = Sampler::ENCODING_PCM16;
+    if(format == 1 && bits == 24) smp->encoding = Sampler::ENCODING_PCM24;
+    if(format == 1 && bits == 32) smp->encoding = Sampler::ENCODING_PCM32;
+    if(format == 3 && bits == 32) smp->encoding = Sampler::ENCODING_FLOAT32;
+    smp->frames = 0;
+    if(smp->data != NULL && smp->encoding >= 0 && smp->channels >= 1) {
+        smp->frame_bytes = smp->channels * (bits / 8);
+        smp->frames = data_bytes / smp->frame_bytes;
+    }
+    if(smp->frames == 0 || smp->sample_rate <= 0) {
+        munmap((void*)map, st.st_size);
+        close(fd);
+        delete smp;
+        return 1;
+    }
+    smp->root = root;
+    smp->low = (low < 0) ? -1 : low;
+    smp->high = (low < 0) ? -1 : high;
+    smp->head_frames = (smp->frames < (unsigned long)Sampler::HEAD_FRAMES) ?
+                       smp->frames : Sampler::HEAD_FRAMES;
+    smp->head = new float[smp->head_frames];
+    Sampler::decode(smp, 0, smp->head_frames, smp->head);
+    this->samples.push_back(smp);
+    this->map_keys();
+    return 0;
+}
+
+/*
+ Number of samples in the library
+*/
+int Sampler::num_samples() {
+    return (int)this->samples.size();
+}
+
+/*
+ Assign every MIDI key a sample: the first whose range holds the key,
+ else the one with a free range whose root is nearest
+*/
+void Sampler::map_keys() {
+    int k, best, distance;
+    
+    for(k = 0; k < Sampler::NUM_KEYS; k++) {
+        this->keys[k] = -1;
+        for(size_t i = 0; i < this->samples.size(); i++) {
+            if(this->samples[i]->low <= k && k <= this->samples[i]->high) {
+                this->keys[k] = (int)i;
+                break;
+            }
+        }
+        if(this->keys[k] >= 0) continue;
+        best = INT_MAX;
+        for(size_t i = 0; i < this->samples.size(); i++) {
+            if(this->samples[i]->low >= 0) continue;
+            distance = abs(this->samples[i]->root - k);
+            if(distance < best) {
+                best = distance;
+                this->keys[k] = (int)i;
+            }
+        }
+    }
+}
+
+/*
+ Decode frames of a sample to mono floats, averaging its channels
+   TAKES:
+     smp   --> const SamplerSample * to read
+     first --> unsigned long first frame
+     count --> unsigned long frames to decode
+     out   --> float * count floats
+*/
+void Sampler::decode(const SamplerSample *smp, unsigned long first, unsigned long count,
+                     float *out) {
+    const unsigned char *p = smp->data + (first * smp->frame_bytes);
+    const float scale = 1.0f / smp->channels;
+    unsigned long i;
+    int c;
+    float sum, f;
+    
+    for(i = 0; i < count; i++) {
+        sum = 0.0;
+        for(c = 0; c < smp->channels; c++) {
+            switch(smp->encoding) {
+                case Sampler::ENCODING_PCM16:
+                    sum += (int16_t)get_u16(p) * (1.0f / 32768.0f);
+                    p += 2;
+                    break;
+                case Sampler::ENCODING_PCM24:
+                    sum += (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) |
+                                     ((uint32_t)p[2] << 24)) * (1.0f / 2147483648.0f);
+                    p += 3;
+                    break;
+                case Sampler::ENCODING_PCM32:
+                    sum += (int32_t)get_u32(p) * (1.0f / 2147483648.0f);
+                    p += 4;
+                    break;
+                default:
+                    memcpy(&f, p, sizeof(f)); // WAV and every target are little-endian
+                    sum += f;
+                    p += 4;
+            }
+        }
+        out[i] = sum * scale;
+    }
+}
+
+/*
+ Sampler override of trigger_template: point the voice's stream at the
+ key's sample, from the top.  Audio thread; the prefetcher picks the
+ note up on its next pass, long before the head runs out.
+*/
+void Sampler::trigger_template(const int note_const) {
+    SamplerStream *s = &this->streams[this->voices->slot[this->curr_voice]];
+    const int key = note_const + MidiFile::NOTE_OFFSET; // as MIDI files map them
+    const int index = (key >= 0 && key < Sampler::NUM_KEYS) ? this->keys[key] : -1;
+    const SamplerSample *smp;
+    
+    if(index < 0) {
+        this->stop(s); // rendered as silence, and ended
+        return;
+    }
+    smp = this->samples[index];
+    s->generation++;
+    s->position = 0.0;
+    s->step = pow(2.0, (key - smp->root) / 12.0) *
+              ((double)smp->sample_rate / Sampler::SAMPLE_RATE);
+    s->sample.store(smp, std::memory_order_relaxed);
+    s->consumed.store(pack(s->generation, 0), std::memory_order_relaxed);
+    s->fill.store(pack(s->generation, smp->head_frames), std::memory_order_release);
+}
+
+/*
+ Detach a stream from its note; the prefetcher leaves it alone
+*/
+void Sampler::stop(SamplerStream *s) {
+    s->generation++;
+    s->sample.store(NULL, std::memory_order_relaxed);
+    s->consumed.store(pack(s->generation, 0), std::memory_order_relaxed);
+    s->fill.store(pack(s->generation, 0), std::memory_order_release);
+}
+
+/*
+ End a voice before its envelope does, e.g. when its sample runs out
+   TAKES:
+     v --> int voice index
+*/
+void Sampler::finish(int v) {
+    VoicePool *p = this->voices;
+    
+    p->active[v] = 0;
+    p->envelope_stage[v] = Envelope::STAGE_IDLE;
+    p->envelope_level[v] = 0.0;
+    p->envelope_mul[v] = 1.0;
+    p->envelope_add[v] = 0.0;
+}
+
+/*
+ Render a block of interleaved frames.  Each voice reads its sample
+ from the decoded head, then from its stream, interpolating between
+ frames at its pitch; taps the prefetcher has not delivered yet read as
+ silence.  Voices run in spans that stop wherever their envelope
+ changes stage, as in WaveTableSynth.
+   TAKES:
+     out      --> float * interleaved output buffer (frames * channels)
+     frames   --> number of frames to render
+     channels --> number of interleaved channels in out
+*/
+void Sampler::render(float *out, unsigned long frames, int channels) {
+    VoicePool *p = this->voices;
+    const int chans = (channels < p->channels) ? channels : p->channels;
+    const int mode = this->interpolation.load(std::memory_order_relaxed);
+    const double frac_one = (double)(1UL << WaveTable::FRAC_BITS);
+    const unsigned long mask = Sampler::RING_FRAMES - 1;
+    const SamplerSample *smp;
+    SamplerStream *s;
+    unsigned long done, avail, span, i;
+    long k, j, first;
+    double position, step;
+    float level, mul, add, x, taps[4];
+    const float *t;
+    bool starved;
+    int v, c;
+    
+    if(this->offline) this->wait_for_streams(frames);
+    memset(out, 0, frames * channels * sizeof(float));
+    for(v = 0; v < p->used; v++) {
+        if(!p->active[v]) continue;
+        s = &this->streams[p->slot[v]];
+        smp = s->sample.load(std::memory_order_relaxed);
+        if(smp == NULL) {
+            this->finish(v);
+            continue;
+        }
+        avail = s->fill.load(std::memory_order_acquire) & Sampler::FRAME_MASK;
+        position = s->position;
+        step = s->step;
+        starved = false;
+        for(done = 0; done < frames && p->active[v]; done += span) {
+            span = frames - done;
+            if((unsigned long)p->envelope_remaining[v] < span) span = p->envelope_remaining[v];
+            level = p->envelope_level[v];
+            mul = p->envelope_mul[v];
+            add = p->envelope_add[v];
+            for(i = done; i < done + span; i++) {
+                k = (long)position;
+                first = k - 1;
+                if(first >= 0 && (unsigned long)(k + 2) < smp->head_frames) {
+                    t = smp->head + k;
+                } else if((unsigned long)first >= smp->head_frames &&
+                          (unsigned long)(k + 2) < avail &&
+                          ((unsigned long)first & mask) <= mask - 3) {
+                    t = s->ring + ((unsigned long)k & mask);
+                } else {
+                    // the taps straddle the head, the ring's wrap or the ends
+                    for(j = 0; j < 4; j++) {
+                        unsigned long f = (unsigned long)(first + j);
+                        if(first + j < 0 || f >= smp->frames) {
+                            taps[j] = 0.0;
+                        } else if(f < smp->head_frames) {
+                            taps[j] = smp->head[f];
+                        } else if(f < avail) {
+                            taps[j] = s->ring[f & mask];
+                        } else {
+                            taps[j] = 0.0;
+                            starved = true;
+                        }
+                    }
+                    t = taps + 1;
+                }
+                x = WaveTable::read(t, (uint32_t)((position - k) * frac_one), mode) * level;
+                level = (level * mul) + add;
+                for(c = 0; c < chans; c++) {
+                    out[(i * channels) + c] += x * p->pan_gain[(c * p->capacity) + v];
+                }
+                position += step;
+            }
+            p->envelope_level[v] = level;
+            this->envelope->elapse(p, v, (int)span);
+            if(position >= smp->frames) this->finish(v); // the sample has run out
+        }
+        s->position = position;
+        if(starved) this->starvations.fetch_add(1, std::memory_order_relaxed);
+        if(!p->active[v]) {
+            this->stop(s);
+        } else {
+            k = (long)position - 1; // the oldest tap the next block reads
+            s->consumed.store(pack(s->generation, (k > 0) ? k : 0),
+                              std::memory_order_release);
+        }
+    }
+    p->compact();
+}
+
+/*
+ Whether a range of the mapping is in the page cache
+*/
+bool Sampler::resident(const unsigned char *addr, unsigned long len) {
+    const unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+    const unsigned char *start = (const unsigned char*)((uintptr_t)addr & ~(uintptr_t)(page - 1));
+    unsigned long pages = ((addr + len - start) + page - 1) / page;
+    
+    this->residency.resize(pages);
+#ifdef __APPLE__
+    if(mincore((void*)start, addr + len - start, (char*)&this->residency[0]) != 0) return true;
+#else
+    if(mincore((void*)start, addr + len - start, &this->residency[0]) != 0) return true;
+#endif
+    for(unsigned long i = 0; i < pages; i++) {
+        if((this->residency[i] & 1) == 0) return false;
+    }
+    return true;
+}
+
+/*
+ Stream one chunk of a note into its ring, if there is room
+   TAKES:
+     s --> SamplerStream * to fill
+   RETURNS:
+     bool true if a chunk was published
+*/
+bool Sampler::prefetch(SamplerStream *s) {
+    uint64_t fill = s->fill.load(std::memory_order_acquire);
+    const uint64_t generation = fill >> Sampler::GENERATION_SHIFT;
+    const unsigned long f = fill & Sampler::FRAME_MASK;
+    const SamplerSample *smp = s->sample.load(std::memory_order_acquire);
+    uint64_t consumed;
+    unsigned long limit, n, first, run, ahead;
+    const unsigned char *src;
+    
+    if(smp == NULL) return false;
+    consumed = s->consumed.load(std::memory_order_acquire);
+    if((consumed >> Sampler::GENERATION_SHIFT) != generation) return false;
+    limit = (consumed & Sampler::FRAME_MASK) + Sampler::RING_FRAMES;
+    if(limit > smp->frames) limit = smp->frames;
+    if(f >= limit) return false;
+    n = ((limit - f) < (unsigned long)Sampler::PREFETCH_CHUNK) ? limit - f :
+        Sampler::PREFETCH_CHUNK;
+    src = smp->data + (f * smp->frame_bytes);
+    if(this->resident(src, n * smp->frame_bytes)) {
+        this->hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        this->misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    first = f & (Sampler::RING_FRAMES - 1);
+    run = ((unsigned long)Sampler::RING_FRAMES - first < n) ? Sampler::RING_FRAMES - first : n;
+    Sampler::decode(smp, f, run, s->ring + first);
+    if(run < n) Sampler::decode(smp, f + run, n - run, s->ring);
+    // have the kernel read on ahead while the voice plays this chunk
+    src += n * smp->frame_bytes;
+    ahead = (unsigned long)Sampler::READAHEAD_CHUNKS * Sampler::PREFETCH_CHUNK * smp->frame_bytes;
+    if(src + ahead > smp->map + smp->map_size) ahead = smp->map + smp->map_size - src;
+    if(ahead > 0) {
+        const unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+        const unsigned char *start = (const unsigned char*)((uintptr_t)src & ~(uintptr_t)(page - 1));
+        madvise((void*)start, src + ahead - start, MADV_WILLNEED);
+    }
+    // publish, unless the voice has moved on to another note meanwhile
+    return s->fill.compare_exchange_strong(fill, pack(generation, f + n),
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed);
+}
+
+/*
+ Prefetch thread: tops up every stream a chunk at a time, round robin,
+ so the notes nearest starving are served first, then sleeps
+*/
+void Sampler::prefetch_loop() {
+    std::unique_lock<std::mutex> lock(this->prefetch_mutex);
+    bool progress;
+    
+    while(!this->prefetch_quit) {
+        this->prefetch_wake = false;
+        lock.unlock();
+        do {
+            progress = false;
+            for(int i = 0; i < this->num_streams; i++) {
+                progress |= this->prefetch(&this->streams[i]);
+            }
+        } while(progress);
+        lock.lock();
+        this->prefetch_cond.notify_all(); // offline renderers recheck
+        if(this->prefetch_quit || this->prefetch_wake) continue;
+        this->prefetch_cond.wait_for(lock, std::chrono::milliseconds(Sampler::PREFETCH_MS));
+    }
+}
+
+/*
+ Block until every sounding voice's stream holds the frames the next
+ block reads.  Offline only: the audio thread never waits on the disk.
+   TAKES:
+     frames --> unsigned long frames about to be rendered
+*/
+void Sampler::wait_for_streams(unsigned long frames) {
+    std::unique_lock<std::mutex> lock(this->prefetch_mutex);
+    VoicePool *p = this->voices;
+    const SamplerSample *smp;
+    SamplerStream *s;
+    unsigned long need, limit;
+    
+    for(int v = 0; v < p->used; v++) {
+        s = &this->streams[p->slot[v]];
+        smp = s->sample.load(std::memory_order_relaxed);
+        if(!p->active[v] || smp == NULL) continue;
+        need = (unsigned long)(s->position + (s->step * frames)) + 3;
+        // never more than the prefetcher may stream ahead
+        limit = (s->consumed.load(std::memory_order_relaxed) & Sampler::FRAME_MASK) +
+                Sampler::RING_FRAMES;
+        if(need > limit) need = limit;
+        if(need > smp->frames) need = smp->frames;
+        while((s->fill.load(std::memory_order_acquire) & Sampler::FRAME_MASK) < need) {
+            this->prefetch_wake = true;
+            this->prefetch_cond.notify_all();
+            this->prefetch_cond.wait(lock);
+        }
+    }
+}
+
+/*
+ Select how samples are interpolated.  Safe to call from any thread;
+ takes effect at the next buffer.
+   TAKES:
+     mode --> int WaveTable::INTERP_TRUNCATE, INTERP_LINEAR or INTERP_CUBIC
+*/
+void Sampler::set_interpolation(int mode) {
+    if(mode < WaveTable::INTERP_TRUNCATE || mode > WaveTable::INTERP_CUBIC) return;
+    this->interpolation.store(mode, std::memory_order_relaxed);
+}
+
+/*
+ Current interpolation mode
+*/
+int Sampler::get_interpolation() {
+    return this->interpolation.load(std::memory_order_relaxed);
+}
+
+/*
+ Have render() wait for the disk instead of playing silence when a
+ stream falls behind.  For offline renders, which outrun the prefetch
+ thread; never for live playback.  Not safe while the instrument is
+ being rendered.
+   TAKES:
+     offline --> bool true to wait
+*/
+void Sampler::set_offline(bool offline) {
+    this->offline = offline;
+}
+
+/*
+ Prefetch reads whose data was already in the page cache
+*/
+unsigned long Sampler::get_cache_hits() {
+    return this->hits.load(std::memory_order_relaxed);
+}
+
+/*
+ Prefetch reads that had to wait for the disk
+*/
+unsigned long Sampler::get_cache_misses() {
+    return this->misses.load(std::memory_order_relaxed);
+}
+
+/*
+ Blocks in which a voice caught up with its stream and played silence
+*/
+unsigned long Sampler::get_starvations() {
+    return this->starvations.load(std::memory_order_relaxed);
+}
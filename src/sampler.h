@@ -0,0 +1,137 @@
+//
+//  sampler.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef sampler_h
+#define sampler_h
+
+#include "instrument.h"
+#include "midifile.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class SamplerConstants {
+public:
+    static const int HEAD_FRAMES = 16384;   // decoded into memory at load
+    static const int RING_FRAMES = 32768;   // streamed ahead per voice, power of 2
+    static const int PREFETCH_CHUNK = 4096; // frames decoded per read
+    static const int READAHEAD_CHUNKS = 4;  // asked of the page cache ahead
+    static const int PREFETCH_MS = 5;
+    static const int NUM_KEYS = 128;        // MIDI keys a library can map
+    // SAMPLE ENCODINGS
+    static const int ENCODING_PCM16 = 0;
+    static const int ENCODING_PCM24 = 1;
+    static const int ENCODING_PCM32 = 2;
+    static const int ENCODING_FLOAT32 = 3;
+    // stream positions are packed with the generation of the note they
+    // belong to, so the prefetcher can never publish for a stolen voice
+    static const int GENERATION_SHIFT = 40;
+    static const uint64_t FRAME_MASK = (1ULL << 40) - 1;
+};
+
+/*
+ One WAV file of a library, memory-mapped.  The first HEAD_FRAMES are
+ decoded to mono floats at load, so a note can start at once; the rest
+ is read from the mapping by the prefetch thread.
+*/
+struct SamplerSample {
+    std::string path;
+    int fd;
+    const unsigned char *map; // whole file, read only
+    unsigned long map_size;
+    const unsigned char *data; // first frame, inside map
+    unsigned long frames;
+    int channels;
+    int sample_rate;
+    int encoding;
+    int frame_bytes;
+    int root; // MIDI key recorded
+    int low, high; // MIDI keys it plays, or -1 to take the nearest
+    float *head;
+    unsigned long head_frames;
+};
+
+/*
+ Per voice stream: a ring of decoded frames beyond the sample's head.
+ The audio thread owns the note (sample, position, generation); the
+ prefetcher owns the ring contents and advances fill.  Frames
+ [head_frames, fill) are in the ring, and the prefetcher never writes
+ more than RING_FRAMES past consumed.
+*/
+struct SamplerStream {
+    std::atomic<const SamplerSample*> sample;
+    std::atomic<uint64_t> fill;     // generation | first frame not yet streamed
+    std::atomic<uint64_t> consumed; // generation | first frame still needed
+    float *ring;
+    // audio thread only
+    uint64_t generation;
+    double position; // frames into the sample
+    double step;     // frames per output frame
+};
+
+/*
+ Class Sampler:
+   Plays a multi-sample library of WAV files, each mapped to a range of
+   keys, and pitch-shifted from its root key by interpolated playback.
+   Libraries may be far larger than memory: only each sample's head is
+   held decoded, and a prefetch thread streams the rest of every
+   sounding note from the mapped file into its voice's ring.  A
+   voice that catches up with its stream plays silence until the data
+   arrives and counts a starvation; prefetch reads are counted as page
+   cache hits or misses.  Voices are mono, placed by the usual pan and
+   spread; stereo samples are mixed down.
+*/
+class Sampler : public Instrument, public SamplerConstants {
+    std::vector<SamplerSample*> samples;
+    int keys[Sampler::NUM_KEYS]; // sample index per MIDI key, or -1
+    SamplerStream *streams; // one per voice slot, [0, voices->size)
+    int num_streams;
+    std::atomic<int> interpolation; // WaveTable::INTERP_* mode
+    // counters
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> starvations;
+    // prefetch thread
+    std::thread prefetcher;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cond;
+    bool prefetch_quit;
+    bool prefetch_wake; // a renderer is waiting for data
+    bool offline;
+    std::vector<unsigned char> residency; // mincore results
+    void prefetch_loop();
+    bool prefetch(SamplerStream*);
+    void wait_for_streams(unsigned long);
+    // helper method(s)
+    void map_keys();
+    void stop(SamplerStream*);
+    void finish(int);
+    bool resident(const unsigned char*, unsigned long);
+    static void decode(const SamplerSample*, unsigned long, unsigned long, float*);
+public:
+    Sampler(int num_channels=2, int num_v=Instrument::DEFAULT_NUM_VOICES);
+    ~Sampler();
+    int load(const char*);
+    int add_sample(const char*, int, int low=-1, int high=-1);
+    int num_samples();
+    // Instrument abstract interface overrides
+    void trigger_template(const int);
+    void render(float*, unsigned long, int);
+    void set_interpolation(int);
+    int get_interpolation();
+    void set_offline(bool);
+    unsigned long get_cache_hits();
+    unsigned long get_cache_misses();
+    unsigned long get_starvations();
+};
+
+#endif /* sampler_h */
@@ -7,28 +7,167 @@
 //
 
 #include "voice.h"
+#include <stdlib.h>
+#include <string.h>
 
-Voice::Voice() {
-    this->triggered = false;
-    this->envelope_pos = 0;
+/*
+ VoicePool constructor: every array is carved from one aligned block
+   TAKES:
+     voices   --> int number of voices
+     channels --> int output channels each voice is placed in
+*/
+VoicePool::VoicePool(int voices, int channels) {
+    size_t row, bytes;
+    char *p;
+    
+    this->size = voices;
+    this->channels = channels;
+    this->used = 0;
+    this->serial = 0;
+    this->capacity = ((voices + VoicePool::PAD_VOICES - 1) / VoicePool::PAD_VOICES) *
+                     VoicePool::PAD_VOICES;
+    row = this->capacity * 4; // bytes in one 32-bit array, a multiple of CACHE_LINE
+    bytes = row * (13 + channels);
+    if(posix_memalign(&(this->block), VoicePool::CACHE_LINE, bytes) != 0) {
+        this->block = NULL;
+        this->size = this->capacity = 0;
+        bytes = 0;
+    }
+    if(bytes > 0) memset(this->block, 0, bytes);
+    p = (char*)this->block;
+    this->active = (uint8_t*)p; p += row; // only capacity bytes used
+    this->envelope_stage = (int32_t*)p; p += row;
+    this->envelope_remaining = (int32_t*)p; p += row;
+    this->envelope_level = (float*)p; p += row;
+    this->envelope_mul = (float*)p; p += row;
+    this->envelope_add = (float*)p; p += row;
+    this->gain = (float*)p; p += row;
+    this->note = (int32_t*)p; p += row;
+    this->started = (uint32_t*)p; p += row;
+    this->increment = (uint32_t*)p; p += row;
+    this->table_offset = (int32_t*)p; p += row;
+    this->phase = (uint32_t*)p; p += row;
+    this->slot = (int32_t*)p; p += row;
+    this->pan_gain = (float*)p;
+    for(int v = 0; v < this->capacity; v++) this->slot[v] = v;
+    for(int v = 0; v < this->size; v++) {
+        this->gain[v] = 1.0;
+        for(int c = 0; c < channels; c++) this->pan_gain[(c * this->capacity) + v] = 1.0;
+    }
 }
 
-void Voice::advance(int envelope_len) {
-    // advance envelope position
-    if(this->triggered) {
-        if(this->envelope_pos >= envelope_len) {
-            this->triggered = false;
-            this->envelope_pos = 0;
-        } else {
-            this->envelope_pos++;
-        }
+/*
+ VoicePool destructor
+*/
+VoicePool::~VoicePool() {
+    free(this->block);
+}
+
+/*
+ Take the next free voice
+   RETURNS:
+     int voice index, or -1 when every voice is in use
+*/
+int VoicePool::allocate() {
+    if(this->used >= this->size) return -1;
+    return this->used++;
+}
+
+/*
+ Mark a voice as playing a note, from phase zero.  The caller starts its
+ envelope and places it.
+   TAKES:
+     v    --> int voice index, from allocate() or a voice being stolen
+     note --> int note constant
+*/
+void VoicePool::start(int v, int note) {
+    this->active[v] = 1;
+    this->note[v] = note;
+    this->started[v] = this->serial++;
+    this->phase[v] = 0;
+}
+
+bool VoicePool::is_triggered(int v) {
+    return this->active[v] != 0;
+}
+
+/*
+ Number of voices currently sounding
+*/
+int VoicePool::count_active() {
+    int n = 0;
+    for(int v = 0; v < this->used; v++) n += this->active[v];
+    return n;
+}
+
+/*
+ Sounding voice playing a note
+   RETURNS:
+     int voice index, or -1
+*/
+int VoicePool::find_note(int note) {
+    for(int v = 0; v < this->used; v++) {
+        if(this->active[v] && this->note[v] == note) return v;
     }
+    return -1;
 }
 
-void Voice::trigger() {
-    this->triggered = true;
+/*
+ Sounding voice started longest ago
+   RETURNS:
+     int voice index, or -1
+*/
+int VoicePool::oldest() {
+    int best = -1;
+    for(int v = 0; v < this->used; v++) {
+        // serials wrap, so compare ages rather than serials
+        if(this->active[v] && (best < 0 || (this->serial - this->started[v]) >
+                                           (this->serial - this->started[best]))) {
+            best = v;
+        }
+    }
+    return best;
 }
 
-bool Voice::is_triggered() {
-    return this->triggered;
+/*
+ Swap-remove finished voices so the ones sounding stay packed at the
+ front.  Moves every array, pan gains included; slots are exchanged so
+ the finished voice's slot is handed out again by allocate().
+*/
+void VoicePool::compact() {
+    int v = 0, last, c;
+    int32_t slot;
+    
+    while(v < this->used) {
+        if(this->active[v]) {
+            v++;
+            continue;
+        }
+        last = --this->used;
+        if(v == last) break;
+        this->active[v] = this->active[last];
+        this->envelope_stage[v] = this->envelope_stage[last];
+        this->envelope_remaining[v] = this->envelope_remaining[last];
+        this->envelope_level[v] = this->envelope_level[last];
+        this->envelope_mul[v] = this->envelope_mul[last];
+        this->envelope_add[v] = this->envelope_add[last];
+        this->gain[v] = this->gain[last];
+        this->note[v] = this->note[last];
+        this->started[v] = this->started[last];
+        this->increment[v] = this->increment[last];
+        this->table_offset[v] = this->table_offset[last];
+        this->phase[v] = this->phase[last];
+        slot = this->slot[v];
+        this->slot[v] = this->slot[last];
+        this->slot[last] = slot;
+        for(c = 0; c < this->channels; c++) {
+            this->pan_gain[(c * this->capacity) + v] =
+                this->pan_gain[(c * this->capacity) + last];
+        }
+        this->active[last] = 0;
+        // allocate() hands out silent voices
+        this->envelope_level[last] = 0.0;
+        this->envelope_mul[last] = 1.0;
+        this->envelope_add[last] = 0.0;
+    }
 }
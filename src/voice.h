@@ -9,17 +9,64 @@
 #ifndef voice_h
 #define voice_h
 
-// Voice base class
-class Voice {
-    bool triggered;
+#include <stdint.h>
+
+class VoicePoolConstants {
+public:
+    static const int CACHE_LINE = 64;
+    // arrays are padded to a whole number of cache lines of floats, which
+    // is also a whole number of lane groups for every render kernel
+    static const int PAD_VOICES = CACHE_LINE / sizeof(float);
+};
+
+/*
+ Class VoicePool:
+   Per voice state for an instrument, held as parallel arrays (structure
+   of arrays) in one cache-line-aligned block allocated at construction.
+   Voice v is index v of every array; arrays run to capacity.  Voices in
+   use are kept packed at the front, indices [0, used), so a renderer only
+   walks the notes actually sounding; voices that finish are swap-removed
+   by compact().  Indices are therefore not stable across compact().
+   Each voice runs one mono oscillator; pan_gain places it in the output
+   channels, one contiguous row per channel.
+*/
+class VoicePool : public VoicePoolConstants {
+    void *block;
 public:
-    // attributes
-    int envelope_pos;
-    // methods
-    Voice();
-    void advance(int);
-    void trigger();
-    bool is_triggered();
+    int size;     // voices
+    int capacity; // size rounded up to PAD_VOICES
+    int channels;
+    int used;     // voices [0, used) were started and not yet compacted away
+    uint32_t serial; // start order, for stealing the oldest
+    // envelope, run by Envelope
+    uint8_t *active;
+    int32_t *envelope_stage;
+    int32_t *envelope_remaining; // samples left in the stage
+    float *envelope_level; // scaled by gain
+    float *envelope_mul;   // level = (level * mul) + add, each sample
+    float *envelope_add;
+    float *gain;
+    int32_t *note;
+    uint32_t *started; // serial at start
+    // oscillator
+    uint32_t *phase; // fixed point
+    uint32_t *increment;
+    int32_t *table_offset;
+    // instrument state kept outside the pool, e.g. a sampler's stream;
+    // swapped rather than copied by compact(), so it stays a permutation
+    // of [0, capacity) and every voice owns a distinct slot
+    int32_t *slot;
+    // placement
+    float *pan_gain; // [channel * capacity + voice]
+    VoicePool(int, int);
+    ~VoicePool();
+    int allocate();
+    void start(int, int);
+    bool is_triggered(int);
+    int count_active();
+    int find_note(int);
+    int oldest();
+    void compact();
 };
 
-#endif /* voice_h */
\ No newline at end of file
+#endif /* voice_h */
@@ -0,0 +1,330 @@
+//
+//  voicekernel.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+// The scalar references must round exactly like the vector kernels, which
+// never fuse a multiply into an add.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+#include "voicekernel.h"
+#include "wavetable.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VOICEKERNEL_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VOICEKERNEL_NEON 1
+#endif
+
+/*
+ Scalar reference: LANES voices stepped together, lane by lane, in the
+ same order of operations as the vector kernels.  Every loop here is
+ instantiated once per interpolation MODE, so the inner loop never
+ branches on configuration; VoiceKernel::run holds one per mode.
+*/
+template<int LANES, int MODE>
+static void scalar_loop(const float *levels, const int32_t *offsets, uint32_t *phases,
+                        const uint32_t *incs, float *env,
+                        const float *env_mul, const float *env_add,
+                        float *out, int frames) {
+    uint32_t ph[LANES];
+    float e[LANES];
+    const float *p;
+    float f, s, c1, c2, c3;
+    int i, l;
+
+    for(l = 0; l < LANES; l++) {
+        ph[l] = phases[l];
+        e[l] = env[l];
+    }
+    for(i = 0; i < frames; i++) {
+        for(l = 0; l < LANES; l++) {
+            p = levels + offsets[l] + (int32_t)(ph[l] >> WaveTable::FRAC_BITS);
+            f = (float)(int32_t)(ph[l] & WaveTable::FRAC_MASK) * WaveTable::FRAC_SCALE;
+            if(MODE == WaveTable::INTERP_TRUNCATE) {
+                s = p[0];
+            } else if(MODE == WaveTable::INTERP_LINEAR) {
+                s = p[0] + (f * (p[1] - p[0]));
+            } else {
+                c1 = 0.5f * (p[1] - p[-1]);
+                c2 = ((p[-1] - (2.5f * p[0])) + (2.0f * p[1])) - (0.5f * p[2]);
+                c3 = (0.5f * (p[2] - p[-1])) + (1.5f * (p[0] - p[1]));
+                s = (((((c3 * f) + c2) * f) + c1) * f) + p[0];
+            }
+            out[(i * LANES) + l] = s * e[l];
+            e[l] = (e[l] * env_mul[l]) + env_add[l];
+            ph[l] += incs[l];
+        }
+    }
+    for(l = 0; l < LANES; l++) {
+        phases[l] = ph[l];
+        env[l] = e[l];
+    }
+}
+
+
+#ifdef VOICEKERNEL_X86
+/*
+ SSE2, 4 lanes.  SSE2 has no gather, so table reads are four scalar loads.
+*/
+static inline __m128 sse2_gather(const float *t, const int32_t *idx, int d) {
+    return _mm_setr_ps(t[idx[0] + d], t[idx[1] + d], t[idx[2] + d], t[idx[3] + d]);
+}
+
+template<int MODE>
+static void sse2_loop(const float *levels, const int32_t *offsets, uint32_t *phases,
+                      const uint32_t *incs, float *env,
+                      const float *env_mul, const float *env_add,
+                      float *out, int frames) {
+    __m128i ph = _mm_loadu_si128((const __m128i*)phases);
+    const __m128i inc = _mm_loadu_si128((const __m128i*)incs);
+    const __m128i off = _mm_loadu_si128((const __m128i*)offsets);
+    const __m128i mask = _mm_set1_epi32(WaveTable::FRAC_MASK);
+    const __m128 scale = _mm_set1_ps(WaveTable::FRAC_SCALE);
+    const __m128 mul = _mm_loadu_ps(env_mul);
+    const __m128 add = _mm_loadu_ps(env_add);
+    __m128 e = _mm_loadu_ps(env);
+    __m128 f, s, p0, p1, pm1, p2, c1, c2, c3;
+    int32_t idx[4] __attribute__((aligned(16)));
+    int i;
+
+    for(i = 0; i < frames; i++) {
+        _mm_store_si128((__m128i*)idx,
+                        _mm_add_epi32(off, _mm_srli_epi32(ph, WaveTable::FRAC_BITS)));
+        p0 = sse2_gather(levels, idx, 0);
+        if(MODE == WaveTable::INTERP_TRUNCATE) {
+            s = p0;
+        } else {
+            f = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(ph, mask)), scale);
+            p1 = sse2_gather(levels, idx, 1);
+            if(MODE == WaveTable::INTERP_LINEAR) {
+                s = _mm_add_ps(p0, _mm_mul_ps(f, _mm_sub_ps(p1, p0)));
+            } else {
+                pm1 = sse2_gather(levels, idx, -1);
+                p2 = sse2_gather(levels, idx, 2);
+                c1 = _mm_mul_ps(_mm_set1_ps(0.5f), _mm_sub_ps(p1, pm1));
+                c2 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(pm1, _mm_mul_ps(_mm_set1_ps(2.5f), p0)),
+                                           _mm_mul_ps(_mm_set1_ps(2.0f), p1)),
+                                _mm_mul_ps(_mm_set1_ps(0.5f), p2));
+                c3 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.5f), _mm_sub_ps(p2, pm1)),
+                                _mm_mul_ps(_mm_set1_ps(1.5f), _mm_sub_ps(p0, p1)));
+                s = _mm_add_ps(_mm_mul_ps(c3, f), c2);
+                s = _mm_add_ps(_mm_mul_ps(s, f), c1);
+                s = _mm_add_ps(_mm_mul_ps(s, f), p0);
+            }
+        }
+        _mm_storeu_ps(out + (i * 4), _mm_mul_ps(s, e));
+        e = _mm_add_ps(_mm_mul_ps(e, mul), add);
+        ph = _mm_add_epi32(ph, inc);
+    }
+    _mm_storeu_si128((__m128i*)phases, ph);
+    _mm_storeu_ps(env, e);
+}
+
+
+/*
+ AVX2, 8 lanes, with hardware gathers.  Compiled for AVX2 regardless of
+ the build flags and only called when the CPU reports it.
+*/
+template<int MODE>
+__attribute__((target("avx2")))
+static void avx2_loop(const float *levels, const int32_t *offsets, uint32_t *phases,
+                      const uint32_t *incs, float *env,
+                      const float *env_mul, const float *env_add,
+                      float *out, int frames) {
+    __m256i ph = _mm256_loadu_si256((const __m256i*)phases);
+    const __m256i inc = _mm256_loadu_si256((const __m256i*)incs);
+    const __m256i off = _mm256_loadu_si256((const __m256i*)offsets);
+    const __m256i mask = _mm256_set1_epi32(WaveTable::FRAC_MASK);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 scale = _mm256_set1_ps(WaveTable::FRAC_SCALE);
+    const __m256 mul = _mm256_loadu_ps(env_mul);
+    const __m256 add = _mm256_loadu_ps(env_add);
+    __m256 e = _mm256_loadu_ps(env);
+    __m256 f, s, p0, p1, pm1, p2, c1, c2, c3;
+    __m256i idx;
+    int i;
+
+    for(i = 0; i < frames; i++) {
+        idx = _mm256_add_epi32(off, _mm256_srli_epi32(ph, WaveTable::FRAC_BITS));
+        p0 = _mm256_i32gather_ps(levels, idx, 4);
+        if(MODE == WaveTable::INTERP_TRUNCATE) {
+            s = p0;
+        } else {
+            f = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(ph, mask)), scale);
+            p1 = _mm256_i32gather_ps(levels, _mm256_add_epi32(idx, one), 4);
+            if(MODE == WaveTable::INTERP_LINEAR) {
+                s = _mm256_add_ps(p0, _mm256_mul_ps(f, _mm256_sub_ps(p1, p0)));
+            } else {
+                pm1 = _mm256_i32gather_ps(levels, _mm256_sub_epi32(idx, one), 4);
+                p2 = _mm256_i32gather_ps(levels, _mm256_add_epi32(idx, _mm256_add_epi32(one, one)), 4);
+                c1 = _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_sub_ps(p1, pm1));
+                c2 = _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(pm1, _mm256_mul_ps(_mm256_set1_ps(2.5f), p0)),
+                                                 _mm256_mul_ps(_mm256_set1_ps(2.0f), p1)),
+                                   _mm256_mul_ps(_mm256_set1_ps(0.5f), p2));
+                c3 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_sub_ps(p2, pm1)),
+                                   _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(p0, p1)));
+                s = _mm256_add_ps(_mm256_mul_ps(c3, f), c2);
+                s = _mm256_add_ps(_mm256_mul_ps(s, f), c1);
+                s = _mm256_add_ps(_mm256_mul_ps(s, f), p0);
+            }
+        }
+        _mm256_storeu_ps(out + (i * 8), _mm256_mul_ps(s, e));
+        e = _mm256_add_ps(_mm256_mul_ps(e, mul), add);
+        ph = _mm256_add_epi32(ph, inc);
+    }
+    _mm256_storeu_si256((__m256i*)phases, ph);
+    _mm256_storeu_ps(env, e);
+}
+
+#endif /* VOICEKERNEL_X86 */
+
+#ifdef VOICEKERNEL_NEON
+/*
+ NEON, 4 lanes.  Like SSE2 there is no gather; lanes are loaded one at a
+ time.  Multiplies and adds are kept separate (no vmla/vfma) to match the
+ scalar reference.
+*/
+static inline float32x4_t neon_gather(const float *t, const int32_t *idx, int d) {
+    float g[4] = {t[idx[0] + d], t[idx[1] + d], t[idx[2] + d], t[idx[3] + d]};
+    return vld1q_f32(g);
+}
+
+template<int MODE>
+static void neon_loop(const float *levels, const int32_t *offsets, uint32_t *phases,
+                      const uint32_t *incs, float *env,
+                      const float *env_mul, const float *env_add,
+                      float *out, int frames) {
+    uint32x4_t ph = vld1q_u32(phases);
+    const uint32x4_t inc = vld1q_u32(incs);
+    const int32x4_t off = vld1q_s32(offsets);
+    const uint32x4_t mask = vdupq_n_u32(WaveTable::FRAC_MASK);
+    const float32x4_t scale = vdupq_n_f32(WaveTable::FRAC_SCALE);
+    const float32x4_t mul = vld1q_f32(env_mul);
+    const float32x4_t add = vld1q_f32(env_add);
+    float32x4_t e = vld1q_f32(env);
+    float32x4_t f, s, p0, p1, pm1, p2, c1, c2, c3;
+    int32_t idx[4];
+    int i;
+
+    for(i = 0; i < frames; i++) {
+        vst1q_s32(idx, vaddq_s32(off, vreinterpretq_s32_u32(
+                                          vshrq_n_u32(ph, WaveTable::FRAC_BITS))));
+        p0 = neon_gather(levels, idx, 0);
+        if(MODE == WaveTable::INTERP_TRUNCATE) {
+            s = p0;
+        } else {
+            f = vmulq_f32(vcvtq_f32_u32(vandq_u32(ph, mask)), scale);
+            p1 = neon_gather(levels, idx, 1);
+            if(MODE == WaveTable::INTERP_LINEAR) {
+                s = vaddq_f32(p0, vmulq_f32(f, vsubq_f32(p1, p0)));
+            } else {
+                pm1 = neon_gather(levels, idx, -1);
+                p2 = neon_gather(levels, idx, 2);
+                c1 = vmulq_f32(vdupq_n_f32(0.5f), vsubq_f32(p1, pm1));
+                c2 = vsubq_f32(vaddq_f32(vsubq_f32(pm1, vmulq_f32(vdupq_n_f32(2.5f), p0)),
+                                         vmulq_f32(vdupq_n_f32(2.0f), p1)),
+                               vmulq_f32(vdupq_n_f32(0.5f), p2));
+                c3 = vaddq_f32(vmulq_f32(vdupq_n_f32(0.5f), vsubq_f32(p2, pm1)),
+                               vmulq_f32(vdupq_n_f32(1.5f), vsubq_f32(p0, p1)));
+                s = vaddq_f32(vmulq_f32(c3, f), c2);
+                s = vaddq_f32(vmulq_f32(s, f), c1);
+                s = vaddq_f32(vmulq_f32(s, f), p0);
+            }
+        }
+        vst1q_f32(out + (i * 4), vmulq_f32(s, e));
+        e = vaddq_f32(vmulq_f32(e, mul), add);
+        ph = vaddq_u32(ph, inc);
+    }
+    vst1q_u32(phases, ph);
+    vst1q_f32(env, e);
+}
+
+#endif /* VOICEKERNEL_NEON */
+
+/*
+ Kernel record with one loop instantiation per interpolation mode
+*/
+static VoiceKernel make_kernel(const char *name, int lanes, VoiceKernel::Run truncate,
+                               VoiceKernel::Run linear, VoiceKernel::Run cubic) {
+    VoiceKernel k;
+    k.name = name;
+    k.lanes = lanes;
+    k.run[WaveTable::INTERP_TRUNCATE] = truncate;
+    k.run[WaveTable::INTERP_LINEAR] = linear;
+    k.run[WaveTable::INTERP_CUBIC] = cubic;
+    return k;
+}
+
+/*
+ Scalar reference kernel
+   TAKES:
+     lanes --> int 4 or 8, the width of the kernel it stands in for
+*/
+VoiceKernel VoiceKernel::reference(int lanes) {
+    if(lanes == 8) {
+        return make_kernel("scalar", 8,
+                           scalar_loop<8, WaveTable::INTERP_TRUNCATE>,
+                           scalar_loop<8, WaveTable::INTERP_LINEAR>,
+                           scalar_loop<8, WaveTable::INTERP_CUBIC>);
+    }
+    return make_kernel("scalar", 4,
+                       scalar_loop<4, WaveTable::INTERP_TRUNCATE>,
+                       scalar_loop<4, WaveTable::INTERP_LINEAR>,
+                       scalar_loop<4, WaveTable::INTERP_CUBIC>);
+}
+
+/*
+ Every kernel this CPU can run, fastest first; the scalar reference is
+ always last
+   TAKES:
+     list --> VoiceKernel * room for MAX_KERNELS
+   RETURNS:
+     int number of kernels written
+*/
+int VoiceKernel::available(VoiceKernel *list) {
+    int n = 0;
+
+#ifdef VOICEKERNEL_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        list[n++] = make_kernel("avx2", 8,
+                                avx2_loop<WaveTable::INTERP_TRUNCATE>,
+                                avx2_loop<WaveTable::INTERP_LINEAR>,
+                                avx2_loop<WaveTable::INTERP_CUBIC>);
+    }
+    if(__builtin_cpu_supports("sse2")) {
+        list[n++] = make_kernel("sse2", 4,
+                                sse2_loop<WaveTable::INTERP_TRUNCATE>,
+                                sse2_loop<WaveTable::INTERP_LINEAR>,
+                                sse2_loop<WaveTable::INTERP_CUBIC>);
+    }
+#endif
+#ifdef VOICEKERNEL_NEON
+    list[n++] = make_kernel("neon", 4,
+                            neon_loop<WaveTable::INTERP_TRUNCATE>,
+                            neon_loop<WaveTable::INTERP_LINEAR>,
+                            neon_loop<WaveTable::INTERP_CUBIC>);
+#endif
+    list[n++] = VoiceKernel::reference(4);
+    return n;
+}
+
+/*
+ Fastest kernel for this CPU, chosen at run time
+*/
+VoiceKernel VoiceKernel::best() {
+    VoiceKernel list[VoiceKernel::MAX_KERNELS];
+    VoiceKernel::available(list);
+    return list[0];
+}
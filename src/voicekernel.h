@@ -0,0 +1,53 @@
+//
+//  voicekernel.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef voicekernel_h
+#define voicekernel_h
+
+#include <stdint.h>
+
+class VoiceKernelConstants {
+public:
+    static const int MAX_LANES = 8;        // widest kernel, voice arrays pad to this
+    static const int KERNEL_FRAMES = 256;  // frames per accumulator pass
+    static const int MAX_KERNELS = 4;
+    static const int NUM_MODES = 3;        // WaveTable::INTERP_* modes
+};
+
+/*
+ Class VoiceKernel:
+   Oscillator inner loop that renders a group of voices side by side, one
+   voice per vector lane: phase advance, table lookup (truncated, linear or
+   cubic) and envelope multiply-add.  Lane l of frame i is stored, mono,
+   to out[(i * lanes) + l]; the caller pans the lanes into its channels.
+   A kernel holds one loop per interpolation mode, each compiled with the
+   mode fixed, so callers pick a loop once instead of branching per call.
+   Every SIMD kernel has a scalar reference of the same lane width that
+   performs the same float operations in the same order, so their output
+   is bit-exact.  Kernels never use fused multiply-add for that reason.
+*/
+class VoiceKernel : public VoiceKernelConstants {
+public:
+    typedef void (*Run)(const float *levels,   // WaveTable::levels
+                        const int32_t *offsets, // per lane level offset
+                        uint32_t *phases,       // per lane, advanced in place
+                        const uint32_t *incs,   // per lane phase increment
+                        float *env,             // per lane envelope, advanced in place
+                        const float *env_mul,   // env = (env * mul) + add
+                        const float *env_add,
+                        float *out,             // frames * lanes samples
+                        int frames);
+    const char *name;
+    int lanes;
+    Run run[VoiceKernel::NUM_MODES];           // indexed by WaveTable::INTERP_*
+    static VoiceKernel best();
+    static VoiceKernel reference(int);
+    static int available(VoiceKernel*);
+};
+
+#endif /* voicekernel_h */
@@ -7,11 +7,22 @@
 //
 
 #include "wavetable.h"
+#include "fft.h"
+#include <string.h>
+
+/*
+ Transform shared by every table; FFT keeps no per-call state
+*/
+static FFT &table_fft() {
+    static FFT fft(WaveTable::TABLE_SIZE);
+    return fft;
+}
 
 /*
  WaveTable constructor: make table, populate with pseudo square wave
 */
 WaveTable::WaveTable() {
+    this->levels = new float[WaveTable::NUM_LEVELS * WaveTable::LEVEL_STRIDE];
     this->table = new float[WaveTable::TABLE_SIZE];
     this->harmonic_amplitudes = new int[WaveTable::HIGHEST_HARMONIC]; // for custom synth
     for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
@@ -24,6 +35,7 @@ WaveTable::WaveTable() {
  WaveTable destructor
 */
 WaveTable::~WaveTable() {
+    delete [] this->levels;
     delete [] this->table;
     delete [] this->harmonic_amplitudes;
 }
@@ -32,6 +44,16 @@ WaveTable::~WaveTable() {
  Populate wave table with a sine waveform
 */
 void WaveTable::sine_wave() {
+    this->fill_sine(this->table);
+    this->build_mipmaps();
+}
+
+/*
+ Write one cycle of a sine wave
+   TAKES:
+     dest --> float * TABLE_SIZE samples
+*/
+void WaveTable::fill_sine(float *dest) {
     int x;
     float calculated_sample;
     double sin_input;
@@ -39,66 +61,181 @@ void WaveTable::sine_wave() {
     for(x = 0; x < WaveTable::TABLE_SIZE; x++) {
         sin_input = ((double)x/(double)WaveTable::TABLE_SIZE) * M_PI * 2.0;
         calculated_sample = (float) sin(sin_input);
-        this->table[x] = WaveTable::SINE_MAX_AMP * calculated_sample;
+        dest[x] = WaveTable::SINE_MAX_AMP * calculated_sample;
     }
 }
 
 /*
- Populate wave table with a pseudo square waveform
+ Populate wave table with a pseudo square waveform: flat halves joined
+ by short linear ramps, each 1/40 of the table long.
  */
 void WaveTable::square_wave() {
+    const int n = WaveTable::TABLE_SIZE;
+    const int ramp = n / 40;
+    const int half = n / 2;
     int x;
-    for(x = 0; x < WaveTable::TABLE_SIZE; x++) {
-        if(x < 10) {
-            this->table[x] = (WaveTable::SQUARE_MAX_AMP * (0 + (x * 0.1)));
-        }
-        if(9 < x && x < 190) {
+    
+    for(x = 0; x < n; x++) {
+        if(x < ramp) {
+            this->table[x] = WaveTable::SQUARE_MAX_AMP * ((float)x / ramp);
+        } else if(x < (half - ramp)) {
             this->table[x] = WaveTable::SQUARE_MAX_AMP;
-        }
-        if(189 < x && x < 200) {
-            this->table[x] = (WaveTable::SQUARE_MAX_AMP * (1 - ((x-190) * 0.1)));
-        }
-        if(199 < x && x < 210) {
-            this->table[x] = (WaveTable::SQUARE_MAX_AMP * (0 - ((x-200) * 0.1)));
-        }
-        if(209 < x && x < 390) {
+        } else if(x < (half + ramp)) {
+            this->table[x] = WaveTable::SQUARE_MAX_AMP *
+                             (1 - ((float)(x - (half - ramp)) / ramp));
+        } else if(x < (n - ramp)) {
             this->table[x] = -WaveTable::SQUARE_MAX_AMP;
-        }
-        if(389 < x && x < WaveTable::TABLE_SIZE) {
-            this->table[x] = (WaveTable::SQUARE_MAX_AMP * (-1 + ((x-390) * 0.1)));
+        } else {
+            this->table[x] = WaveTable::SQUARE_MAX_AMP *
+                             (-1 + ((float)(x - (n - ramp)) / ramp));
         }
     }
+    this->build_mipmaps();
 }
 
 /*
- Populate wave table with a custom waveform
+ Populate wave table with a custom waveform: harmonic_amplitudes[x] is the
+ weight of harmonic x + 1 of the true harmonic series, all in sine phase.
+ Weights are normalized so the peak stays within CUSTOM_MAX_AMP.
  */
 void WaveTable::custom_wave() {
+    float amplitudes[WaveTable::HIGHEST_HARMONIC];
     float amplitude_scale = 0.0;
-    float amplitude_total = 0.0;
-    float temp_table[WaveTable::TABLE_SIZE];
-    int target_index;
-    int i, x;
+    int x;
     
-    // set table to reference sine wave
-    this->sine_wave();
-    // add harmonic amplitudes
-    for(i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
-        amplitude_scale += this->harmonic_amplitudes[i];
+    for(x = 0; x < WaveTable::HIGHEST_HARMONIC; x++) {
+        amplitude_scale += this->harmonic_amplitudes[x];
     }
-    // harmonics waveforms are added together, one wavetable index at a time
-    for(i = 0; i < WaveTable::TABLE_SIZE; i++) {
-        for(x = 0; x < (WaveTable::HIGHEST_HARMONIC); x++) {
-            target_index = (int)(i * pow((double)2, x));
-            target_index = target_index % WaveTable::TABLE_SIZE;
-            amplitude_total += this->table[target_index] *
-              (this->harmonic_amplitudes[x] / amplitude_scale) *
-              WaveTable::CUSTOM_MAX_AMP;
-        }
-        temp_table[i] = amplitude_total;
+    for(x = 0; x < WaveTable::HIGHEST_HARMONIC; x++) {
+        amplitudes[x] = (amplitude_scale > 0) ?
+            (this->harmonic_amplitudes[x] / amplitude_scale) *
+            WaveTable::CUSTOM_MAX_AMP : 0.0;
+    }
+    this->set_spectrum(amplitudes, NULL, WaveTable::HIGHEST_HARMONIC);
+}
+
+/*
+ Populate wave table from a spectrum by inverse FFT, O(N log N).  Harmonic
+ h contributes amplitudes[h-1] * sin(2 pi h t + phases[h-1]).
+   TAKES:
+     amplitudes --> const float * peak amplitude of harmonics 1..count
+     phases     --> const float * phase offsets in radians, or NULL for 0
+     count      --> int harmonics given, those above MAX_HARMONIC are dropped
+ */
+void WaveTable::set_spectrum(const float *amplitudes, const float *phases, int count) {
+    const int n = WaveTable::TABLE_SIZE;
+    float re[WaveTable::TABLE_SIZE];
+    float im[WaveTable::TABLE_SIZE];
+    float scale, phase;
+    int h;
+    
+    memset(re, 0, sizeof(re));
+    memset(im, 0, sizeof(im));
+    if(count > WaveTable::MAX_HARMONIC) count = WaveTable::MAX_HARMONIC;
+    // A sin(wt + p) = (A / 2)(sin p - i cos p) e^(iwt) + conjugate
+    for(h = 1; h <= count; h++) {
+        scale = amplitudes[h - 1] * (n / 2);
+        phase = (phases != NULL) ? phases[h - 1] : 0.0;
+        re[h] = scale * sinf(phase);
+        im[h] = -scale * cosf(phase);
+        re[n - h] = re[h];
+        im[n - h] = -im[h];
+    }
+    this->synthesize(re, im);
+    table_fft().inverse(re, im);
+    for(h = 0; h < n; h++) this->table[h] = re[h] / n;
+}
+
+/*
+ Band-limited table for a mipmap level
+   TAKES:
+     level --> int 0 <= level < NUM_LEVELS
+*/
+const float *WaveTable::level(int level) {
+    return this->levels + WaveTable::level_offset(level);
+}
+
+/*
+ Offset of a mipmap level's first entry within levels
+   TAKES:
+     level --> int 0 <= level < NUM_LEVELS
+*/
+int WaveTable::level_offset(int level) {
+    return (level * WaveTable::LEVEL_STRIDE) + 1;
+}
+
+/*
+ Fixed point phase increment for a table increment
+   TAKES:
+     increment --> float table positions advanced per sample
+   RETURNS:
+     uint32_t increment in cycles / 2^32
+*/
+uint32_t WaveTable::phase_increment(float increment) {
+    return (uint32_t)((increment * (double)(1u << WaveTable::FRAC_BITS)) + 0.5);
+}
+
+/*
+ Mipmap level to play a table at a given pitch increment: the smallest
+ level k with increment <= 2^k, so no harmonic can pass Nyquist.
+   TAKES:
+     increment --> float table positions advanced per sample
+*/
+int WaveTable::level_for(float increment) {
+    int level = 0;
+    float limit = 1.0;
+    
+    while(increment > limit && level < (WaveTable::NUM_LEVELS - 1)) {
+        limit *= 2.0;
+        level++;
     }
-    // main wavetable is replaced with data stored in the temporary table
-    for(i = 0; i < WaveTable::TABLE_SIZE; i++) {
-        this->table[i] = temp_table[i];
+    return level;
+}
+
+/*
+ Rebuild the mipmap levels from the full band table by forward FFT
+*/
+void WaveTable::build_mipmaps() {
+    float re[WaveTable::TABLE_SIZE];
+    float im[WaveTable::TABLE_SIZE];
+    
+    memcpy(re, this->table, sizeof(re));
+    memset(im, 0, sizeof(im));
+    table_fft().forward(re, im);
+    this->synthesize(re, im);
+}
+
+/*
+ Write every mipmap level from one spectrum of the table.  Level
+ k keeps the harmonics h with h * 2^k below Nyquist (TABLE_SIZE / 2).
+   TAKES:
+     spec_re --> const float * TABLE_SIZE bins, real parts (unscaled)
+     spec_im --> const float * TABLE_SIZE bins, imaginary parts
+*/
+void WaveTable::synthesize(const float *spec_re, const float *spec_im) {
+    const int n = WaveTable::TABLE_SIZE;
+    const int nyquist = n / 2;
+    const float norm = 1.0 / n;
+    float re[WaveTable::TABLE_SIZE];
+    float im[WaveTable::TABLE_SIZE];
+    float *dest;
+    int x, k, limit;
+    
+    for(k = 0; k < WaveTable::NUM_LEVELS; k++) {
+        memcpy(re, spec_re, sizeof(re));
+        memcpy(im, spec_im, sizeof(im));
+        dest = this->levels + WaveTable::level_offset(k);
+        limit = (nyquist - 1) >> k; // highest harmonic kept
+        for(x = limit + 1; x < (n - limit); x++) {
+            re[x] = 0.0;
+            im[x] = 0.0;
+        }
+        table_fft().inverse(re, im);
+        for(x = 0; x < n; x++) dest[x] = re[x] * norm;
+        // guard points
+        dest[-1] = dest[n - 1];
+        dest[n] = dest[0];
+        dest[n + 1] = dest[1];
+        dest[n + 2] = dest[2];
     }
 }
@@ -10,14 +10,31 @@
 #define wavetable_h
 
 #include <math.h>
+#include <stdint.h>
 
 class WaveTableConstants {
 public:
-    static const int TABLE_SIZE = 400;
-    static const int HIGHEST_HARMONIC = 10;
+    static const int TABLE_BITS = 11;
+    static const int TABLE_SIZE = 1 << TABLE_BITS; // power of two, for the FFT
+    static const int HIGHEST_HARMONIC = 10; // harmonics set by custom_wave
+    static const int MAX_HARMONIC = (TABLE_SIZE / 2) - 1; // below Nyquist
     constexpr static const float SINE_MAX_AMP = 0.5;
-    constexpr static const float CUSTOM_MAX_AMP = 0.01;
+    constexpr static const float CUSTOM_MAX_AMP = 0.25; // peak bound
     constexpr static const float SQUARE_MAX_AMP = 0.05;
+    // mipmap level k is band-limited for pitch increments up to 2^k
+    static const int NUM_LEVELS = 10;
+    // each level has one guard point before it and three after, so the
+    // interpolators never wrap an index
+    static const int LEVEL_STRIDE = TABLE_SIZE + 4;
+    // phase is a 32-bit fixed point fraction of a cycle: the top TABLE_BITS
+    // index the table and the FRAC_BITS below interpolate between entries
+    static const int FRAC_BITS = 32 - TABLE_BITS;
+    static const uint32_t FRAC_MASK = (1u << FRAC_BITS) - 1;
+    constexpr static const float FRAC_SCALE = 1.0 / (1 << FRAC_BITS);
+    // INTERPOLATION MODES
+    static const int INTERP_TRUNCATE = 0;
+    static const int INTERP_LINEAR = 1;
+    static const int INTERP_CUBIC = 2; // 4-point Hermite
 };
 
 /*
@@ -27,10 +44,18 @@ public:
      * sine wave
      * pseudo square wave
      * custom wave (user defined)
+     * any spectrum of harmonic amplitudes and phases
+   Each waveform is also stored as a set of band-limited copies, one per
+   octave of playback pitch (mipmap levels), stored back to back so a
+   voice can address any level from one base pointer.
 */
 class WaveTable : public WaveTableConstants {
+    void fill_sine(float*);
+    void build_mipmaps();
+    void synthesize(const float*, const float*);
 public:
-    float *table; // table for wavetable synthesis
+    float *levels; // NUM_LEVELS band-limited tables, LEVEL_STRIDE apart
+    float *table; // table for wavetable synthesis (full band)
     int *harmonic_amplitudes; // for custom synth
     WaveTable();
     ~WaveTable();
@@ -38,6 +63,35 @@ public:
     void sine_wave();
     void square_wave();
     void custom_wave();
+    void set_spectrum(const float*, const float*, int);
+    const float *level(int);
+    static int level_for(float);
+    static int level_offset(int);
+    static uint32_t phase_increment(float);
+    // table readers, t from level(): inline, they run once per sample
+    static inline float read_truncate(const float *t, uint32_t phase) {
+        return t[phase >> FRAC_BITS];
+    }
+    static inline float read_linear(const float *t, uint32_t phase) {
+        const float *p = t + (phase >> FRAC_BITS);
+        float f = (phase & FRAC_MASK) * FRAC_SCALE;
+        return p[0] + (f * (p[1] - p[0]));
+    }
+    static inline float read_cubic(const float *t, uint32_t phase) {
+        const float *p = t + (phase >> FRAC_BITS);
+        float f = (phase & FRAC_MASK) * FRAC_SCALE;
+        float c1 = 0.5f * (p[1] - p[-1]);
+        float c2 = p[-1] - (2.5f * p[0]) + (2.0f * p[1]) - (0.5f * p[2]);
+        float c3 = (0.5f * (p[2] - p[-1])) + (1.5f * (p[0] - p[1]));
+        return (((((c3 * f) + c2) * f) + c1) * f) + p[0];
+    }
+    static inline float read(const float *t, uint32_t phase, int mode) {
+        switch(mode) {
+            case INTERP_TRUNCATE: return read_truncate(t, phase);
+            case INTERP_CUBIC: return read_cubic(t, phase);
+            default: return read_linear(t, phase);
+        }
+    }
 };
 
 #endif /* wavetable_h */
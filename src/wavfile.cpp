@@ -0,0 +1,162 @@
+//
+//  wavfile.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "wavfile.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ Little-endian field writers for the RIFF header
+*/
+static void put_u16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+/*
+ WavWriter default constructor
+*/
+WavWriter::WavWriter() {
+    this->file = NULL;
+    this->format = WavWriter::FORMAT_WAV;
+    this->sample_rate = 0;
+    this->num_channels = 0;
+    this->frames_written = 0;
+}
+
+/*
+ WavWriter destructor
+*/
+WavWriter::~WavWriter() {
+    this->close();
+}
+
+/*
+ Open a file for writing
+   TAKES:
+     path         --> const char * output file path
+     sample_rate  --> int sample rate in Hz
+     num_channels --> int number of interleaved channels
+     format       --> FORMAT_WAV or FORMAT_RAW
+   RETURNS:
+     0 on success, 1 if the file could not be opened
+*/
+int WavWriter::open(const char *path, int sample_rate, int num_channels,
+                    int format) {
+    this->close();
+    this->file = fopen(path, "wb");
+    if(this->file == NULL) return 1;
+    this->format = format;
+    this->sample_rate = sample_rate;
+    this->num_channels = num_channels;
+    this->frames_written = 0;
+    if(this->format == WavWriter::FORMAT_WAV) this->write_header();
+    return 0;
+}
+
+/*
+ Append interleaved frames
+   TAKES:
+     data   --> const float * interleaved samples
+     frames --> number of frames in data
+   RETURNS:
+     0 on success, 1 on a short write
+*/
+int WavWriter::write(const float *data, unsigned long frames) {
+    size_t n = frames * this->num_channels;
+    
+    if(this->file == NULL) return 1;
+    if(fwrite(data, sizeof(float), n, this->file) != n) return 1;
+    this->frames_written += frames;
+    return 0;
+}
+
+/*
+ Patch the header (WAV only) and close the file
+   RETURNS:
+     0 on success, 1 on error
+*/
+int WavWriter::close() {
+    int err = 0;
+    
+    if(this->file == NULL) return 0;
+    if(this->format == WavWriter::FORMAT_WAV) {
+        if(fseek(this->file, 0, SEEK_SET) == 0) {
+            this->write_header();
+        } else {
+            err = 1;
+        }
+    }
+    if(fclose(this->file) != 0) err = 1;
+    this->file = NULL;
+    return err;
+}
+
+/*
+ Number of frames written so far
+*/
+unsigned long WavWriter::frames() {
+    return this->frames_written;
+}
+
+/*
+ Write a 44 byte IEEE float WAV header for the frames written so far
+*/
+void WavWriter::write_header() {
+    unsigned char h[WavWriter::WAV_HEADER_SIZE];
+    
+    WavWriter::make_header(h, WavWriter::WAV_HEADER_SIZE, this->sample_rate,
+                           this->num_channels, this->frames_written);
+    fwrite(h, 1, WavWriter::WAV_HEADER_SIZE, this->file);
+}
+
+/*
+ Build an IEEE float WAV header.  A header longer than WAV_HEADER_SIZE
+ is padded with a JUNK chunk, so the samples can start on an aligned
+ offset.
+   TAKES:
+     h            --> unsigned char * size bytes to fill
+     size         --> int header length: WAV_HEADER_SIZE, or at least
+                      8 bytes more
+     sample_rate  --> int sample rate in Hz
+     num_channels --> int number of interleaved channels
+     frames       --> unsigned long frames in the data chunk
+*/
+void WavWriter::make_header(unsigned char *h, int size, int sample_rate,
+                            int num_channels, unsigned long frames) {
+    uint32_t block_align = num_channels * sizeof(float);
+    uint32_t data_size = (uint32_t)(frames * block_align);
+    int junk = size - WavWriter::WAV_HEADER_SIZE;
+    unsigned char *d = h + 36 + junk; // data chunk header
+    
+    put_u32(h, 0x46464952);             // "RIFF"
+    put_u32(h + 4, size - 8 + data_size);
+    put_u32(h + 8, 0x45564157);         // "WAVE"
+    put_u32(h + 12, 0x20746d66);        // "fmt "
+    put_u32(h + 16, 16);
+    put_u16(h + 20, 3);                 // WAVE_FORMAT_IEEE_FLOAT
+    put_u16(h + 22, num_channels);
+    put_u32(h + 24, sample_rate);
+    put_u32(h + 28, sample_rate * block_align);
+    put_u16(h + 32, block_align);
+    put_u16(h + 34, 32);
+    if(junk > 0) {
+        memset(h + 36, 0, junk);
+        put_u32(h + 36, 0x4b4e554a);    // "JUNK"
+        put_u32(h + 40, junk - 8);
+    }
+    put_u32(d, 0x61746164);             // "data"
+    put_u32(d + 4, data_size);
+}
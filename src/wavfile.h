@@ -0,0 +1,45 @@
+//
+//  wavfile.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef wavfile_h
+#define wavfile_h
+
+#include <stdio.h>
+
+class WavFileConstants {
+public:
+    static const int FORMAT_WAV = 0; // float32 RIFF/WAVE
+    static const int FORMAT_RAW = 1; // headerless interleaved float32
+    static const int WAV_HEADER_SIZE = 44;
+};
+
+/*
+ Class WavWriter:
+   Writes interleaved float32 audio to disk, either as an IEEE float
+   WAV file or as raw samples.  The WAV header is patched with the final
+   sizes when the file is closed.
+*/
+class WavWriter : public WavFileConstants {
+    FILE *file;
+    int format;
+    int sample_rate;
+    int num_channels;
+    unsigned long frames_written;
+    // helper method(s)
+    void write_header();
+public:
+    WavWriter();
+    ~WavWriter();
+    int open(const char*, int, int, int format=WavWriter::FORMAT_WAV);
+    int write(const float*, unsigned long);
+    int close();
+    unsigned long frames();
+    static void make_header(unsigned char*, int, int, int, unsigned long);
+};
+
+#endif /* wavfile_h */
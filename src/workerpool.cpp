@@ -0,0 +1,160 @@
+//
+//  workerpool.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#include "workerpool.h"
+#include "denormals.h"
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// storage for constants passed by reference (unoptimized builds)
+const int WorkerPoolConstants::PARK_TIMEOUT_MS;
+
+/*
+ Pause hint for spin loops
+*/
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ WorkerPool constructor: starts the worker threads
+   TAKES:
+     num_workers --> int helper threads (0 to MAX_WORKERS), capped at one
+                     less than the number of cores
+*/
+WorkerPool::WorkerPool(int num_workers) : num_tasks(0), generation(0), next(0),
+pending(0), sleepers(0), quit(false) {
+    int ncpu = (int)std::thread::hardware_concurrency();
+    if(ncpu > 0 && num_workers > ncpu - 1) num_workers = ncpu - 1;
+    if(num_workers < 0) num_workers = 0;
+    if(num_workers > WorkerPool::MAX_WORKERS) num_workers = WorkerPool::MAX_WORKERS;
+    this->num_workers = num_workers;
+    this->task = NULL;
+    this->task_data = NULL;
+    for(int i = 0; i < this->num_workers; i++) {
+        this->threads[i] = std::thread(&WorkerPool::worker_loop, this, i);
+    }
+}
+
+/*
+ WorkerPool destructor: stops and joins the workers
+*/
+WorkerPool::~WorkerPool() {
+    this->quit.store(true);
+    {
+        std::lock_guard<std::mutex> lock(this->park_mutex);
+    }
+    this->park_cond.notify_all();
+    for(int i = 0; i < this->num_workers; i++) {
+        this->threads[i].join();
+    }
+}
+
+/*
+ Number of helper threads
+*/
+int WorkerPool::size() {
+    return this->num_workers;
+}
+
+/*
+ Run a batch of tasks and return when all of them are done (audio thread)
+   TAKES:
+     task      --> Task called once for each index in [0, num_tasks)
+     data      --> void * passed through to task
+     num_tasks --> int number of tasks
+*/
+void WorkerPool::run(Task task, void *data, int num_tasks) {
+    unsigned g = this->generation.load(std::memory_order_relaxed) + 1;
+    
+    this->task = task;
+    this->task_data = data;
+    this->num_tasks.store(num_tasks, std::memory_order_relaxed);
+    this->pending.store(num_tasks, std::memory_order_relaxed);
+    this->next.store((uint64_t)g << 32, std::memory_order_release);
+    this->generation.store(g, std::memory_order_seq_cst);
+    if(this->sleepers.load(std::memory_order_seq_cst) > 0) {
+        this->park_cond.notify_all();
+    }
+    // help out, then wait for tasks claimed by workers
+    this->run_tasks(g);
+    while(this->pending.load(std::memory_order_acquire) > 0) cpu_relax();
+}
+
+/*
+ Claim and run tasks from one batch until none are left.  The batch
+ generation is part of the claim counter, so a worker that arrives late
+ can never claim an index from the following batch by mistake.
+   TAKES:
+     g --> unsigned generation of the batch to work on
+*/
+void WorkerPool::run_tasks(unsigned g) {
+    uint64_t cur = this->next.load(std::memory_order_acquire);
+    uint64_t index;
+    
+    while((unsigned)(cur >> 32) == g) {
+        index = cur & 0xffffffff;
+        if(index >= (uint64_t)this->num_tasks.load(std::memory_order_relaxed)) return;
+        if(this->next.compare_exchange_weak(cur, cur + 1,
+                                            std::memory_order_acq_rel)) {
+            this->task((int)index, this->task_data);
+            this->pending.fetch_sub(1, std::memory_order_acq_rel);
+            cur = this->next.load(std::memory_order_acquire);
+        }
+    }
+}
+
+/*
+ Worker thread body: pin, spin-then-park between batches
+*/
+void WorkerPool::worker_loop(int index) {
+    unsigned seen = this->generation.load(std::memory_order_acquire);
+    int spin;
+#ifdef __linux__
+    // pin to its own core, leaving the first core for the audio callback
+    cpu_set_t cpus;
+    int ncpu = (int)std::thread::hardware_concurrency();
+    struct sched_param param;
+    if(ncpu > 1) {
+        CPU_ZERO(&cpus);
+        CPU_SET(1 + (index % (ncpu - 1)), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    param.sched_priority = WorkerPool::WORKER_PRIORITY;
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param); // best effort
+#else
+    (void) index;
+#endif
+    flush_denormals();
+    while(!this->quit.load(std::memory_order_acquire)) {
+        for(spin = 0; spin < WorkerPool::SPIN_ITERATIONS; spin++) {
+            if(this->generation.load(std::memory_order_acquire) != seen) break;
+            cpu_relax();
+        }
+        if(this->generation.load(std::memory_order_acquire) == seen) {
+            // park; the timeout covers a wakeup racing with the check
+            std::unique_lock<std::mutex> lock(this->park_mutex);
+            this->sleepers.fetch_add(1, std::memory_order_seq_cst);
+            while(this->generation.load(std::memory_order_seq_cst) == seen &&
+                  !this->quit.load()) {
+                this->park_cond.wait_for(lock,
+                    std::chrono::milliseconds(WorkerPool::PARK_TIMEOUT_MS));
+            }
+            this->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+        }
+        seen = this->generation.load(std::memory_order_acquire);
+        this->run_tasks(seen);
+    }
+}
@@ -0,0 +1,63 @@
+//
+//  workerpool.h
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+
+#ifndef workerpool_h
+#define workerpool_h
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class WorkerPoolConstants {
+public:
+    static const int MAX_WORKERS = 8;
+    static const int SPIN_ITERATIONS = 20000; // before a worker parks
+    static const int PARK_TIMEOUT_MS = 10;
+    static const int WORKER_PRIORITY = 70;    // SCHED_FIFO, if permitted
+};
+
+/*
+ Class WorkerPool:
+   Preallocated helper threads for the audio callback.  run() publishes a
+   batch of independent tasks; the workers and the calling thread all
+   claim tasks from a shared atomic counter until none are left, then the
+   caller waits for the stragglers.  Workers spin briefly after a batch
+   and then park on a condition variable.  Because the caller also runs
+   tasks, a worker that wakes late only costs parallelism, never progress.
+*/
+class WorkerPool : public WorkerPoolConstants {
+public:
+    typedef void (*Task)(int, void*); // task index, user data
+private:
+    std::thread threads[MAX_WORKERS];
+    int num_workers;
+    // current batch, written before next is published
+    Task task;
+    void *task_data;
+    std::atomic<int> num_tasks;
+    std::atomic<unsigned> generation;
+    std::atomic<uint64_t> next; // batch generation << 32 | next task index
+    std::atomic<int> pending;   // tasks not yet finished
+    // parking
+    std::atomic<int> sleepers;
+    std::atomic<bool> quit;
+    std::mutex park_mutex;
+    std::condition_variable park_cond;
+    // helper method(s)
+    void worker_loop(int);
+    void run_tasks(unsigned);
+public:
+    WorkerPool(int);
+    ~WorkerPool();
+    void run(Task, void*, int);
+    int size();
+};
+
+#endif /* workerpool_h */
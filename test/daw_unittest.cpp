@@ -7,11 +7,887 @@
 //
 
 #include "../src/wavetable.h"
+#include "../src/eventqueue.h"
+#include "../src/eventloop.h"
+#include "../src/midifile.h"
+#include "../src/osc.h"
+#include "../src/recorder.h"
+#include "../src/sampler.h"
+#include "../src/dspgraph.h"
+#include "../src/mixer.h"
+#include "../src/rcu.h"
+#include "../src/parameter.h"
+#include "../src/instrument.h"
 #include <fftw3.h>
+#include <math.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
 #include "gtest/gtest.h"
 
 namespace dawtest {
 
+TEST(EventQueue, FifoOrder) {
+    EventQueue<int, 8> q;
+    int x;
+    for(int i = 0; i < 5; i++) EXPECT_TRUE(q.push(i));
+    for(int i = 0; i < 5; i++) {
+        ASSERT_TRUE(q.pop(x));
+        EXPECT_EQ(i, x);
+    }
+    EXPECT_FALSE(q.pop(x));
+}
 
+TEST(EventQueue, RejectsWhenFull) {
+    EventQueue<int, 4> q;
+    int x;
+    for(int i = 0; i < 4; i++) EXPECT_TRUE(q.push(i));
+    EXPECT_FALSE(q.push(4));
+    EXPECT_EQ(4u, q.size());
+    ASSERT_TRUE(q.pop(x));
+    EXPECT_TRUE(q.push(4));
+}
+
+TEST(EventQueue, ProducerConsumerThreads) {
+    EventQueue<Event, 64> q;
+    const int n = 20000;
+    std::thread producer([&q, n]() {
+        Event ev;
+        for(int i = 0; i < n; i++) {
+            ev.type = i;
+            ev.value = i;
+            while(!q.push(ev)) std::this_thread::yield();
+        }
+    });
+    Event ev;
+    for(int i = 0; i < n; i++) {
+        while(!q.pop(ev)) std::this_thread::yield();
+        ASSERT_EQ(i, ev.value);
+        ASSERT_EQ(i, ev.type); // no torn copies
+    }
+    producer.join();
+}
+
+TEST(EventQueue, StagedItemsWaitForPublish) {
+    EventQueue<int, 8> q;
+    int x;
+    EXPECT_TRUE(q.stage(1));
+    EXPECT_TRUE(q.stage(2));
+    EXPECT_FALSE(q.pop(x)); // nothing handed over yet
+    q.publish();
+    ASSERT_TRUE(q.pop(x));
+    EXPECT_EQ(1, x);
+    ASSERT_TRUE(q.pop(x));
+    EXPECT_EQ(2, x);
+    EXPECT_FALSE(q.pop(x));
+}
+
+static Event at_frame(int value, unsigned long frame) {
+    Event ev;
+    ev.type = Event::EVENT_NOTE;
+    ev.instrument = NULL;
+    ev.value = value;
+    ev.frame = frame;
+    return ev;
+}
+
+TEST(EventSchedule, ReleasesEventsInFrameOrder) {
+    EventSchedule<8> s;
+    Event ev;
+    unsigned long next;
+    s.insert(at_frame(1, 300));
+    s.insert(at_frame(2, 100));
+    s.insert(at_frame(3, 300)); // same frame: stays behind 1
+    s.insert(at_frame(4, 0));
+    ASSERT_TRUE(s.next(next));
+    EXPECT_EQ(0UL, next);
+    ASSERT_TRUE(s.due(50, ev));
+    EXPECT_EQ(4, ev.value);
+    EXPECT_FALSE(s.due(50, ev)); // next is at 100
+    ASSERT_TRUE(s.due(300, ev));
+    EXPECT_EQ(2, ev.value);
+    ASSERT_TRUE(s.due(300, ev));
+    EXPECT_EQ(1, ev.value);
+    ASSERT_TRUE(s.due(300, ev));
+    EXPECT_EQ(3, ev.value);
+    EXPECT_FALSE(s.next(next));
+}
+
+TEST(EventSchedule, ReusesSpaceAsEventsLeave) {
+    EventSchedule<4> s;
+    Event ev;
+    for(int i = 0; i < 4; i++) EXPECT_TRUE(s.insert(at_frame(i, i)));
+    EXPECT_FALSE(s.insert(at_frame(9, 9)));
+    ASSERT_TRUE(s.due(1, ev));
+    ASSERT_TRUE(s.due(1, ev));
+    EXPECT_TRUE(s.insert(at_frame(5, 2))); // after the pending event on frame 2
+    EXPECT_TRUE(s.insert(at_frame(6, 1)));
+    int expect[] = {6, 2, 5, 3};
+    for(int i = 0; i < 4; i++) {
+        ASSERT_TRUE(s.due(10, ev));
+        EXPECT_EQ(expect[i], ev.value);
+    }
+}
+
+static void count_read(int fd, void *data) {
+    char c;
+    if(read(fd, &c, 1) == 1) (*(int*)data)++;
+}
+
+static void count_tick(int, void *data) {
+    (*(int*)data)++;
+}
+
+TEST(EventLoop, RunsHandlerWhenFdIsReadable) {
+    EventLoop loop;
+    int fds[2];
+    int count = 0;
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(0, loop.add_fd(fds[0], count_read, &count));
+    EXPECT_EQ(0, loop.run_once(0)); // nothing to read
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    EXPECT_EQ(1, loop.run_once(1000));
+    EXPECT_EQ(1, count);
+    loop.remove_fd(fds[0]);
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    EXPECT_EQ(0, loop.run_once(0));
+    EXPECT_EQ(1, count);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(EventLoop, TimersRepeatUntilRemoved) {
+    EventLoop loop;
+    int ticks = 0;
+    int id = loop.add_timer(1, count_tick, &ticks);
+    ASSERT_GE(id, 0);
+    while(ticks < 3) ASSERT_GE(loop.run_once(), 0); // poll() sleeps until due
+    loop.remove_timer(id);
+    EXPECT_EQ(0, loop.run_once(5));
+    EXPECT_EQ(3, ticks);
+}
+
+TEST(EventLoop, StopWakesABlockedLoop) {
+    EventLoop loop;
+    std::thread stopper([&loop]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        loop.stop();
+    });
+    while(loop.is_running()) ASSERT_GE(loop.run_once(), 0); // no sources: blocks
+    stopper.join();
+    EXPECT_FALSE(loop.is_running());
+}
+
+// format 1, 96 ticks per quarter: a tempo track that doubles the tempo
+// after one quarter, and a note track in running status
+static const unsigned char TWO_TRACKS[] = {
+    'M','T','h','d', 0,0,0,6, 0,1, 0,2, 0,96,
+    'M','T','r','k', 0,0,0,18,
+    0x00, 0xff,0x51,0x03, 0x07,0xa1,0x20,       // 500000 us per quarter
+    0x60, 0xff,0x51,0x03, 0x03,0xd0,0x90,       // 250000 from tick 96
+    0x00, 0xff,0x2f,0x00,
+    'M','T','r','k', 0,0,0,19,
+    0x00, 0x90, 69, 100,                        // A4 (440 Hz) at 0 s
+    0x60, 69, 0,                                // off (velocity 0) at 0.5 s
+    0x00, 0x80, 72, 64,                         // C4 off, part never started
+    0x60, 0x90, 72, 100,                        // on at 0.75 s
+    0x00, 0xff,0x2f,0x00,
+};
+
+// as locals, so EXPECT_EQ can bind them by reference
+const int A4 = Instrument::A4, C4 = Instrument::C4;
+
+TEST(MidiFile, NotesFollowTheTempoMap) {
+    MidiFile f;
+    ASSERT_EQ(0, f.parse(TWO_TRACKS, sizeof(TWO_TRACKS), 1000));
+    const std::vector<MidiFile::Note> &n = f.events();
+    ASSERT_EQ(4u, n.size());
+    EXPECT_EQ(1, f.parts());
+    EXPECT_EQ(0UL, n[0].frame);
+    EXPECT_EQ(A4, n[0].note);
+    EXPECT_TRUE(n[0].on);
+    EXPECT_EQ(500UL, n[1].frame);
+    EXPECT_FALSE(n[1].on);
+    EXPECT_EQ(500UL, n[2].frame);
+    EXPECT_EQ(C4, n[2].note);
+    EXPECT_FALSE(n[2].on);
+    EXPECT_EQ(750UL, n[3].frame);
+    EXPECT_TRUE(n[3].on);
+    EXPECT_EQ(0, n[3].part);
+}
+
+TEST(MidiFile, RejectsOtherFiles) {
+    MidiFile f;
+    const unsigned char riff[] = {'R','I','F','F', 0,0,0,0, 'W','A','V','E', 0,0};
+    EXPECT_EQ(1, f.parse(riff, sizeof(riff), 44100));
+    EXPECT_EQ(1, f.parse(TWO_TRACKS, 30, 44100)); // truncated
+}
+
+struct OscSeen {
+    int count;
+    char address[4][32];
+    uint64_t time[4];
+    int note[4];
+};
+
+static void collect_osc(const OscMessage &msg, void *data) {
+    OscSeen *seen = (OscSeen*)data;
+    if(seen->count >= 4) return;
+    strncpy(seen->address[seen->count], msg.address, 31);
+    seen->time[seen->count] = msg.time;
+    if(!msg.get_int(0, &seen->note[seen->count])) seen->note[seen->count] = -1;
+    seen->count++;
+}
+
+// a bundle at 2^32 holding /note/on 48, then a nested immediate bundle
+// holding /1/timbre "sine"
+static const unsigned char OSC_BUNDLE[] = {
+    '#','b','u','n','d','l','e',0, 0,0,0,1, 0,0,0,0,
+    0,0,0,20,
+    '/','n','o','t','e','/','o','n',0,0,0,0, ',','i',0,0, 0,0,0,48,
+    0,0,0,44,
+    '#','b','u','n','d','l','e',0, 0,0,0,0, 0,0,0,1,
+    0,0,0,24,
+    '/','1','/','t','i','m','b','r','e',0,0,0, ',','s',0,0, 's','i','n','e',0,0,0,0,
+};
+
+TEST(OscReader, WalksNestedBundles) {
+    OscSeen seen;
+    seen.count = 0;
+    ASSERT_EQ(0, OscReader::parse(OSC_BUNDLE, sizeof(OSC_BUNDLE), collect_osc, &seen));
+    ASSERT_EQ(2, seen.count);
+    EXPECT_EQ(0, strcmp("/note/on", seen.address[0]));
+    EXPECT_EQ((uint64_t)1 << 32, seen.time[0]);
+    EXPECT_EQ(48, seen.note[0]);
+    EXPECT_EQ(0, strcmp("/1/timbre", seen.address[1]));
+    EXPECT_EQ((uint64_t)1, seen.time[1]);
+    EXPECT_EQ(-1, seen.note[1]); // a string is not an int
+}
+
+struct OscArgs {
+    float f;
+    int i;
+    bool s_is_int;
+    const char *s;
+};
+
+static void read_args(const OscMessage &msg, void *data) {
+    OscArgs *a = (OscArgs*)data;
+    int x;
+    EXPECT_EQ(3, msg.count());
+    EXPECT_TRUE(msg.get_float(0, &a->f));
+    a->s_is_int = msg.get_int(1, &x);
+    a->s = msg.get_string(1);
+    EXPECT_TRUE(msg.get_int(2, &a->i));
+}
+
+TEST(OscReader, ReadsArgumentsInPlace) {
+    // /g ,fsi 0.5 "hi" -7
+    const unsigned char packet[] = {
+        '/','g',0,0, ',','f','s','i',0,0,0,0,
+        0x3f,0,0,0, 'h','i',0,0, 0xff,0xff,0xff,0xf9,
+    };
+    OscArgs a;
+    ASSERT_EQ(0, OscReader::parse(packet, sizeof(packet), read_args, &a));
+    EXPECT_FLOAT_EQ(0.5, a.f);
+    EXPECT_FALSE(a.s_is_int);
+    EXPECT_EQ((const char*)packet + 16, a.s); // points into the packet
+    EXPECT_EQ(-7, a.i);
+}
+
+TEST(OscReader, RejectsMalformedPackets) {
+    OscSeen seen;
+    seen.count = 0;
+    const unsigned char unpadded[] = {'/','a','b','c'}; // no terminator
+    const unsigned char short_bundle[] = {
+        '#','b','u','n','d','l','e',0, 0,0,0,0, 0,0,0,1, 0,0,0,64, 0,0,0,0,
+    };
+    EXPECT_EQ(1, OscReader::parse(unpadded, sizeof(unpadded), collect_osc, &seen));
+    EXPECT_EQ(1, OscReader::parse(short_bundle, sizeof(short_bundle), collect_osc, &seen));
+    EXPECT_EQ(1, OscReader::parse(OSC_BUNDLE, sizeof(OSC_BUNDLE) - 2, collect_osc, &seen));
+    EXPECT_EQ(0, seen.count);
+}
+
+TEST(OscReader, NotesOutOfRangeAreNotPlayable) {
+    // /note/on 2147483647, well formed but no note: counted as malformed
+    const unsigned char huge[] = {
+        '/','n','o','t','e','/','o','n',0,0,0,0, ',','i',0,0, 0x7f,0xff,0xff,0xff,
+    };
+    OscSeen seen;
+    seen.count = 0;
+    ASSERT_EQ(0, OscReader::parse(huge, sizeof(huge), collect_osc, &seen));
+    ASSERT_EQ(1, seen.count);
+    EXPECT_FALSE(Instrument::playable(seen.note[0]));
+    EXPECT_FALSE(Instrument::playable(Instrument::HIGHEST_NOTE + 1));
+    EXPECT_FALSE(Instrument::playable(-1));
+    EXPECT_TRUE(Instrument::playable(48)); // from OSC_BUNDLE
+    EXPECT_TRUE(Instrument::playable(0));
+}
+
+TEST(Recorder, WritesAlignedWavThatReadsBack) {
+    const char *path = "recorder_unittest.wav";
+    const unsigned long frames = 40000; // two full chunks and a partial one
+    float block[2 * 100];
+    Recorder rec;
+    ASSERT_EQ(0, rec.open(path, 44100, 2, Recorder::FORMAT_WAV, 1));
+    for(unsigned long f = 0; f < frames; f += 100) {
+        for(int i = 0; i < 100; i++) {
+            block[2 * i] = (float)(f + i);
+            block[2 * i + 1] = -(float)(f + i);
+        }
+        rec.write(block, 100);
+        if(f % 8000 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    rec.write_silence(10);
+    ASSERT_EQ(0, rec.close());
+    EXPECT_EQ(0UL, rec.get_overruns());
+    EXPECT_EQ(frames + 10, rec.get_written());
+    
+    FILE *f = fopen(path, "rb");
+    ASSERT_TRUE(f != NULL);
+    unsigned char h[Recorder::ALIGN];
+    ASSERT_EQ((size_t)Recorder::ALIGN, fread(h, 1, sizeof(h), f));
+    EXPECT_EQ(0, memcmp(h, "RIFF", 4));
+    EXPECT_EQ(0, memcmp(h + 36, "JUNK", 4));
+    EXPECT_EQ(0, memcmp(h + Recorder::ALIGN - 8, "data", 4)); // samples aligned
+    uint32_t data_size = h[Recorder::ALIGN - 4] | (h[Recorder::ALIGN - 3] << 8) |
+                         (h[Recorder::ALIGN - 2] << 16) | (h[Recorder::ALIGN - 1] << 24);
+    EXPECT_EQ((frames + 10) * 2 * sizeof(float), data_size);
+    std::vector<float> data((frames + 10) * 2);
+    ASSERT_EQ(data.size(), fread(&data[0], sizeof(float), data.size(), f));
+    EXPECT_EQ(EOF, fgetc(f)); // reserved space given back
+    fclose(f);
+    remove(path);
+    for(unsigned long i = 0; i < frames; i += 997) {
+        EXPECT_EQ((float)i, data[2 * i]);
+        EXPECT_EQ(-(float)i, data[2 * i + 1]);
+    }
+    EXPECT_EQ(0.0, data[2 * frames]);
+}
+
+TEST(Recorder, DropsBlocksThatDoNotFit) {
+    const char *path = "recorder_unittest.raw";
+    std::vector<float> big(2 * 3 * Recorder::CHUNK_FRAMES, 0.5);
+    Recorder rec;
+    ASSERT_EQ(0, rec.open(path, 44100, 2, Recorder::FORMAT_RAW, 0)); // 2 chunks
+    rec.write(&big[0], 3 * Recorder::CHUNK_FRAMES); // larger than the ring
+    rec.write(&big[0], 100);
+    ASSERT_EQ(0, rec.close());
+    EXPECT_EQ(1UL, rec.get_overruns());
+    EXPECT_EQ(3UL * Recorder::CHUNK_FRAMES, rec.get_dropped());
+    EXPECT_EQ(100UL, rec.get_written());
+    remove(path);
+}
+
+static void put_le(unsigned char *p, uint32_t v, int bytes) {
+    for(int i = 0; i < bytes; i++) p[i] = (v >> (8 * i)) & 0xff;
+}
+
+// 16-bit PCM WAV with every channel holding value(frame)
+static void write_pcm16(const char *path, int frames, int channels, int (*value)(int)) {
+    const uint32_t data_size = 2 * channels * frames;
+    unsigned char h[44];
+    FILE *f = fopen(path, "wb");
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + data_size, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2); // PCM
+    put_le(h + 22, channels, 2);
+    put_le(h + 24, 44100, 4);
+    put_le(h + 28, 44100 * 2 * channels, 4);
+    put_le(h + 32, 2 * channels, 2);
+    put_le(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, data_size, 4);
+    fwrite(h, 1, sizeof(h), f);
+    for(int i = 0; i < frames; i++) {
+        int16_t v = (int16_t)value(i);
+        for(int c = 0; c < channels; c++) fwrite(&v, sizeof(v), 1, f);
+    }
+    fclose(f);
+}
+
+static int saw(int i) {
+    return ((i * 7) % 2000) - 1000;
+}
+
+TEST(Sampler, StreamsPastTheHeadAtRootPitch) {
+    const char *path = "sampler_unittest.wav";
+    const int frames = 4 * Sampler::HEAD_FRAMES;
+    std::vector<float> wave(frames), out(frames + 512);
+    WavWriter w;
+    for(int i = 0; i < frames; i++) wave[i] = (float)(i % 1000) / 1000.0f - 0.5f;
+    ASSERT_EQ(0, w.open(path, 44100, 1));
+    ASSERT_EQ(0, w.write(&wave[0], frames));
+    ASSERT_EQ(0, w.close());
+    // live at about 5x realtime, then offline as fast as it goes
+    for(int offline = 0; offline < 2; offline++) {
+        Sampler s(1, 2);
+        s.set_envelope(Envelope(1, 1, Envelope::SUSTAIN_HOLD, 1, 1.0));
+        s.set_offline(offline == 1);
+        ASSERT_EQ(0, s.add_sample(path, 69)); // MIDI 69 is A4
+        s.trigger(Instrument::A4);
+        for(int f = 0; f < frames + 512; f += 256) {
+            s.render(&out[f], 256, 1);
+            if(!offline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(0UL, s.get_starvations());
+        EXPECT_GT(s.get_cache_hits() + s.get_cache_misses(), 0UL);
+        for(int i = 1; i < frames; i++) {
+            ASSERT_FLOAT_EQ(wave[i], out[i]) << "frame " << i;
+        }
+        EXPECT_EQ(0.0, out[frames + 1]);
+        EXPECT_EQ(0, s.active_voices()); // ended with its sample
+    }
+    remove(path);
+}
+
+TEST(Sampler, ShiftsPitchAndMapsKeys) {
+    const char *map = "sampler_unittest.map";
+    const char *path = "sampler_unittest_pcm.wav";
+    float out[3000];
+    FILE *f;
+    write_pcm16(path, 4000, 2, saw);
+    f = fopen(map, "w");
+    fprintf(f, "# one sample, middle C\n\n%s 60\n", path);
+    fclose(f);
+    Sampler s(1, 2);
+    s.set_envelope(Envelope(1, 1, Envelope::SUSTAIN_HOLD, 1, 1.0));
+    ASSERT_EQ(0, s.load(map));
+    EXPECT_EQ(1, s.num_samples());
+    s.trigger(72 - MidiFile::NOTE_OFFSET); // an octave up: every other frame
+    s.render(out, 3000, 1);
+    for(int i = 1; i < 2000; i++) {
+        ASSERT_FLOAT_EQ(saw(2 * i) / 32768.0f, out[i]) << "frame " << i;
+    }
+    EXPECT_EQ(0.0, out[2001]);
+    EXPECT_EQ(0, s.active_voices());
+    
+    // a ranged sample leaves other keys silent
+    Sampler ranged(1, 2);
+    ASSERT_EQ(0, ranged.add_sample(path, 60, 60, 72));
+    ranged.trigger(50 - MidiFile::NOTE_OFFSET);
+    ranged.render(out, 100, 1);
+    EXPECT_EQ(0.0, out[50]);
+    EXPECT_EQ(0, ranged.active_voices());
+    EXPECT_EQ(1, ranged.load("no_such_map"));
+    EXPECT_EQ(1, ranged.add_sample(map, 60)); // not a WAV file
+    remove(map);
+    remove(path);
+}
+
+struct Counted {
+    static int deleted;
+    ~Counted() { deleted++; }
+};
+int Counted::deleted = 0;
+
+// ops of the mix section that a bus returns through, by level
+static int find_return(DspSchedule *s, float level) {
+    for(int i = s->mix_begin; i < (int)s->ops.size(); i++) {
+        if(s->ops[i].type == DspGraph::OP_SEND && s->ops[i].dst == DspGraph::BUFFER_OUT &&
+           s->ops[i].track < 0 && s->ops[i].level == level) return i;
+    }
+    return -1;
+}
+
+TEST(DspGraph, OrdersBusesAndRejectsLoops) {
+    DspGraph g;
+    int a = g.add_bus(0.25), b = g.add_bus(0.5);
+    EXPECT_EQ(0, g.set_send(DspGraph::bus_node(b), a, 1.0));
+    EXPECT_EQ(1, g.set_send(DspGraph::bus_node(a), b, 1.0)); // would loop
+    EXPECT_EQ(1, g.set_send(0, 5, 1.0)); // bus not open
+    DspSchedule *s = g.compile();
+    ASSERT_TRUE(s != NULL);
+    // b feeds a, so b is finished first
+    EXPECT_LT(find_return(s, 0.5), find_return(s, 0.25));
+    EXPECT_EQ(0, g.remove_bus(b));
+    EXPECT_EQ(0, g.set_send(DspGraph::bus_node(a), g.add_bus(), 1.0));
+    delete s;
+}
+
+TEST(DspGraph, BusesShareBuffersOnceDone) {
+    DspGraph g;
+    int bus[4];
+    for(int i = 0; i < 4; i++) bus[i] = g.add_bus();
+    EXPECT_EQ(0, g.set_send(0, bus[0], 1.0));
+    for(int i = 0; i < 3; i++) {
+        EXPECT_EQ(0, g.set_send(DspGraph::bus_node(bus[i]), bus[i + 1], 1.0));
+    }
+    DspSchedule *s = g.compile();
+    // a chain only ever needs the bus being finished and the next one
+    EXPECT_EQ(2, s->num_scratch);
+    EXPECT_FALSE(s->has_inserts(0));
+    delete s;
+}
+
+// Instrument holding a constant level, for the mixer
+class ConstantInstrument : public Instrument {
+public:
+    bool on;
+    ConstantInstrument() : Instrument(2, 1), on(true) {}
+    void render(float *buf, unsigned long frames, int channels) {
+        for(unsigned long i = 0; i < frames * channels; i++) buf[i] = this->on ? 1.0 : 0.0;
+    }
+    bool silent() { return !this->on; }
+};
+
+// Effect adding a gain and an offset, for the graph
+class AffineEffect : public Effect {
+public:
+    float gain, offset;
+    AffineEffect(float gain, float offset) : gain(gain), offset(offset) {}
+    void process(float *buf, unsigned long frames, int channels) {
+        for(unsigned long i = 0; i < frames * channels; i++) {
+            buf[i] = (buf[i] * this->gain) + this->offset;
+        }
+    }
+};
+
+// level of the last frame after the master has faded in
+static float mix_level(Mixer &m) {
+    float out[2 * 1024];
+    for(int i = 0; i < 40; i++) m.mix(out, 1024, 2);
+    return out[2046];
+}
+
+TEST(Mixer, RunsInsertsAndSendsIntoTheMix) {
+    Mixer m;
+    ConstantInstrument inst;
+    AffineEffect half(0.5, 0.0);
+    int track = m.add_track(&inst);
+    int bus = m.add_bus(1.0);
+    m.fade_in(false);
+    EXPECT_EQ(0, m.add_insert(track, &half));
+    EXPECT_EQ(0, m.set_send(track, bus, 0.5));
+    // 0.5 through the fader, plus half of that through the bus
+    EXPECT_NEAR(0.75, mix_level(m), 1e-5);
+    EXPECT_EQ(0, m.add_insert(DspGraph::bus_node(bus), &half));
+    EXPECT_NEAR(0.625, mix_level(m), 1e-5);
+    EXPECT_EQ(0, m.remove_insert(track, &half));
+    EXPECT_EQ(1, m.remove_insert(track, &half));
+    EXPECT_NEAR(1.25, mix_level(m), 1e-5);
+    EXPECT_EQ(0, m.set_return(bus, 0.0));
+    EXPECT_NEAR(1.0, mix_level(m), 1e-5);
+}
+
+TEST(Mixer, SilentTracksRunTheirInserts) {
+    Mixer m;
+    ConstantInstrument inst;
+    AffineEffect tail(1.0, 0.25);
+    int track = m.add_track(&inst);
+    m.fade_in(false);
+    inst.on = false;
+    EXPECT_EQ(0.0, mix_level(m));
+    // an effect's tail still reaches the mix...
+    EXPECT_EQ(0, m.add_insert(track, &tail));
+    EXPECT_NEAR(0.25, mix_level(m), 1e-5);
+    // ...and on the master it sees the whole bus
+    EXPECT_EQ(0, m.add_insert(DspGraph::MASTER, &tail));
+    EXPECT_NEAR(0.5, mix_level(m), 1e-5);
+}
+
+TEST(Mixer, IgnoresGainAndPanThatAreNotNumbers) {
+    Mixer m;
+    ConstantInstrument inst;
+    int track = m.add_track(&inst);
+    m.fade_in(false);
+    m.set_gain(track, NAN);
+    m.set_gain(track, INFINITY);
+    m.set_pan(track, NAN);
+    EXPECT_NEAR(1.0, mix_level(m), 1e-5);
+    m.set_gain(track, 0.5);
+    EXPECT_NEAR(0.5, mix_level(m), 1e-5);
+}
+
+TEST(Mixer, RemoveWaitsOutAStalledCallback) {
+    Mixer m;
+    ConstantInstrument inst;
+    int track = m.add_track(&inst);
+    std::chrono::steady_clock::time_point t0;
+    m.set_running(true);
+    // an audio thread stuck well past any timeout, then two passes
+    std::thread audio([&m]() {
+        float out[2 * 256];
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        for(int i = 0; i < 2; i++) m.mix(out, 256, 2);
+    });
+    t0 = std::chrono::steady_clock::now();
+    m.remove_track(track);
+    EXPECT_TRUE(std::chrono::steady_clock::now() - t0 >= std::chrono::milliseconds(250));
+    audio.join();
+    // with the stream stopped there is nothing to wait for
+    m.set_running(false);
+    t0 = std::chrono::steady_clock::now();
+    m.remove_track(m.add_track(&inst));
+    EXPECT_TRUE(std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(50));
+}
+
+TEST(RcuPointer, ReclaimWaitsForReader) {
+    Counted::deleted = 0;
+    {
+        RcuPointer<Counted> p(new Counted());
+        Counted *seen = p.read_lock();
+        p.publish(new Counted());
+        EXPECT_EQ(1u, p.reclaim()); // reader still holds the old object
+        EXPECT_EQ(0, Counted::deleted);
+        p.read_unlock();
+        (void) seen;
+        EXPECT_EQ(0u, p.reclaim());
+        EXPECT_EQ(1, Counted::deleted);
+        EXPECT_NE(seen, p.read_lock());
+        p.read_unlock();
+    }
+    EXPECT_EQ(2, Counted::deleted);
+}
+
+TEST(RcuPointer, ReclaimAllWhenReaderIsStopped) {
+    Counted::deleted = 0;
+    {
+        RcuPointer<Counted> p(new Counted());
+        p.publish(new Counted());
+        EXPECT_EQ(1u, p.reclaim()); // no read section has ended since
+        p.reclaim_all();
+        EXPECT_EQ(1, Counted::deleted);
+    }
+    EXPECT_EQ(2, Counted::deleted);
+}
+
+TEST(SmoothedParameter, LinearRampReachesTarget) {
+    SmoothedParameter p(0.0, 1000);
+    float buf[100];
+    p.set(1.0, 250);
+    EXPECT_FALSE(p.is_settled());
+    for(int b = 0; b < 3; b++) {
+        for(int i = 0; i < 100; i++) buf[i] = 1.0;
+        p.apply(buf, 100, 1);
+        EXPECT_LT(buf[0], buf[99]); // still rising
+    }
+    EXPECT_TRUE(p.is_settled());
+    EXPECT_FLOAT_EQ(1.0, p.get());
+}
+
+TEST(SmoothedParameter, WaitReturnsWhenAudioSettles) {
+    SmoothedParameter p(1.0, 44100);
+    p.set(0.0, 4410, SmoothedParameter::RAMP_EXPONENTIAL);
+    std::thread audio([&p]() {
+        float buf[64];
+        while(!p.is_settled()) {
+            for(int i = 0; i < 64; i++) buf[i] = 1.0;
+            p.apply(buf, 64, 1);
+        }
+    });
+    p.wait();
+    audio.join();
+    EXPECT_EQ(0.0, p.get());
+}
+
+// notes as locals, so EXPECT_EQ can bind them by reference
+const int A3 = Instrument::A3, B3 = Instrument::B3, C3 = Instrument::C3;
+
+// Instrument with no sound of its own, for the voice allocator
+class SilentInstrument : public Instrument {
+public:
+    SilentInstrument(int num_v) : Instrument(2, num_v) {}
+    int note_of(int v) { return this->voices->note[v]; }
+    int used() { return this->voices->used; }
+};
+
+TEST(VoiceAllocator, DropsWhenFullWithoutStealing) {
+    SilentInstrument inst(2);
+    inst.set_steal_policy(Instrument::STEAL_NONE);
+    EXPECT_EQ(0, inst.trigger(A3));
+    EXPECT_EQ(0, inst.trigger(B3));
+    EXPECT_EQ(1, inst.trigger(C3));
+    EXPECT_EQ(1u, inst.get_drops());
+    EXPECT_EQ(0u, inst.get_steals());
+}
+
+TEST(VoiceAllocator, StealsOldest) {
+    SilentInstrument inst(2);
+    inst.set_steal_policy(Instrument::STEAL_OLDEST);
+    inst.trigger(A3);
+    inst.trigger(B3);
+    EXPECT_EQ(0, inst.trigger(C3));
+    EXPECT_EQ(1u, inst.get_steals());
+    EXPECT_EQ(2, inst.active_voices());
+    EXPECT_EQ(C3, inst.note_of(0));
+    EXPECT_EQ(B3, inst.note_of(1));
+}
+
+TEST(VoiceAllocator, StealsQuietest) {
+    SilentInstrument inst(2);
+    float buf[2 * 64];
+    inst.set_steal_policy(Instrument::STEAL_QUIETEST);
+    inst.trigger(A3);
+    inst.render(buf, 64, 2); // A3 is further into its attack, so louder
+    inst.trigger(B3);
+    inst.trigger(C3);
+    EXPECT_EQ(A3, inst.note_of(0));
+    EXPECT_EQ(C3, inst.note_of(1));
+}
+
+TEST(VoiceAllocator, SameNoteRetriggers) {
+    SilentInstrument inst(4);
+    inst.set_steal_policy(Instrument::STEAL_SAME_NOTE);
+    inst.trigger(A3);
+    inst.trigger(A3);
+    EXPECT_EQ(1, inst.active_voices());
+    EXPECT_EQ(1u, inst.get_steals());
+}
+
+TEST(VoiceAllocator, FinishedVoicesLeaveTheActiveList) {
+    SilentInstrument inst(8);
+    Envelope envelope;
+    float buf[2 * 256];
+    inst.trigger(A3);
+    inst.trigger(B3);
+    EXPECT_EQ(2, inst.used());
+    for(int i = 0; i <= envelope.length; i += 256) inst.render(buf, 256, 2);
+    EXPECT_EQ(0, inst.active_voices());
+    EXPECT_EQ(0, inst.used());
+}
+
+// runs one voice of an envelope for some samples, returns true if it finished
+bool run_envelope(Envelope &envelope, VoicePool &pool, int samples) {
+    bool finished = false;
+    for(int i = 0; i < samples && !finished; i++) {
+        finished = envelope.advance(&pool, 0);
+    }
+    return finished;
+}
+
+TEST(Envelope, LinearStagesLandOnTheirLevels) {
+    VoicePool pool(1, 1);
+    Envelope envelope(100, 200, Envelope::SUSTAIN_HOLD, 300, 0.5);
+    pool.start(pool.allocate(), A3);
+    envelope.start(&pool, 0);
+    run_envelope(envelope, pool, 100);
+    EXPECT_EQ(1.0f, pool.envelope_level[0]);
+    run_envelope(envelope, pool, 200);
+    EXPECT_EQ(0.5f, pool.envelope_level[0]);
+    EXPECT_FALSE(run_envelope(envelope, pool, 100000)); // held
+    EXPECT_EQ(0.5f, pool.envelope_level[0]);
+    envelope.release(&pool, 0);
+    EXPECT_FALSE(run_envelope(envelope, pool, 299));
+    EXPECT_TRUE(run_envelope(envelope, pool, 1));
+    EXPECT_EQ(0, pool.active[0]);
+    EXPECT_EQ(0.0f, pool.envelope_level[0]);
+}
+
+TEST(Envelope, ExponentialStagesLandOnTheirLevels) {
+    VoicePool pool(1, 1);
+    Envelope envelope(500, 2000, 100, 3000, 0.25, Envelope::CURVE_EXPONENTIAL);
+    pool.start(pool.allocate(), A3);
+    envelope.start(&pool, 0);
+    run_envelope(envelope, pool, 499);
+    EXPECT_LT(pool.envelope_level[0], 1.0f);
+    EXPECT_GT(pool.envelope_level[0], 0.99f);
+    run_envelope(envelope, pool, 1);
+    EXPECT_EQ(1.0f, pool.envelope_level[0]);
+    run_envelope(envelope, pool, 2000);
+    EXPECT_EQ(0.25f, pool.envelope_level[0]);
+    // sustain times out into the release
+    EXPECT_TRUE(run_envelope(envelope, pool, 100 + 3000));
+    EXPECT_EQ(0, pool.active[0]);
+}
+
+TEST(Envelope, ReleaseStartsFromCurrentLevel) {
+    VoicePool pool(1, 1);
+    Envelope envelope(100, 200, Envelope::SUSTAIN_HOLD, 400, 0.5);
+    pool.start(pool.allocate(), A3);
+    envelope.start(&pool, 0);
+    run_envelope(envelope, pool, 50);
+    float level = pool.envelope_level[0];
+    EXPECT_NEAR(0.5, level, 1e-4);
+    envelope.release(&pool, 0);
+    EXPECT_EQ((int)Envelope::STAGE_RELEASE, pool.envelope_stage[0]);
+    run_envelope(envelope, pool, 1);
+    EXPECT_LT(pool.envelope_level[0], level);
+    EXPECT_TRUE(run_envelope(envelope, pool, 400));
+}
+
+TEST(Envelope, ReleaseIsCulledBelowThreshold) {
+    VoicePool pool(1, 1);
+    Envelope envelope(10, 10, Envelope::SUSTAIN_HOLD, 1000, 1.0);
+    envelope.set_cull_level(0.5);
+    pool.start(pool.allocate(), A3);
+    envelope.start(&pool, 0);
+    run_envelope(envelope, pool, 20);
+    envelope.release(&pool, 0);
+    EXPECT_FALSE(run_envelope(envelope, pool, 499));
+    EXPECT_TRUE(run_envelope(envelope, pool, 1)); // halfway down, at 0.5
+    EXPECT_EQ(0.0f, pool.envelope_level[0]);
+}
+
+TEST(Envelope, InaudibleSustainEndsTheVoice) {
+    VoicePool pool(1, 1);
+    Envelope envelope(10, 10, Envelope::SUSTAIN_HOLD, 1000, 0.0);
+    pool.start(pool.allocate(), A3);
+    envelope.start(&pool, 0);
+    EXPECT_TRUE(run_envelope(envelope, pool, 20));
+}
+
+TEST(VoiceAllocator, SilentOnceVoicesFinish) {
+    SilentInstrument inst(2);
+    float buf[2 * 64];
+    inst.set_envelope(Envelope(10, 10, 10, 10, 0.5));
+    EXPECT_TRUE(inst.silent());
+    inst.trigger(A3);
+    EXPECT_FALSE(inst.silent());
+    inst.render(buf, 64, 2);
+    EXPECT_TRUE(inst.silent());
+}
+
+// peak of each channel over a rendered block
+void channel_peaks(Instrument &inst, float *left, float *right) {
+    float buf[2 * 512];
+    inst.render(buf, 512, 2);
+    *left = *right = 0.0;
+    for(int i = 0; i < 512; i++) {
+        if(fabs(buf[2 * i]) > *left) *left = fabs(buf[2 * i]);
+        if(fabs(buf[(2 * i) + 1]) > *right) *right = fabs(buf[(2 * i) + 1]);
+    }
+}
+
+TEST(VoicePan, ConstantPowerPan) {
+    float left, right, hard_left, hard_right;
+    WaveTableSynth center(2, 1), hard(2, 1);
+    center.set_envelope(Envelope(1, 1, Envelope::SUSTAIN_HOLD, 1, 1.0));
+    hard.set_envelope(Envelope(1, 1, Envelope::SUSTAIN_HOLD, 1, 1.0));
+    hard.set_pan(Instrument::PAN_LEFT);
+    center.trigger(A3);
+    hard.trigger(A3);
+    channel_peaks(center, &left, &right);
+    channel_peaks(hard, &hard_left, &hard_right);
+    EXPECT_NEAR(left, right, 1e-6);
+    EXPECT_GT(left, 0.01);
+    EXPECT_NEAR(0.0, hard_right, 1e-6);
+    // same power either way
+    EXPECT_NEAR((left * left) + (right * right), hard_left * hard_left, 1e-4);
+}
+
+TEST(VoicePan, SpreadScattersNotes) {
+    float left, right;
+    WaveTableSynth inst(2, 1);
+    inst.set_envelope(Envelope(1, 1, Envelope::SUSTAIN_HOLD, 1, 1.0));
+    inst.set_spread(1.0);
+    inst.trigger(A3); // first note sits hard left of centre
+    channel_peaks(inst, &left, &right);
+    EXPECT_GT(left, right * 10);
+}
+
+TEST(VoiceAllocator, NoteOffReleasesOnlyThatNote) {
+    SilentInstrument inst(4);
+    inst.set_envelope(Envelope(10, 10, Envelope::SUSTAIN_HOLD, 10, 0.5));
+    inst.trigger(A3);
+    inst.trigger(B3);
+    EXPECT_EQ(0, inst.release(A3));
+    EXPECT_EQ(1, inst.release(C3));
+    for(int i = 0; i < 100; i++) inst.advance();
+    EXPECT_EQ(1, inst.active_voices());
+    EXPECT_EQ(B3, inst.note_of(0));
+}
 
 } // dawtest
\ No newline at end of file
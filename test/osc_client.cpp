@@ -0,0 +1,130 @@
+//
+//  osc_client.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+//  Stands in for a control surface: sends OSC note bundles to a running
+//  littledaw at a fixed message rate, over UDP or the Unix socket.
+//
+//      osc_client [--port N | --unix PATH] [--rate MSGS] [--seconds S]
+//                 [--bundle N] [--ahead MS]
+//
+//  Each bundle holds N messages, alternating /note/on and /note/off over
+//  a two octave run, and is stamped MS milliseconds ahead (0 sends it
+//  "immediately").
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <thread>
+
+static const uint64_t NTP_UNIX_OFFSET = 2208988800ULL;
+
+static unsigned char *put_u32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+    return p + 4;
+}
+
+static unsigned char *put_string(unsigned char *p, const char *s) {
+    size_t n = strlen(s) + 1;
+    memcpy(p, s, n);
+    while(n & 3) p[n++] = 0;
+    return p + n;
+}
+
+static uint64_t ntp_time(double ahead_ms) {
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    us += (long long)(ahead_ms * 1000.0);
+    return (((uint64_t)(us / 1000000) + NTP_UNIX_OFFSET) << 32) +
+           (((uint64_t)(us % 1000000) << 32) / 1000000);
+}
+
+int main(int argc, char *argv[]) {
+    int port = 9000, rate = 1000, bundle = 8, fd, i;
+    double seconds = 5.0, ahead = 0.0;
+    const char *path = NULL;
+    unsigned char packet[8192], *p, *size;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+    struct sockaddr *to;
+    socklen_t to_len;
+    unsigned long sent = 0, failed = 0, total;
+    uint64_t tag;
+    int note = 36;
+    
+    for(i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "--port") == 0) port = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "--unix") == 0) path = argv[i + 1];
+        else if(strcmp(argv[i], "--rate") == 0) rate = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "--seconds") == 0) seconds = atof(argv[i + 1]);
+        else if(strcmp(argv[i], "--bundle") == 0) bundle = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "--ahead") == 0) ahead = atof(argv[i + 1]);
+    }
+    if(rate < 1 || bundle < 1 || bundle > 256) {
+        fprintf(stderr, "rate must be positive, bundle 1..256\n");
+        return 1;
+    }
+    if(path != NULL) {
+        fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+        to = (struct sockaddr*)&un;
+        to_len = sizeof(un);
+    } else {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons(port);
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        to = (struct sockaddr*)&in;
+        to_len = sizeof(in);
+    }
+    if(fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    total = (unsigned long)(rate * seconds);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(sent + failed < total) {
+        tag = (ahead > 0.0) ? ntp_time(ahead) : 1;
+        p = put_string(packet, "#bundle");
+        p = put_u32(p, tag >> 32);
+        p = put_u32(p, tag & 0xffffffff);
+        for(i = 0; i < bundle; i++) {
+            size = p;
+            p = put_string(p + 4, (i & 1) ? "/note/off" : "/note/on");
+            p = put_string(p, ",i");
+            p = put_u32(p, note);
+            put_u32(size, p - size - 4);
+            if(i & 1) note = (note < 60) ? note + 1 : 36;
+        }
+        if(sendto(fd, packet, p - packet, 0, to, to_len) < 0) {
+            failed += bundle;
+        } else {
+            sent += bundle;
+        }
+        // pace to the requested message rate
+        std::this_thread::sleep_until(start + std::chrono::microseconds(
+            (long long)((sent + failed) * 1000000.0 / rate)));
+    }
+    printf("sent %lu messages in %.2f s, %lu failed\n", sent,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+           failed);
+    close(fd);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,330 @@
+//
+//  synth_benchmark.cpp
+//  little-daw
+//
+//  Created by Zach Snyder on 11/26/17.
+//  Copyright © 2017 Zach Snyder. All rights reserved.
+//
+//  Microbenchmarks for the synthesis hot paths.  Prints one record per
+//  benchmark as JSON (default) or CSV (--csv), so results from different
+//  builds and boards can be diffed or loaded into a spreadsheet.
+//  ns_per_sample is per output frame for renders and mixes, per call for
+//  an envelope sample, and per table entry for wavetable rebuilds.  Interpolation
+//  benchmarks also report snr_db, the signal to error ratio of a sine
+//  read at an inharmonic pitch, to set cost against quality.
+//
+
+#include "../src/instrument.h"
+#include "../src/envelope.h"
+#include "../src/wavetable.h"
+#include "../src/mixer.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace synthbenchmark {
+
+const int SAMPLE_RATE = 44100;
+const int CHANNELS = 2;
+const int FRAMES = 192;
+const double MIN_SECONDS = 0.5; // wall time per benchmark
+
+struct Result {
+    std::string name;
+    long iterations;
+    double samples;  // frames (or operations) processed
+    double seconds;
+    double snr_db; // 0 when not measured
+};
+
+std::vector<Result> results;
+
+double now() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// keeps the optimizer from discarding benchmark output
+volatile float sink;
+
+/*
+ WaveTableSynth::render with a number of voices configured, some or all of
+ them sounding
+*/
+void bench_render(int num_voices, int sounding, bool reference) {
+    WaveTableSynth synth(CHANNELS, num_voices);
+    Envelope envelope;
+    float buffer[FRAMES * CHANNELS];
+    long iterations = 0;
+    double frames = 0, start, elapsed;
+    unsigned long since_trigger = envelope.length;
+    char name[64];
+    
+    if(reference) synth.set_kernel(VoiceKernel::reference(4));
+    start = now();
+    do {
+        // retrigger every voice as soon as the envelopes have run out
+        if(since_trigger > (unsigned long)envelope.length) {
+            for(int v = 0; v < sounding; v++) {
+                synth.trigger(Instrument::A3 + (v % 24));
+            }
+            since_trigger = 0;
+        }
+        synth.render(buffer, FRAMES, CHANNELS);
+        sink = buffer[0];
+        since_trigger += FRAMES;
+        frames += FRAMES;
+        iterations++;
+        elapsed = now() - start;
+    } while(elapsed < MIN_SECONDS);
+    if(sounding == num_voices) {
+        snprintf(name, sizeof(name), "wavetable_render_%d_voices_%s",
+                 num_voices, synth.kernel_name());
+    } else {
+        snprintf(name, sizeof(name), "wavetable_render_%d_of_%d_voices_%s",
+                 sounding, num_voices, synth.kernel_name());
+    }
+    Result r = {name, iterations, frames, elapsed};
+    results.push_back(r);
+}
+
+/*
+ Envelope::advance across a whole note, one voice a sample at a time
+*/
+void bench_envelope() {
+    Envelope envelope;
+    VoicePool pool(1, 1);
+    long iterations = 0;
+    double calls = 0, start, elapsed;
+    float acc = 0.0;
+    
+    pool.allocate();
+    start = now();
+    do {
+        pool.start(0, InstrumentConstants::A3);
+        envelope.start(&pool, 0);
+        for(int pos = 0; pos < envelope.length; pos++) {
+            envelope.advance(&pool, 0);
+            acc += pool.envelope_level[0];
+        }
+        calls += envelope.length;
+        iterations++;
+        elapsed = now() - start;
+    } while(elapsed < MIN_SECONDS);
+    sink = acc;
+    Result r = {"envelope_advance", iterations, calls, elapsed};
+    results.push_back(r);
+}
+
+/*
+ WaveTable::custom_wave rebuild, all harmonics in use
+*/
+void bench_custom_wave() {
+    WaveTable table;
+    long iterations = 0;
+    double start, elapsed;
+    
+    for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
+        table.harmonic_amplitudes[i] = 100 - (i * 7);
+    }
+    start = now();
+    do {
+        table.custom_wave();
+        sink = table.table[1];
+        iterations++;
+        elapsed = now() - start;
+    } while(elapsed < MIN_SECONDS);
+    Result r = {"wavetable_custom_wave", iterations,
+                (double)iterations * WaveTable::TABLE_SIZE, elapsed};
+    results.push_back(r);
+}
+
+/*
+ WaveTable::set_spectrum rebuild with every harmonic below Nyquist
+*/
+void bench_spectrum() {
+    static float amplitudes[WaveTable::MAX_HARMONIC];
+    static float phases[WaveTable::MAX_HARMONIC];
+    WaveTable table;
+    long iterations = 0;
+    double start, elapsed;
+    
+    for(int h = 0; h < WaveTable::MAX_HARMONIC; h++) {
+        amplitudes[h] = 0.25 / (h + 1); // sawtooth
+        phases[h] = 0.1 * h;
+    }
+    start = now();
+    do {
+        table.set_spectrum(amplitudes, phases, WaveTable::MAX_HARMONIC);
+        sink = table.table[1];
+        iterations++;
+        elapsed = now() - start;
+    } while(elapsed < MIN_SECONDS);
+    Result r = {"wavetable_spectrum_full", iterations,
+                (double)iterations * WaveTable::TABLE_SIZE, elapsed};
+    results.push_back(r);
+}
+
+// Instrument that only fills its buffer, so the mixer cost dominates
+class ConstantInstrument : public Instrument {
+    bool idle;
+public:
+    ConstantInstrument(bool idle) : Instrument(CHANNELS, 0), idle(idle) {}
+    void render(float *out, unsigned long frames, int channels) {
+        for(unsigned long i = 0; i < frames * channels; i++) out[i] = 0.25;
+    }
+    bool silent() { return this->idle; }
+};
+
+/*
+ Mixer::mix summing a number of tracks, or passing over idle ones
+*/
+void bench_mixer(int num_tracks, bool idle) {
+    Mixer mixer(SAMPLE_RATE);
+    std::vector<ConstantInstrument*> instruments;
+    float buffer[FRAMES * CHANNELS];
+    long iterations = 0;
+    double frames = 0, start, elapsed;
+    char name[64];
+    
+    for(int i = 0; i < num_tracks; i++) {
+        instruments.push_back(new ConstantInstrument(idle));
+        mixer.add_track(instruments[i]);
+        mixer.set_pan(i, -1.0 + (2.0 * i) / num_tracks);
+    }
+    mixer.fade_in(false);
+    start = now();
+    do {
+        mixer.mix(buffer, FRAMES, CHANNELS);
+        sink = buffer[0];
+        frames += FRAMES;
+        iterations++;
+        elapsed = now() - start;
+    } while(elapsed < MIN_SECONDS);
+    snprintf(name, sizeof(name), idle ? "mixer_mix_%d_idle_tracks" : "mixer_mix_%d_tracks",
+             num_tracks);
+    Result r = {name, iterations, frames, elapsed};
+    results.push_back(r);
+    for(int i = 0; i < num_tracks; i++) {
+        mixer.remove_track(i);
+        delete instruments[i];
+    }
+}
+
+/*
+ Cost and quality of each interpolation mode: WaveTableSynth::render cost
+ with 6 voices, and the error of a sine table read against the exact sine
+*/
+void bench_interpolation(int mode) {
+    const char *names[] = {"truncate", "linear", "cubic"};
+    WaveTable table;
+    WaveTableSynth synth(CHANNELS, Instrument::DEFAULT_NUM_VOICES);
+    Envelope envelope;
+    float buffer[FRAMES * CHANNELS];
+    long iterations = 0;
+    double frames = 0, start, elapsed;
+    double signal = 0.0, noise = 0.0, exact, e;
+    unsigned long since_trigger = envelope.length;
+    uint32_t phase = 0;
+    uint32_t inc = WaveTable::phase_increment(17.3191); // ~372 Hz
+    const float *t;
+    char name[64];
+    
+    table.sine_wave();
+    t = table.level(WaveTable::level_for(17.3191));
+    for(int i = 0; i < SAMPLE_RATE; i++) {
+        exact = WaveTable::SINE_MAX_AMP * sin(2.0 * M_PI * (phase / 4294967296.0));
+        e = WaveTable::read(t, phase, mode) - exact;
+        signal += exact * exact;
+        noise += e * e;
+        phase += inc;
+    }
+    synth.set_interpolation(mode);
+    start = now();
+    do {
+        if(since_trigger > (unsigned long)envelope.length) {
+            for(int v = 0; v < Instrument::DEFAULT_NUM_VOICES; v++) {
+                synth.trigger(Instrument::A3 + (v * 5));
+            }
+            since_trigger = 0;
+        }
+        synth.render(buffer, FRAMES, CHANNELS);
+        sink = buffer[0];
+        since_trigger += FRAMES;
+        frames += FRAMES;
+        iterations++;
+        elapsed = now() - start;
+    } while(elapsed < MIN_SECONDS);
+    snprintf(name, sizeof(name), "interpolation_%s", names[mode]);
+    Result r = {name, iterations, frames, elapsed,
+                10.0 * log10(signal / (noise + 1e-30))};
+    results.push_back(r);
+}
+
+const char *arch() {
+#if defined(__x86_64__)
+    return "x86_64";
+#elif defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#else
+    return "unknown";
+#endif
+}
+
+void print_json() {
+    printf("{\n  \"arch\": \"%s\",\n  \"compiler\": \"%s\",\n", arch(), __VERSION__);
+    printf("  \"sample_rate\": %d,\n  \"frames_per_buffer\": %d,\n", SAMPLE_RATE, FRAMES);
+    printf("  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); i++) {
+        Result &r = results[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %ld, "
+               "\"ns_per_sample\": %.3f, \"samples_per_sec\": %.0f",
+               r.name.c_str(), r.iterations, 1e9 * r.seconds / r.samples,
+               r.samples / r.seconds);
+        if(r.snr_db != 0) printf(", \"snr_db\": %.1f", r.snr_db);
+        printf("}%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+void print_csv() {
+    printf("name,arch,iterations,ns_per_sample,samples_per_sec,snr_db\n");
+    for(size_t i = 0; i < results.size(); i++) {
+        Result &r = results[i];
+        printf("%s,%s,%ld,%.3f,%.0f,", r.name.c_str(), arch(), r.iterations,
+               1e9 * r.seconds / r.samples, r.samples / r.seconds);
+        if(r.snr_db != 0) printf("%.1f", r.snr_db);
+        printf("\n");
+    }
+}
+
+} // synthbenchmark
+
+int main(int argc, char *argv[]) {
+    using namespace synthbenchmark;
+    int voices[] = {1, 6, 32, 128};
+    int tracks[] = {1, 4, 16};
+    
+    for(int i = 0; i < 4; i++) bench_render(voices[i], voices[i], false);
+    bench_render(128, 128, true);
+    bench_render(128, 6, false);
+    bench_envelope();
+    bench_custom_wave();
+    bench_spectrum();
+    for(int m = WaveTable::INTERP_TRUNCATE; m <= WaveTable::INTERP_CUBIC; m++) {
+        bench_interpolation(m);
+    }
+    for(int i = 0; i < 3; i++) bench_mixer(tracks[i], false);
+    bench_mixer(16, true);
+    if(argc > 1 && strcmp(argv[1], "--csv") == 0) {
+        print_csv();
+    } else {
+        print_json();
+    }
+    return 0;
+}
@@ -7,6 +7,9 @@
 //
 
 #include "../src/wavetable.h"
+#include "../src/fft.h"
+#include "../src/voicekernel.h"
+#include <string.h>
 #include <fftw3.h>
 #include "gtest/gtest.h"
 
@@ -23,4 +26,154 @@ TEST_F(WaveTableWaveForms, SineWave) {}
 TEST_F(WaveTableWaveForms, SquareWave) {}
 TEST_F(WaveTableWaveForms, CustomWave) {}
 
+// energy of harmonic h in one table cycle
+double harmonic_power(const float *t, int h) {
+    double a = 0.0, b = 0.0;
+    for(int x = 0; x < WaveTable::TABLE_SIZE; x++) {
+        a += t[x] * cos(2.0 * M_PI * h * x / WaveTable::TABLE_SIZE);
+        b += t[x] * sin(2.0 * M_PI * h * x / WaveTable::TABLE_SIZE);
+    }
+    return (a * a) + (b * b);
+}
+
+TEST_F(WaveTableWaveForms, MipmapsAreBandLimited) {
+    table.square_wave();
+    for(int k = 0; k < WaveTable::NUM_LEVELS; k++) {
+        int limit = (WaveTable::TABLE_SIZE / 2) >> k;
+        const float *level = table.level(k);
+        EXPECT_GT(harmonic_power(level, 1), 1.0);
+        for(int h = limit + 1; h < WaveTable::TABLE_SIZE / 2; h += 7) {
+            EXPECT_LT(harmonic_power(level, h), 1e-6) << "level " << k << " h " << h;
+        }
+    }
+}
+
+TEST_F(WaveTableWaveForms, CustomWaveIsHarmonicSeries) {
+    for(int i = 0; i < WaveTable::HIGHEST_HARMONIC; i++) {
+        table.harmonic_amplitudes[i] = 0;
+    }
+    table.harmonic_amplitudes[0] = 50;
+    table.harmonic_amplitudes[2] = 50; // third harmonic, not an octave
+    table.custom_wave();
+    EXPECT_GT(harmonic_power(table.table, 1), 1.0);
+    EXPECT_GT(harmonic_power(table.table, 3), 1.0);
+    EXPECT_LT(harmonic_power(table.table, 2), 1e-6);
+    EXPECT_LT(harmonic_power(table.table, 4), 1e-6);
+}
+
+TEST_F(WaveTableWaveForms, SpectrumPhases) {
+    float amplitudes[2] = {0.25, 0.125};
+    float phases[2] = {(float)(M_PI / 2), 0.0}; // cosine fundamental
+    table.set_spectrum(amplitudes, phases, 2);
+    for(int x = 0; x < WaveTable::TABLE_SIZE; x += 61) {
+        double t = 2.0 * M_PI * x / WaveTable::TABLE_SIZE;
+        EXPECT_NEAR((0.25 * cos(t)) + (0.125 * sin(2 * t)), table.table[x], 1e-5);
+    }
+}
+
+TEST_F(WaveTableWaveForms, SpectrumUpToNyquist) {
+    static float amplitudes[WaveTable::TABLE_SIZE];
+    for(int h = 0; h < WaveTable::TABLE_SIZE; h++) amplitudes[h] = 0.001;
+    table.set_spectrum(amplitudes, NULL, WaveTable::TABLE_SIZE);
+    EXPECT_GT(harmonic_power(table.table, WaveTable::MAX_HARMONIC), 0.1);
+    EXPECT_LT(harmonic_power(table.level(1), WaveTable::MAX_HARMONIC), 1e-6);
+}
+
+// worst error of a reader against the exact sine, over a sweep of phases
+double sine_error(WaveTable &table, int mode) {
+    const float *t = table.level(0);
+    double worst = 0.0;
+    uint32_t phase = 12345;
+    for(int i = 0; i < 100000; i++) {
+        double exact = WaveTable::SINE_MAX_AMP * sin(2.0 * M_PI * (phase / 4294967296.0));
+        double e = fabs(WaveTable::read(t, phase, mode) - exact);
+        if(e > worst) worst = e;
+        phase += 2654435761u; // spreads phases over the whole cycle
+    }
+    return worst;
+}
+
+TEST_F(WaveTableWaveForms, InterpolationAccuracy) {
+    table.sine_wave();
+    double truncated = sine_error(table, WaveTable::INTERP_TRUNCATE);
+    double linear = sine_error(table, WaveTable::INTERP_LINEAR);
+    double cubic = sine_error(table, WaveTable::INTERP_CUBIC);
+    EXPECT_LT(truncated, 2e-3);
+    EXPECT_LT(linear, truncated / 100);
+    EXPECT_LT(cubic, linear);
+}
+
+TEST_F(WaveTableWaveForms, GuardPointsWrap) {
+    table.square_wave();
+    const float *t = table.level(2);
+    EXPECT_EQ(t[WaveTable::TABLE_SIZE - 1], t[-1]);
+    EXPECT_EQ(t[0], t[WaveTable::TABLE_SIZE]);
+    EXPECT_EQ(t[2], t[WaveTable::TABLE_SIZE + 2]);
+    // the last entry interpolates back toward the first
+    uint32_t last = 0xFFFFFFFFu;
+    EXPECT_NEAR(t[0], WaveTable::read_linear(t, last), 1e-4);
+}
+
+// every kernel on this CPU must match the scalar reference of its width
+TEST_F(WaveTableWaveForms, VoiceKernelsBitExact) {
+    const int frames = 300;
+    VoiceKernel kernels[VoiceKernel::MAX_KERNELS];
+    int count = VoiceKernel::available(kernels);
+    int32_t offsets[8];
+    uint32_t incs[8], phases[8], ref_phases[8];
+    float env[8], ref_env[8], start[8], mul[8], add[8];
+    static float out[frames * 8], ref_out[frames * 8];
+    table.square_wave();
+    for(int l = 0; l < 8; l++) {
+        offsets[l] = WaveTable::level_offset(l % WaveTable::NUM_LEVELS);
+        incs[l] = WaveTable::phase_increment(1.0 + (l * 3.7));
+        start[l] = 0.1 * l;
+        mul[l] = (l % 2) ? 1.0 : 0.9995;
+        add[l] = (l % 2) ? 0.0001 : 0.0002;
+    }
+    for(int k = 0; k < count; k++) {
+        VoiceKernel ref = VoiceKernel::reference(kernels[k].lanes);
+        for(int mode = WaveTable::INTERP_TRUNCATE; mode <= WaveTable::INTERP_CUBIC; mode++) {
+            for(int l = 0; l < 8; l++) phases[l] = ref_phases[l] = 0x9E3779B9u * (l + 1);
+            for(int l = 0; l < 8; l++) env[l] = ref_env[l] = start[l];
+            kernels[k].run[mode](table.levels, offsets, phases, incs, env, mul, add, out, frames);
+            ref.run[mode](table.levels, offsets, ref_phases, incs, ref_env, mul, add, ref_out, frames);
+            EXPECT_EQ(0, memcmp(out, ref_out, sizeof(float) * frames * kernels[k].lanes))
+                << kernels[k].name << " mode " << mode;
+            EXPECT_EQ(0, memcmp(phases, ref_phases, sizeof(uint32_t) * kernels[k].lanes))
+                << kernels[k].name << " mode " << mode;
+            EXPECT_EQ(0, memcmp(env, ref_env, sizeof(float) * kernels[k].lanes))
+                << kernels[k].name << " mode " << mode;
+        }
+    }
+}
+
+TEST(FFTTransform, RoundTrip) {
+    const int n = 64;
+    FFT fft(n);
+    float re[n], im[n], x[n];
+    for(int i = 0; i < n; i++) {
+        x[i] = re[i] = (float)sin(i * 0.37) + (i % 5);
+        im[i] = 0.0;
+    }
+    fft.forward(re, im);
+    // bin 0 is the sum
+    float sum = 0.0;
+    for(int i = 0; i < n; i++) sum += x[i];
+    EXPECT_NEAR(sum, re[0], 1e-3);
+    fft.inverse(re, im);
+    for(int i = 0; i < n; i++) {
+        EXPECT_NEAR(x[i], re[i] / n, 1e-5);
+        EXPECT_NEAR(0.0, im[i] / n, 1e-5);
+    }
+}
+
+TEST(WaveTableMipmaps, LevelForPitch) {
+    EXPECT_EQ(0, WaveTable::level_for(0.5));
+    EXPECT_EQ(0, WaveTable::level_for(1.0));
+    EXPECT_EQ(1, WaveTable::level_for(1.5));
+    EXPECT_EQ(3, WaveTable::level_for(8.0));
+    EXPECT_EQ(WaveTable::NUM_LEVELS - 1, WaveTable::level_for(1e6));
+}
+
 } // wavetabletest